@@ -0,0 +1,511 @@
+// Counts the rays and cube tests of every frame, the engine leaves the counters out.
+#define ENGINE_TRACE_STATS
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#include <common.hpp>
+#include <memory.hpp>
+#include <options.hpp>
+#include <profile.hpp>
+#include <render.hpp>
+#include <scenes.hpp>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace Engine
+{
+    static constexpr const char *kBenchUsage =
+        "Usage: %s [bench options] [engine options]\n"
+        "  --scene cubes|grid|cloud|wall|sparse|all\n"
+        "                                      Scene to render, defaults to all\n"
+        "  --path orbit|dolly|pan|all          Camera path to follow, defaults to all\n"
+        "  --frames COUNT                      Measured frames per run, defaults to 120\n"
+        "  --warmup COUNT                      Frames rendered before measuring, defaults to 10\n"
+        "  --json                              Report as a JSON array instead of CSV\n"
+        "  --frame-times PATH                  Also write every measured frame time to PATH as CSV\n"
+        "  --stores-ab                         Run everything with streaming and then with ordinary window stores\n"
+        "Cache misses per frame come from the hardware counters where the kernel exposes them, empty otherwise.\n"
+        "Engine options such as --size and --aa apply to every run.\n";
+
+    static constexpr U32 kMaxBenchFrames = 100000;
+
+    struct BenchOptions
+    {
+        // kCount runs every scene or path.
+        ScenePreset m_scene = ScenePreset::kCount;
+        CameraPath m_path = CameraPath::kCount;
+        U32 m_numFrames = 120;
+        U32 m_numWarmupFrames = 10;
+        bool m_isJson = false;
+        bool m_isStoresAb = false;
+        const char *m_pFrameTimesPath = nullptr;
+    };
+
+    // Hardware cache events counted around the measured frames, so --stores-ab shows what streaming the window pixels
+    // does to the cache misses of the intersection loop, not only to the frame time.
+    enum class CacheEvent : U32
+    {
+        kL1dReadMisses,
+        kLlcReferences,
+        kLlcMisses,
+        kCount
+    };
+
+    static constexpr U32 kNumCacheEvents = static_cast<U32>(CacheEvent::kCount);
+
+    struct CacheCounts
+    {
+        U64 m_counts[kNumCacheEvents] = {};
+    };
+
+    // Every thread counts its own events, the workers of the OpenMP team open theirs in OpenCacheCounters.
+    inline thread_local int tCacheCounterFds[kNumCacheEvents] = {-1, -1, -1};
+
+    inline bool OpenCacheCounters()
+    {
+#if defined(__linux__)
+        bool isOpen = true;
+#pragma omp parallel
+        {
+            for (U32 iEvent = 0; iEvent < kNumCacheEvents; ++iEvent)
+            {
+                perf_event_attr attr{};
+                attr.size = sizeof(attr);
+                attr.exclude_kernel = 1;
+                attr.exclude_hv = 1;
+                switch (static_cast<CacheEvent>(iEvent))
+                {
+                    case CacheEvent::kL1dReadMisses:
+                        attr.type = PERF_TYPE_HW_CACHE;
+                        attr.config = PERF_COUNT_HW_CACHE_L1D | PERF_COUNT_HW_CACHE_OP_READ << 8 |
+                                      PERF_COUNT_HW_CACHE_RESULT_MISS << 16;
+                        break;
+                    case CacheEvent::kLlcReferences:
+                        attr.type = PERF_TYPE_HARDWARE;
+                        attr.config = PERF_COUNT_HW_CACHE_REFERENCES;
+                        break;
+                    default:
+                        attr.type = PERF_TYPE_HARDWARE;
+                        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+                        break;
+                }
+                tCacheCounterFds[iEvent] = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+                if (tCacheCounterFds[iEvent] < 0)
+                {
+                    __atomic_store_n(&isOpen, false, __ATOMIC_RELAXED);
+                }
+            }
+        }
+        return isOpen;
+#else
+        return false;
+#endif
+    }
+
+    // Sums and resets the counters of the OpenMP workers, like TakeTraceStats.
+    inline CacheCounts TakeCacheCounts()
+    {
+        CacheCounts total;
+#if defined(__linux__)
+#pragma omp parallel
+        {
+            for (U32 iEvent = 0; iEvent < kNumCacheEvents; ++iEvent)
+            {
+                U64 count = 0;
+                if (tCacheCounterFds[iEvent] >= 0 && read(tCacheCounterFds[iEvent], &count, sizeof(count)) ==
+                                                         static_cast<ssize_t>(sizeof(count)))
+                {
+                    __atomic_fetch_add(&total.m_counts[iEvent], count, __ATOMIC_RELAXED);
+                    ioctl(tCacheCounterFds[iEvent], PERF_EVENT_IOC_RESET, 0);
+                }
+            }
+        }
+#endif
+        return total;
+    }
+
+    inline void CloseCacheCounters()
+    {
+#if defined(__linux__)
+#pragma omp parallel
+        {
+            for (int &fd: tCacheCounterFds)
+            {
+                if (fd >= 0)
+                {
+                    close(fd);
+                    fd = -1;
+                }
+            }
+        }
+#endif
+    }
+
+    struct BenchResult
+    {
+        F64 m_meanMs;
+        F64 m_p50Ms;
+        F64 m_p95Ms;
+        F64 m_p99Ms;
+        F64 m_maxMs;
+        F64 m_raysPerSecond;
+        F64 m_cubeTestsPerSecond;
+        // Per measured frame, negative without hardware counters.
+        F64 m_cacheEventsPerFrame[kNumCacheEvents];
+    };
+
+    inline F64 Percentile(const F64 *sortedMs, const U32 count, const U32 percent)
+    {
+        // Nearest rank.
+        const U32 rank = (count * percent + 99) / 100;
+        return sortedMs[rank > 0 ? rank - 1 : 0];
+    }
+
+    template<typename Extent>
+    BenchResult RunBench(const Extent extent, const BenchOptions &options, const CameraPath path, const F32 radius,
+                         const bool hasCacheCounters, State &state, Targets &targets, U32 *pPixels, F64 *frameMs)
+    {
+        const Vec2f focus = FoveaFocus(state, -1, -1);
+        const U32 numFrames = options.m_numWarmupFrames + options.m_numFrames;
+        F64 totalMs = 0.0;
+        for (U32 iFrame = 0; iFrame < numFrames; ++iFrame)
+        {
+            SetCameraInWorld(state, CameraOnPath(path, radius, static_cast<F32>(iFrame) / static_cast<F32>(numFrames)));
+            if (iFrame == options.m_numWarmupFrames)
+            {
+                TakeTraceStats();
+                TakeCacheCounts();
+            }
+            const auto start = std::chrono::steady_clock::now();
+            RenderFrame(extent, state, targets, pPixels, nullptr, focus);
+            const auto end = std::chrono::steady_clock::now();
+            if (iFrame >= options.m_numWarmupFrames)
+            {
+                const F64 ms = std::chrono::duration<F64, std::milli>(end - start).count();
+                frameMs[iFrame - options.m_numWarmupFrames] = ms;
+                totalMs += ms;
+            }
+        }
+        const TraceStats stats = TakeTraceStats();
+        const CacheCounts cacheCounts = TakeCacheCounts();
+
+        F64 *sortedMs = frameMs + options.m_numFrames;
+        std::copy(frameMs, frameMs + options.m_numFrames, sortedMs);
+        std::sort(sortedMs, sortedMs + options.m_numFrames);
+        const F64 seconds = totalMs / 1000.0;
+        BenchResult result{
+            .m_meanMs = totalMs / options.m_numFrames,
+            .m_p50Ms = Percentile(sortedMs, options.m_numFrames, 50),
+            .m_p95Ms = Percentile(sortedMs, options.m_numFrames, 95),
+            .m_p99Ms = Percentile(sortedMs, options.m_numFrames, 99),
+            .m_maxMs = sortedMs[options.m_numFrames - 1],
+            .m_raysPerSecond = static_cast<F64>(stats.m_numRays) / seconds,
+            .m_cubeTestsPerSecond = static_cast<F64>(stats.m_numCubeTests) / seconds,
+            .m_cacheEventsPerFrame = {},
+        };
+        for (U32 iEvent = 0; iEvent < kNumCacheEvents; ++iEvent)
+        {
+            result.m_cacheEventsPerFrame[iEvent] =
+                hasCacheCounters ? static_cast<F64>(cacheCounts.m_counts[iEvent]) / options.m_numFrames : -1.0;
+        }
+        return result;
+    }
+
+    inline bool ParseCount(const char *value, const char *name, U32 &count)
+    {
+        char *end;
+        const U64 parsed = std::strtoull(value, &end, 10);
+        if (*end != '\0' || parsed > kMaxBenchFrames)
+        {
+            std::fprintf(stderr, "%s must be from 0 to %u: %s\n", name, kMaxBenchFrames, value);
+            return false;
+        }
+        count = static_cast<U32>(parsed);
+        return true;
+    }
+
+    // Takes the bench options out of argv, leaving the engine options for ParseArguments.
+    inline bool ParseBenchArguments(int &argc, char **argv, BenchOptions &options)
+    {
+        int numEngineArgs = 1;
+        for (int i = 1; i < argc; ++i)
+        {
+            const char *arg = argv[i];
+            const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+            if (std::strcmp(arg, "--scene") == 0 && value)
+            {
+                options.m_scene = ScenePreset::kCount;
+                for (U32 iScene = 0; iScene < static_cast<U32>(ScenePreset::kCount); ++iScene)
+                {
+                    if (std::strcmp(value, kScenePresetNames[iScene]) == 0)
+                    {
+                        options.m_scene = static_cast<ScenePreset>(iScene);
+                    }
+                }
+                if (options.m_scene == ScenePreset::kCount && std::strcmp(value, "all") != 0)
+                {
+                    std::fprintf(stderr, "Scene must be cubes, grid, cloud, wall, sparse or all: %s\n", value);
+                    return false;
+                }
+                ++i;
+            }
+            else if (std::strcmp(arg, "--path") == 0 && value)
+            {
+                options.m_path = CameraPath::kCount;
+                for (U32 iPath = 0; iPath < static_cast<U32>(CameraPath::kCount); ++iPath)
+                {
+                    if (std::strcmp(value, kCameraPathNames[iPath]) == 0)
+                    {
+                        options.m_path = static_cast<CameraPath>(iPath);
+                    }
+                }
+                if (options.m_path == CameraPath::kCount && std::strcmp(value, "all") != 0)
+                {
+                    std::fprintf(stderr, "Path must be orbit, dolly, pan or all: %s\n", value);
+                    return false;
+                }
+                ++i;
+            }
+            else if (std::strcmp(arg, "--frames") == 0 && value)
+            {
+                if (!ParseCount(value, "Frames", options.m_numFrames))
+                {
+                    return false;
+                }
+                if (options.m_numFrames == 0)
+                {
+                    std::fprintf(stderr, "At least one frame must be measured\n");
+                    return false;
+                }
+                ++i;
+            }
+            else if (std::strcmp(arg, "--warmup") == 0 && value)
+            {
+                if (!ParseCount(value, "Warmup frames", options.m_numWarmupFrames))
+                {
+                    return false;
+                }
+                ++i;
+            }
+            else if (std::strcmp(arg, "--json") == 0)
+            {
+                options.m_isJson = true;
+            }
+            else if (std::strcmp(arg, "--stores-ab") == 0)
+            {
+                options.m_isStoresAb = true;
+            }
+            else if (std::strcmp(arg, "--frame-times") == 0 && value)
+            {
+                options.m_pFrameTimesPath = value;
+                ++i;
+            }
+            else if (std::strcmp(arg, "--help") == 0)
+            {
+                std::fprintf(stderr, kBenchUsage, argv[0]);
+                std::fprintf(stderr, kUsage, argv[0]);
+                return false;
+            }
+            else
+            {
+                argv[numEngineArgs++] = argv[i];
+            }
+        }
+        argc = numEngineArgs;
+        return true;
+    }
+
+    // Empty in CSV and null in JSON when there are no hardware counters.
+    inline void FormatCacheEvents(const BenchResult &result, const bool isJson, char (&text)[kNumCacheEvents][32])
+    {
+        for (U32 iEvent = 0; iEvent < kNumCacheEvents; ++iEvent)
+        {
+            const F64 perFrame = result.m_cacheEventsPerFrame[iEvent];
+            if (perFrame < 0.0)
+            {
+                std::snprintf(text[iEvent], sizeof(text[iEvent]), "%s", isJson ? "null" : "");
+            }
+            else
+            {
+                std::snprintf(text[iEvent], sizeof(text[iEvent]), "%.0f", perFrame);
+            }
+        }
+    }
+
+    inline void PrintBenchResult(const BenchOptions &options, const State &state, const ScenePreset scene,
+                                 const CameraPath path, const BenchResult &result, const bool isFirst)
+    {
+        const char *sceneName = kScenePresetNames[static_cast<U32>(scene)];
+        const char *pathName = kCameraPathNames[static_cast<U32>(path)];
+        const char *storesName = state.m_isStreamingStores ? "stream" : "ordinary";
+        char cacheEvents[kNumCacheEvents][32];
+        FormatCacheEvents(result, options.m_isJson, cacheEvents);
+        if (options.m_isJson)
+        {
+            std::printf("%s\n  {\"scene\": \"%s\", \"path\": \"%s\", \"stores\": \"%s\", \"width\": %u, "
+                        "\"height\": %u, \"frames\": %u, \"mean_ms\": %.4f, \"p50_ms\": %.4f, \"p95_ms\": %.4f, "
+                        "\"p99_ms\": %.4f, \"max_ms\": %.4f, \"rays_per_s\": %.0f, \"cube_tests_per_s\": %.0f, "
+                        "\"l1d_read_misses_per_frame\": %s, \"llc_references_per_frame\": %s, "
+                        "\"llc_misses_per_frame\": %s}",
+                        isFirst ? "[" : ",", sceneName, pathName, storesName, state.m_width, state.m_height,
+                        options.m_numFrames, result.m_meanMs, result.m_p50Ms, result.m_p95Ms, result.m_p99Ms,
+                        result.m_maxMs, result.m_raysPerSecond, result.m_cubeTestsPerSecond, cacheEvents[0],
+                        cacheEvents[1], cacheEvents[2]);
+            return;
+        }
+        if (isFirst)
+        {
+            std::printf("scene,path,stores,width,height,frames,mean_ms,p50_ms,p95_ms,p99_ms,max_ms,rays_per_s,"
+                        "cube_tests_per_s,l1d_read_misses_per_frame,llc_references_per_frame,llc_misses_per_frame\n");
+        }
+        std::printf("%s,%s,%s,%u,%u,%u,%.4f,%.4f,%.4f,%.4f,%.4f,%.0f,%.0f,%s,%s,%s\n", sceneName, pathName, storesName,
+                    state.m_width, state.m_height, options.m_numFrames, result.m_meanMs, result.m_p50Ms,
+                    result.m_p95Ms, result.m_p99Ms, result.m_maxMs, result.m_raysPerSecond,
+                    result.m_cubeTestsPerSecond, cacheEvents[0], cacheEvents[1], cacheEvents[2]);
+    }
+
+    bool Bench(const BenchOptions &options, State &state, Targets &targets, U32 *pPixels, F64 *frameMs)
+    {
+        std::FILE *pFrameTimes = nullptr;
+        if (options.m_pFrameTimesPath)
+        {
+            pFrameTimes = std::fopen(options.m_pFrameTimesPath, "w");
+            if (!pFrameTimes)
+            {
+                std::fprintf(stderr, "Failed to open %s for the frame times\n", options.m_pFrameTimesPath);
+                return false;
+            }
+            std::fprintf(pFrameTimes, "scene,path,stores,frame,ms\n");
+        }
+        const bool hasCacheCounters = OpenCacheCounters();
+        if (!hasCacheCounters)
+        {
+            std::fprintf(stderr, "Hardware cache counters are not available, cache misses are not reported\n");
+        }
+        // Without --stores-ab the runs use the stores the engine options chose.
+        const bool isStreamingStores = state.m_isStreamingStores;
+        const U32 numStoreModes = options.m_isStoresAb ? 2 : 1;
+
+        bool isFirst = true;
+        for (U32 iScene = 0; iScene < static_cast<U32>(ScenePreset::kCount); ++iScene)
+        {
+            const ScenePreset scene = static_cast<ScenePreset>(iScene);
+            if (options.m_scene != ScenePreset::kCount && options.m_scene != scene)
+            {
+                continue;
+            }
+            const F32 radius = MakeScenePreset(state, scene);
+            for (U32 iPath = 0; iPath < static_cast<U32>(CameraPath::kCount); ++iPath)
+            {
+                const CameraPath path = static_cast<CameraPath>(iPath);
+                if (options.m_path != CameraPath::kCount && options.m_path != path)
+                {
+                    continue;
+                }
+                for (U32 iStoreMode = 0; iStoreMode < numStoreModes; ++iStoreMode)
+                {
+                    state.m_isStreamingStores = options.m_isStoresAb ? iStoreMode == 0 : isStreamingStores;
+                    // Every run starts from an empty history and the first jitter phase, whatever ran before it.
+                    targets.m_hasHistory = false;
+                    targets.m_frameIndex = 0;
+                    BenchResult result{};
+                    WithExtent(state.m_width, state.m_height, [&](const auto extent) {
+                        result = RunBench(extent, options, path, radius, hasCacheCounters, state, targets, pPixels,
+                                          frameMs);
+                    });
+                    PrintBenchResult(options, state, scene, path, result, isFirst);
+                    isFirst = false;
+                    for (U32 iFrame = 0; pFrameTimes && iFrame < options.m_numFrames; ++iFrame)
+                    {
+                        std::fprintf(pFrameTimes, "%s,%s,%s,%u,%.4f\n", kScenePresetNames[iScene],
+                                     kCameraPathNames[iPath], state.m_isStreamingStores ? "stream" : "ordinary",
+                                     iFrame, frameMs[iFrame]);
+                    }
+                }
+            }
+        }
+        CloseCacheCounters();
+        if (options.m_isJson)
+        {
+            std::printf("\n]\n");
+        }
+        return !pFrameTimes || std::fclose(pFrameTimes) == 0;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    using namespace Engine;
+
+    BenchOptions options;
+    if (!ParseBenchArguments(argc, argv, options))
+    {
+        return 1;
+    }
+
+    // Same layout as the engine, so --huge-pages measures the same thing.
+    const bool isHugePages = HasArgument(argc, argv, "--huge-pages");
+    constexpr std::size_t kTargetsOffset = AlignUp(sizeof(State), alignof(Targets));
+    const PageAllocation pages = AllocatePages(kTargetsOffset + sizeof(Targets), isHugePages);
+    if (!pages.m_pData)
+    {
+        std::fprintf(stderr, "Failed to allocate %zu bytes for the scene\n", pages.m_size);
+        return 1;
+    }
+    State *pState = new (pages.m_pData) State();
+    Targets *pTargets = new (static_cast<U8 *>(pages.m_pData) + kTargetsOffset) Targets();
+    pTargets->m_isHugePages = isHugePages;
+
+    bool isValid = ParseArguments(argc, argv, *pState) && ResizeTargets(*pTargets, pState->m_width, pState->m_height);
+    if (isValid && (pState->m_pRecordPath || pState->m_isSharingFrames || pState->m_pServeAddress ||
+                    pState->m_mjpegPort != 0))
+    {
+        std::fprintf(stderr, "The benchmark renders headless, recording, sharing and serving are not available\n");
+        isValid = false;
+    }
+
+    // Window pixels followed by the measured frame times and their sorted copy.
+    const std::size_t pixelsSize = AlignUp(std::size_t{pState->m_width} * pState->m_height * sizeof(U32), 64);
+    const PageAllocation frame = AllocatePages(pixelsSize + 2 * sizeof(F64) * options.m_numFrames, false);
+    if (isValid && !frame.m_pData)
+    {
+        std::fprintf(stderr, "Failed to allocate %zu bytes for the frame\n", frame.m_size);
+        isValid = false;
+    }
+    if (isValid && pState->m_pProfilePath)
+    {
+        StartProfiler();
+    }
+    if (isValid)
+    {
+        isValid = Bench(options, *pState, *pTargets, static_cast<U32 *>(frame.m_pData),
+                        reinterpret_cast<F64 *>(static_cast<U8 *>(frame.m_pData) + pixelsSize));
+    }
+    if (IsProfiling())
+    {
+        if (!WriteProfile(pState->m_pProfilePath))
+        {
+            std::fprintf(stderr, "Failed to write the profile to %s\n", pState->m_pProfilePath);
+            isValid = false;
+        }
+        StopProfiler();
+    }
+
+    FreePages(frame);
+    FreePages(pTargets->m_pages);
+    pState->~State();
+    pTargets->~Targets();
+    FreePages(pages);
+
+    return isValid ? 0 : 1;
+}
@@ -17,9 +17,20 @@ namespace Engine
     using I128 = __int128_t;
 
     using F32 = float;
+    using F64 = double;
 
     typedef float F32x2 __attribute__((__vector_size__(8), __aligned__(8)));
     typedef float F32x4 __attribute__((__vector_size__(16), __aligned__(16)));
+    typedef float F32x8 __attribute__((__vector_size__(32), __aligned__(32)));
+    typedef U8 U8x4 __attribute__((__vector_size__(4), __aligned__(4)));
+    typedef U8 U8x8 __attribute__((__vector_size__(8), __aligned__(8)));
+    typedef U8 U8x16 __attribute__((__vector_size__(16), __aligned__(16)));
+    typedef U16 U16x4 __attribute__((__vector_size__(8), __aligned__(8)));
+    typedef U16 U16x8 __attribute__((__vector_size__(16), __aligned__(16)));
+    typedef U32 U32x4 __attribute__((__vector_size__(16), __aligned__(16)));
+    typedef I32 I32x4 __attribute__((__vector_size__(16), __aligned__(16)));
+    typedef U32 U32x8 __attribute__((__vector_size__(32), __aligned__(32)));
+    typedef I32 I32x8 __attribute__((__vector_size__(32), __aligned__(32)));
 
     static constexpr F32 kPi = 3.1415927f;
     static constexpr F32 kTau = 6.2831853f;
@@ -69,6 +80,60 @@ namespace Engine
         return a > b ? a : b;
     }
 
+    constexpr I32 Min(const I32 a, const I32 b)
+    {
+        return a < b ? a : b;
+    }
+
+    constexpr I32 Max(const I32 a, const I32 b)
+    {
+        return a > b ? a : b;
+    }
+
+    constexpr U32 Min(const U32 a, const U32 b)
+    {
+        return a < b ? a : b;
+    }
+
+    constexpr U32 Max(const U32 a, const U32 b)
+    {
+        return a > b ? a : b;
+    }
+
+    constexpr I32 Clamp(const I32 value, const I32 lo, const I32 hi)
+    {
+        return value < lo ? lo : value > hi ? hi : value;
+    }
+
+    constexpr U32 Clamp(const U32 value, const U32 lo, const U32 hi)
+    {
+        return value < lo ? lo : value > hi ? hi : value;
+    }
+
+    constexpr F32x4 Min(const F32x4 a, const F32x4 b)
+    {
+        return a < b ? a : b;
+    }
+
+    constexpr F32x4 Max(const F32x4 a, const F32x4 b)
+    {
+        return a > b ? a : b;
+    }
+
+    // Low-discrepancy sequence used for per-frame subpixel jitter, returns values in [0, 1).
+    constexpr F32 Halton(U32 index, const U32 base)
+    {
+        F32 result = 0.0f;
+        F32 fraction = 1.0f;
+        while (index > 0)
+        {
+            fraction /= static_cast<F32>(base);
+            result += fraction * static_cast<F32>(index % base);
+            index /= base;
+        }
+        return result;
+    }
+
     template<U32 k1, U32 k2, U32 k3, U32 k4>
     constexpr F32x4 Shuffle(const F32x4 v)
     {
@@ -0,0 +1,286 @@
+#pragma once
+
+#include <cstddef>
+
+#include <common.hpp>
+
+namespace Engine
+{
+    // Pixel layouts the renderer can hand to encoders. The window itself is always BGRA.
+    enum class PixelFormat : U8
+    {
+        // 0xAARRGGBB words, bytes B, G, R, A in memory.
+        kBgra32,
+        // Little endian 5:6:5 words, red in the high bits.
+        kRgb565,
+        // Bytes R, G, B.
+        kRgb24,
+        // BT.601 limited range Y plane followed by quarter size U and V planes.
+        kI420,
+        // BT.601 limited range Y plane followed by one quarter size plane of interleaved U, V pairs.
+        kNv12,
+        kCount,
+    };
+
+    static constexpr const char *kPixelFormatNames[] = {"bgra", "rgb565", "rgb24", "i420", "nv12"};
+    static_assert(sizeof(kPixelFormatNames) / sizeof(kPixelFormatNames[0]) == static_cast<U32>(PixelFormat::kCount));
+
+    constexpr bool IsChromaSubsampled(const PixelFormat format)
+    {
+        return format == PixelFormat::kI420 || format == PixelFormat::kNv12;
+    }
+
+    constexpr std::size_t FrameImageSize(const PixelFormat format, const U32 width, const U32 height)
+    {
+        const std::size_t numPixels = static_cast<std::size_t>(width) * height;
+        switch (format)
+        {
+            case PixelFormat::kBgra32:
+                return numPixels * 4;
+            case PixelFormat::kRgb565:
+                return numPixels * 2;
+            case PixelFormat::kRgb24:
+                return numPixels * 3;
+            default:
+                return numPixels + numPixels / 2;
+        }
+    }
+
+    // Planes of a converted frame. Packed formats only use the first plane.
+    struct FrameImage
+    {
+        PixelFormat m_format;
+        U32 m_width;
+        U32 m_height;
+        U8 *m_pPlanes[3];
+        U32 m_strides[3];
+    };
+
+    // Lays the planes out back to back in pData, which must hold FrameImageSize bytes.
+    // Subsampled formats need even dimensions.
+    inline FrameImage MakeFrameImage(const PixelFormat format, const U32 width, const U32 height, U8 *pData)
+    {
+        FrameImage image{format, width, height, {pData, nullptr, nullptr}, {0, 0, 0}};
+        switch (format)
+        {
+            case PixelFormat::kBgra32:
+                image.m_strides[0] = width * 4;
+                break;
+            case PixelFormat::kRgb565:
+                image.m_strides[0] = width * 2;
+                break;
+            case PixelFormat::kRgb24:
+                image.m_strides[0] = width * 3;
+                break;
+            case PixelFormat::kI420:
+                image.m_strides[0] = width;
+                image.m_strides[1] = image.m_strides[2] = width / 2;
+                image.m_pPlanes[1] = pData + width * height;
+                image.m_pPlanes[2] = image.m_pPlanes[1] + width / 2 * (height / 2);
+                break;
+            default:
+                image.m_strides[0] = image.m_strides[1] = width;
+                image.m_pPlanes[1] = pData + width * height;
+                break;
+        }
+        return image;
+    }
+
+    inline void LoadChannels(const U32 *pSrc, I32x4 &r, I32x4 &g, I32x4 &b)
+    {
+        U32x4 pixels;
+        __builtin_memcpy(&pixels, pSrc, sizeof(pixels));
+        r = __builtin_convertvector(pixels >> 16 & 0xFFu, I32x4);
+        g = __builtin_convertvector(pixels >> 8 & 0xFFu, I32x4);
+        b = __builtin_convertvector(pixels & 0xFFu, I32x4);
+    }
+
+    // Fixed point BT.601, the results stay within [16, 240] so narrowing to bytes never wraps.
+    template<typename T>
+    constexpr T LumaY(const T r, const T g, const T b)
+    {
+        return ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+    }
+
+    template<typename T>
+    constexpr T ChromaU(const T r, const T g, const T b)
+    {
+        return ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+    }
+
+    template<typename T>
+    constexpr T ChromaV(const T r, const T g, const T b)
+    {
+        return ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+    }
+
+    inline void StoreLuma(U8 *pDst, const U32 *pSrc)
+    {
+        I32x4 r, g, b;
+        LoadChannels(pSrc, r, g, b);
+        const U8x4 y = __builtin_convertvector(LumaY(r, g, b), U8x4);
+        __builtin_memcpy(pDst, &y, sizeof(y));
+    }
+
+    inline void ConvertRowRgb565(const U32 *pSrc, U8 *pDst, const U32 count)
+    {
+        U32 x = 0;
+        for (; x + 4 <= count; x += 4)
+        {
+            U32x4 pixels;
+            __builtin_memcpy(&pixels, pSrc + x, sizeof(pixels));
+            const U32x4 packed = (pixels >> 8 & 0xF800u) | (pixels >> 5 & 0x07E0u) | (pixels >> 3 & 0x001Fu);
+            const U16x4 words = __builtin_convertvector(packed, U16x4);
+            __builtin_memcpy(pDst + x * 2, &words, sizeof(words));
+        }
+        for (; x < count; ++x)
+        {
+            const U32 pixel = pSrc[x];
+            const U16 word = static_cast<U16>((pixel >> 8 & 0xF800u) | (pixel >> 5 & 0x07E0u) | (pixel >> 3 & 0x001Fu));
+            __builtin_memcpy(pDst + x * 2, &word, sizeof(word));
+        }
+    }
+
+    inline void ConvertRowRgb24(const U32 *pSrc, U8 *pDst, const U32 count)
+    {
+        U32 x = 0;
+        for (; x + 4 <= count; x += 4)
+        {
+            U8x16 bytes;
+            __builtin_memcpy(&bytes, pSrc + x, sizeof(bytes));
+            // Swap red and blue and drop alpha, the last four lanes are not stored.
+            const U8x16 rgb = __builtin_shufflevector(bytes, bytes, 2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, 0, 0, 0, 0);
+            __builtin_memcpy(pDst + x * 3, &rgb, 12);
+        }
+        for (; x < count; ++x)
+        {
+            const U32 pixel = pSrc[x];
+            pDst[x * 3 + 0] = static_cast<U8>(pixel >> 16);
+            pDst[x * 3 + 1] = static_cast<U8>(pixel >> 8);
+            pDst[x * 3 + 2] = static_cast<U8>(pixel);
+        }
+    }
+
+    // Converts two source rows into two luma rows and one chroma row, chroma is the 2x2 box average.
+    // U and V are written every kUvStep bytes, 1 for planar and 2 for interleaved output. count must be even.
+    template<U32 kUvStep>
+    void ConvertRowPairYuv(const U32 *pSrc0, const U32 *pSrc1, U8 *pY0, U8 *pY1, U8 *pU, U8 *pV, const U32 count)
+    {
+        U32 x = 0;
+        for (; x + 8 <= count; x += 8)
+        {
+            StoreLuma(pY0 + x, pSrc0 + x);
+            StoreLuma(pY0 + x + 4, pSrc0 + x + 4);
+            StoreLuma(pY1 + x, pSrc1 + x);
+            StoreLuma(pY1 + x + 4, pSrc1 + x + 4);
+
+            I32x4 r[4], g[4], b[4];
+            LoadChannels(pSrc0 + x, r[0], g[0], b[0]);
+            LoadChannels(pSrc0 + x + 4, r[1], g[1], b[1]);
+            LoadChannels(pSrc1 + x, r[2], g[2], b[2]);
+            LoadChannels(pSrc1 + x + 4, r[3], g[3], b[3]);
+            // Sum vertically, then add horizontally adjacent pairs.
+            const auto boxAverage = [](const I32x4 *c) {
+                const I32x4 lo = c[0] + c[2];
+                const I32x4 hi = c[1] + c[3];
+                const I32x4 even = __builtin_shufflevector(lo, hi, 0, 2, 4, 6);
+                const I32x4 odd = __builtin_shufflevector(lo, hi, 1, 3, 5, 7);
+                return (even + odd + 2) >> 2;
+            };
+            const I32x4 rAverage = boxAverage(r);
+            const I32x4 gAverage = boxAverage(g);
+            const I32x4 bAverage = boxAverage(b);
+            const I32x4 u = ChromaU(rAverage, gAverage, bAverage);
+            const I32x4 v = ChromaV(rAverage, gAverage, bAverage);
+            if constexpr (kUvStep == 2)
+            {
+                const U8x8 uv = __builtin_convertvector(__builtin_shufflevector(u, v, 0, 4, 1, 5, 2, 6, 3, 7), U8x8);
+                __builtin_memcpy(pU + x, &uv, sizeof(uv));
+            }
+            else
+            {
+                const U8x4 uBytes = __builtin_convertvector(u, U8x4);
+                const U8x4 vBytes = __builtin_convertvector(v, U8x4);
+                __builtin_memcpy(pU + x / 2, &uBytes, sizeof(uBytes));
+                __builtin_memcpy(pV + x / 2, &vBytes, sizeof(vBytes));
+            }
+        }
+        for (; x < count; x += 2)
+        {
+            const U32 *pRows[2] = {pSrc0, pSrc1};
+            U8 *pLumaRows[2] = {pY0, pY1};
+            I32 rSum = 0, gSum = 0, bSum = 0;
+            for (U32 iRow = 0; iRow < 2; ++iRow)
+            {
+                for (U32 dx = 0; dx < 2; ++dx)
+                {
+                    const U32 pixel = pRows[iRow][x + dx];
+                    const I32 r = static_cast<I32>(pixel >> 16 & 0xFFu);
+                    const I32 g = static_cast<I32>(pixel >> 8 & 0xFFu);
+                    const I32 b = static_cast<I32>(pixel & 0xFFu);
+                    pLumaRows[iRow][x + dx] = static_cast<U8>(LumaY(r, g, b));
+                    rSum += r;
+                    gSum += g;
+                    bSum += b;
+                }
+            }
+            const I32 rAverage = (rSum + 2) >> 2;
+            const I32 gAverage = (gSum + 2) >> 2;
+            const I32 bAverage = (bSum + 2) >> 2;
+            pU[x / 2 * kUvStep] = static_cast<U8>(ChromaU(rAverage, gAverage, bAverage));
+            pV[x / 2 * kUvStep] = static_cast<U8>(ChromaV(rAverage, gAverage, bAverage));
+        }
+    }
+
+    // Converts a width x height block of BGRA pixels at (x0, y0) into the image, pSrc points at the block's first
+    // pixel. Meant to be called on blocks that are still cached, e.g. right after a post tile is resolved.
+    // Subsampled formats need x0, y0, width and height to be even.
+    inline void ConvertPixels(const U32 *pSrc, const U32 srcStride, const FrameImage &image, const U32 x0,
+                              const U32 y0, const U32 width, const U32 height)
+    {
+        U8 *const *pPlanes = image.m_pPlanes;
+        const U32 *strides = image.m_strides;
+        switch (image.m_format)
+        {
+            case PixelFormat::kBgra32:
+                for (U32 y = 0; y < height; ++y)
+                {
+                    __builtin_memcpy(pPlanes[0] + (y0 + y) * strides[0] + x0 * 4, pSrc + y * srcStride, width * 4);
+                }
+                break;
+            case PixelFormat::kRgb565:
+                for (U32 y = 0; y < height; ++y)
+                {
+                    ConvertRowRgb565(pSrc + y * srcStride, pPlanes[0] + (y0 + y) * strides[0] + x0 * 2, width);
+                }
+                break;
+            case PixelFormat::kRgb24:
+                for (U32 y = 0; y < height; ++y)
+                {
+                    ConvertRowRgb24(pSrc + y * srcStride, pPlanes[0] + (y0 + y) * strides[0] + x0 * 3, width);
+                }
+                break;
+            case PixelFormat::kI420:
+                for (U32 y = 0; y < height; y += 2)
+                {
+                    U8 *pY = pPlanes[0] + (y0 + y) * strides[0] + x0;
+                    const U32 iChroma = (y0 + y) / 2;
+                    ConvertRowPairYuv<1>(pSrc + y * srcStride, pSrc + (y + 1) * srcStride, pY, pY + strides[0],
+                                         pPlanes[1] + iChroma * strides[1] + x0 / 2,
+                                         pPlanes[2] + iChroma * strides[2] + x0 / 2, width);
+                }
+                break;
+            case PixelFormat::kNv12:
+                for (U32 y = 0; y < height; y += 2)
+                {
+                    U8 *pY = pPlanes[0] + (y0 + y) * strides[0] + x0;
+                    U8 *pUv = pPlanes[1] + (y0 + y) / 2 * strides[1] + x0;
+                    ConvertRowPairYuv<2>(pSrc + y * srcStride, pSrc + (y + 1) * srcStride, pY, pY + strides[0], pUv,
+                                         pUv + 1, width);
+                }
+                break;
+            default:
+                break;
+        }
+    }
+}
@@ -0,0 +1,476 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#include <common.hpp>
+#include <image.hpp>
+#include <memory.hpp>
+#include <options.hpp>
+#include <render.hpp>
+#include <scenes.hpp>
+
+namespace Engine
+{
+    static constexpr const char *kGoldenUsage =
+        "Usage: %s [options]\n"
+        "  --golden DIR            Directory of the golden images, defaults to golden\n"
+        "  --timings PATH          Frame time baselines of this host, defaults to golden_timings.txt\n"
+        "  --case NAME             Only run the named case\n"
+        "  --update                Rewrite the golden images and the frame time baselines\n"
+        "  --tolerance LEVELS      Channel difference a pixel may have, defaults to 2\n"
+        "  --max-differing FRACTION\n"
+        "                          Fraction of pixels allowed past the tolerance, defaults to 0.001\n"
+        "  --time-tolerance FRACTION\n"
+        "                          Frame time increase over the baseline that fails, defaults to 0.25\n"
+        "Golden images are only written with --update, a missing or unreadable one fails its case. Frame time\n"
+        "baselines that do not exist yet are recorded and pass. Failed cases write NAME_actual.qoi and\n"
+        "NAME_diff.qoi to the working directory.\n";
+
+    // Frame size of every case that does not set its own.
+    static constexpr const char *kGoldenSize = "--size 192x128";
+    static constexpr U32 kMaxGoldenArguments = 16;
+    // Frames timed after the comparison, as many as fit in kMinTimedMs within these bounds.
+    static constexpr U32 kMinTimedFrames = 5;
+    static constexpr U32 kMaxTimedFrames = 200;
+    static constexpr F64 kMinTimedMs = 200.0;
+    static constexpr U32 kTimedAttempts = 3;
+
+    struct GoldenCase
+    {
+        const char *m_name;
+        ScenePreset m_scene;
+        CameraPath m_path;
+        // Fraction of the path the camera stays at.
+        F32 m_pathTime;
+        // Engine options as they would be given on the command line.
+        const char *m_arguments;
+        // Frames rendered from an empty history before the last one is compared.
+        U32 m_numFrames;
+    };
+
+    static constexpr GoldenCase kGoldenCases[] = {
+        {"cubes_none", ScenePreset::kCubes, CameraPath::kOrbit, 0.1f, "--aa none", 3},
+        {"cubes_fxaa", ScenePreset::kCubes, CameraPath::kOrbit, 0.1f, "--aa fxaa", 3},
+        {"cubes_edge", ScenePreset::kCubes, CameraPath::kOrbit, 0.1f, "--aa edge", 3},
+        {"cubes_taa", ScenePreset::kCubes, CameraPath::kOrbit, 0.1f, "--aa taa", 8},
+        {"cubes_taa_half_res", ScenePreset::kCubes, CameraPath::kOrbit, 0.1f, "--aa taa --half-res", 8},
+        {"cubes_post", ScenePreset::kCubes, CameraPath::kOrbit, 0.1f, "--aa none --post sharpen,vignette", 3},
+        {"cubes_ortho", ScenePreset::kCubes, CameraPath::kOrbit, 0.1f, "--aa none --ortho 12", 3},
+        {"cubes_views", ScenePreset::kCubes, CameraPath::kOrbit, 0.1f, "--aa none --views 2x2", 3},
+        {"cubes_stereo", ScenePreset::kCubes, CameraPath::kOrbit, 0.1f, "--aa none --stereo 0.5", 3},
+        {"cubes_cubemap", ScenePreset::kCubes, CameraPath::kOrbit, 0.1f, "--aa none --panorama cubemap", 3},
+        {"cubes_equirect", ScenePreset::kCubes, CameraPath::kOrbit, 0.1f,
+         "--aa none --size 192x96 --panorama equirect", 3},
+        {"cubes_foveate", ScenePreset::kCubes, CameraPath::kOrbit, 0.1f, "--aa none --foveate 24 --gaze 0.3,0.6", 3},
+        {"grid_orbit", ScenePreset::kGrid, CameraPath::kOrbit, 0.3f, "--aa fxaa", 3},
+        {"cloud_dolly", ScenePreset::kCloud, CameraPath::kDolly, 0.5f, "--aa fxaa", 3},
+        {"wall_pan", ScenePreset::kWall, CameraPath::kPan, 0.3f, "--aa fxaa", 3},
+        {"sparse_orbit", ScenePreset::kSparse, CameraPath::kOrbit, 0.6f, "--aa fxaa", 3},
+    };
+
+    static constexpr U32 kNumGoldenCases = sizeof(kGoldenCases) / sizeof(kGoldenCases[0]);
+
+    struct GoldenOptions
+    {
+        const char *m_pGoldenDir = "golden";
+        const char *m_pTimingsPath = "golden_timings.txt";
+        const char *m_pCaseName = nullptr;
+        bool m_isUpdate = false;
+        U32 m_tolerance = 2;
+        F64 m_maxDiffering = 0.001;
+        F64 m_timeTolerance = 0.25;
+    };
+
+    struct GoldenRun
+    {
+        State *m_pState;
+        Targets *m_pTargets;
+        U32 m_width = 0;
+        U32 m_height = 0;
+        PageAllocation m_pixels = {};
+        U32 *m_pPixels = nullptr;
+    };
+
+    // Baselines in milliseconds per case, negative until recorded.
+    struct GoldenTimings
+    {
+        F64 m_ms[kNumGoldenCases];
+        bool m_isChanged = false;
+    };
+
+    inline U32 FindGoldenCase(const char *name)
+    {
+        U32 iCase = 0;
+        while (iCase < kNumGoldenCases && std::strcmp(kGoldenCases[iCase].m_name, name) != 0)
+        {
+            ++iCase;
+        }
+        return iCase;
+    }
+
+    // One "name milliseconds" line per case, cases no longer around are dropped on the next write.
+    inline void ReadGoldenTimings(const char *path, GoldenTimings &timings)
+    {
+        for (F64 &ms: timings.m_ms)
+        {
+            ms = -1.0;
+        }
+        std::FILE *pFile = std::fopen(path, "r");
+        if (!pFile)
+        {
+            return;
+        }
+        char name[64];
+        F64 ms;
+        while (std::fscanf(pFile, "%63s %lf", name, &ms) == 2)
+        {
+            const U32 iCase = FindGoldenCase(name);
+            if (iCase < kNumGoldenCases)
+            {
+                timings.m_ms[iCase] = ms;
+            }
+        }
+        std::fclose(pFile);
+    }
+
+    inline bool WriteGoldenTimings(const char *path, const GoldenTimings &timings)
+    {
+        std::FILE *pFile = std::fopen(path, "w");
+        if (!pFile)
+        {
+            return false;
+        }
+        for (U32 iCase = 0; iCase < kNumGoldenCases; ++iCase)
+        {
+            if (timings.m_ms[iCase] >= 0.0)
+            {
+                std::fprintf(pFile, "%s %.4f\n", kGoldenCases[iCase].m_name, timings.m_ms[iCase]);
+            }
+        }
+        return std::fclose(pFile) == 0;
+    }
+
+    // Resets the state and parses the case's options into it, the targets follow the frame size.
+    inline bool PrepareGoldenCase(const GoldenCase &golden, GoldenRun &run)
+    {
+        State &state = *run.m_pState;
+        state.~State();
+        new (&state) State();
+
+        char arguments[256];
+        std::snprintf(arguments, sizeof(arguments), "%s %s", kGoldenSize, golden.m_arguments);
+        char *argv[kMaxGoldenArguments] = {const_cast<char *>(golden.m_name)};
+        int argc = 1;
+        for (char *pToken = std::strtok(arguments, " "); pToken && argc < static_cast<int>(kMaxGoldenArguments);
+             pToken = std::strtok(nullptr, " "))
+        {
+            argv[argc++] = pToken;
+        }
+        if (!ParseArguments(argc, argv, state))
+        {
+            return false;
+        }
+
+        Targets &targets = *run.m_pTargets;
+        if (state.m_width != run.m_width || state.m_height != run.m_height)
+        {
+            FreePages(run.m_pixels);
+            run.m_pixels = AllocatePages(std::size_t{state.m_width} * state.m_height * sizeof(U32), false);
+            run.m_pPixels = static_cast<U32 *>(run.m_pixels.m_pData);
+            if (!run.m_pPixels || !ResizeTargets(targets, state.m_width, state.m_height))
+            {
+                return false;
+            }
+            run.m_width = state.m_width;
+            run.m_height = state.m_height;
+        }
+        targets.m_hasHistory = false;
+        targets.m_frameIndex = 0;
+
+        const F32 radius = MakeScenePreset(state, golden.m_scene);
+        SetCameraInWorld(state, CameraOnPath(golden.m_path, radius, golden.m_pathTime));
+        return true;
+    }
+
+    // Renders the frames the case compares.
+    template<typename Extent>
+    void RenderGoldenCase(const Extent extent, const GoldenCase &golden, GoldenRun &run)
+    {
+        const Vec2f focus = FoveaFocus(*run.m_pState, -1, -1);
+        for (U32 iFrame = 0; iFrame < golden.m_numFrames; ++iFrame)
+        {
+            RenderFrame(extent, *run.m_pState, *run.m_pTargets, run.m_pPixels, nullptr, focus);
+        }
+    }
+
+    // Keeps rendering until enough frames and time have passed for the fastest frame to be steady, returns its time in
+    // milliseconds.
+    template<typename Extent>
+    F64 TimeGoldenCase(const Extent extent, GoldenRun &run)
+    {
+        const Vec2f focus = FoveaFocus(*run.m_pState, -1, -1);
+        F64 bestMs = 0.0;
+        F64 totalMs = 0.0;
+        for (U32 iFrame = 0; iFrame < kMaxTimedFrames && (iFrame < kMinTimedFrames || totalMs < kMinTimedMs); ++iFrame)
+        {
+            const auto start = std::chrono::steady_clock::now();
+            RenderFrame(extent, *run.m_pState, *run.m_pTargets, run.m_pPixels, nullptr, focus);
+            const auto end = std::chrono::steady_clock::now();
+            const F64 ms = std::chrono::duration<F64, std::milli>(end - start).count();
+            bestMs = iFrame == 0 || ms < bestMs ? ms : bestMs;
+            totalMs += ms;
+        }
+        return bestMs;
+    }
+
+    // Counts the pixels with a channel off by more than the tolerance and marks them red in pDiff, the rest of the
+    // diff is the actual frame dimmed to a quarter.
+    inline U32 DiffImages(const U32 *pActual, const U32 *pGolden, const U32 numPixels, const U32 tolerance,
+                          U32 *pDiff, U32 &maxDifference)
+    {
+        U32 numDiffering = 0;
+        maxDifference = 0;
+        for (U32 i = 0; i < numPixels; ++i)
+        {
+            U32 difference = 0;
+            for (U32 shift = 0; shift < 24; shift += 8)
+            {
+                const I32 a = static_cast<I32>(pActual[i] >> shift & 0xFFu);
+                const I32 g = static_cast<I32>(pGolden[i] >> shift & 0xFFu);
+                difference = Max(difference, static_cast<U32>(a > g ? a - g : g - a));
+            }
+            maxDifference = Max(maxDifference, difference);
+            const bool isDiffering = difference > tolerance;
+            numDiffering += isDiffering;
+            pDiff[i] = isDiffering ? 0xFFFF0000u : pActual[i] >> 2 & 0x3F3F3Fu;
+        }
+        return numDiffering;
+    }
+
+    inline bool CheckGoldenImage(const GoldenOptions &options, const GoldenCase &golden, const GoldenRun &run)
+    {
+        char path[512];
+        std::snprintf(path, sizeof(path), "%s/%s.qoi", options.m_pGoldenDir, golden.m_name);
+        U32 goldenWidth = 0;
+        U32 goldenHeight = 0;
+        if (options.m_isUpdate)
+        {
+            if (!WriteImageFile(path, ImageFormat::kQoi, run.m_pPixels, run.m_width, run.m_height))
+            {
+                std::fprintf(stderr, "%s: failed to write %s\n", golden.m_name, path);
+                return false;
+            }
+            std::printf("%s: recorded %s\n", golden.m_name, path);
+            return true;
+        }
+        // A reference that went missing or got damaged fails rather than silently re-recording itself.
+        U32 *pGolden = ReadQoiFile(path, goldenWidth, goldenHeight);
+        if (!pGolden)
+        {
+            std::printf("%s: FAILED, %s is missing or not a valid QOI image, --update records it\n", golden.m_name,
+                        path);
+            return false;
+        }
+        if (goldenWidth != run.m_width || goldenHeight != run.m_height)
+        {
+            std::printf("%s: FAILED, rendered %ux%u but the golden image is %ux%u\n", golden.m_name, run.m_width,
+                        run.m_height, goldenWidth, goldenHeight);
+            delete[] pGolden;
+            return false;
+        }
+
+        const U32 numPixels = run.m_width * run.m_height;
+        U32 *pDiff = new U32[numPixels];
+        U32 maxDifference;
+        const U32 numDiffering = DiffImages(run.m_pPixels, pGolden, numPixels, options.m_tolerance, pDiff,
+                                            maxDifference);
+        const bool isPassed = numDiffering <= static_cast<U32>(options.m_maxDiffering * numPixels);
+        if (!isPassed)
+        {
+            std::printf("%s: FAILED, %u of %u pixels differ by more than %u, at most by %u\n", golden.m_name,
+                        numDiffering, numPixels, options.m_tolerance, maxDifference);
+            std::snprintf(path, sizeof(path), "%s_actual.qoi", golden.m_name);
+            const bool isActualWritten = WriteImageFile(path, ImageFormat::kQoi, run.m_pPixels, run.m_width,
+                                                        run.m_height);
+            std::snprintf(path, sizeof(path), "%s_diff.qoi", golden.m_name);
+            if (!isActualWritten || !WriteImageFile(path, ImageFormat::kQoi, pDiff, run.m_width, run.m_height))
+            {
+                std::fprintf(stderr, "%s: failed to write the actual and diff images\n", golden.m_name);
+            }
+        }
+        delete[] pDiff;
+        delete[] pGolden;
+        return isPassed;
+    }
+
+    inline bool CheckGoldenTime(const GoldenOptions &options, const GoldenCase &golden, const F64 ms,
+                                F64 &baselineMs, bool &isChanged)
+    {
+        if (options.m_isUpdate || baselineMs < 0.0)
+        {
+            std::printf("%s: %.3f ms, recorded as the baseline\n", golden.m_name, ms);
+            baselineMs = ms;
+            isChanged = true;
+            return true;
+        }
+        const bool isPassed = ms <= baselineMs * (1.0 + options.m_timeTolerance);
+        std::printf("%s: %s%.3f ms against a baseline of %.3f ms\n", golden.m_name, isPassed ? "" : "FAILED, ", ms,
+                    baselineMs);
+        return isPassed;
+    }
+
+    inline bool ParseGoldenArguments(const int argc, char **argv, GoldenOptions &options)
+    {
+        for (int i = 1; i < argc; ++i)
+        {
+            const char *arg = argv[i];
+            const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+            if (std::strcmp(arg, "--golden") == 0 && value)
+            {
+                options.m_pGoldenDir = value;
+                ++i;
+            }
+            else if (std::strcmp(arg, "--timings") == 0 && value)
+            {
+                options.m_pTimingsPath = value;
+                ++i;
+            }
+            else if (std::strcmp(arg, "--case") == 0 && value)
+            {
+                if (FindGoldenCase(value) == kNumGoldenCases)
+                {
+                    std::fprintf(stderr, "No golden case is named %s\n", value);
+                    return false;
+                }
+                options.m_pCaseName = value;
+                ++i;
+            }
+            else if (std::strcmp(arg, "--update") == 0)
+            {
+                options.m_isUpdate = true;
+            }
+            else if (std::strcmp(arg, "--tolerance") == 0 && value)
+            {
+                options.m_tolerance = static_cast<U32>(std::atoi(value));
+                if (options.m_tolerance > 255)
+                {
+                    std::fprintf(stderr, "Tolerance must be from 0 to 255: %s\n", value);
+                    return false;
+                }
+                ++i;
+            }
+            else if (std::strcmp(arg, "--max-differing") == 0 && value)
+            {
+                options.m_maxDiffering = std::atof(value);
+                if (!(options.m_maxDiffering >= 0.0 && options.m_maxDiffering <= 1.0))
+                {
+                    std::fprintf(stderr, "Fraction of differing pixels must be from 0 to 1: %s\n", value);
+                    return false;
+                }
+                ++i;
+            }
+            else if (std::strcmp(arg, "--time-tolerance") == 0 && value)
+            {
+                options.m_timeTolerance = std::atof(value);
+                if (!(options.m_timeTolerance >= 0.0))
+                {
+                    std::fprintf(stderr, "Time tolerance must not be negative: %s\n", value);
+                    return false;
+                }
+                ++i;
+            }
+            else
+            {
+                std::fprintf(stderr, kGoldenUsage, argv[0]);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool RunGoldenCases(const GoldenOptions &options, GoldenRun &run)
+    {
+        GoldenTimings timings;
+        ReadGoldenTimings(options.m_pTimingsPath, timings);
+
+        U32 numFailed = 0;
+        U32 numRun = 0;
+        for (U32 iCase = 0; iCase < kNumGoldenCases; ++iCase)
+        {
+            const GoldenCase &golden = kGoldenCases[iCase];
+            if (options.m_pCaseName && std::strcmp(options.m_pCaseName, golden.m_name) != 0)
+            {
+                continue;
+            }
+            ++numRun;
+            if (!PrepareGoldenCase(golden, run))
+            {
+                std::printf("%s: FAILED to set up\n", golden.m_name);
+                ++numFailed;
+                continue;
+            }
+            WithExtent(run.m_width, run.m_height, [&](const auto extent) {
+                RenderGoldenCase(extent, golden, run);
+            });
+            const bool isImagePassed = CheckGoldenImage(options, golden, run);
+            // A case slower than its baseline is timed again before it fails, noise rarely repeats but regressions do.
+            const F64 baselineMs = timings.m_ms[iCase];
+            F64 ms = 0.0;
+            for (U32 iAttempt = 0; iAttempt < kTimedAttempts; ++iAttempt)
+            {
+                WithExtent(run.m_width, run.m_height, [&](const auto extent) {
+                    const F64 attemptMs = TimeGoldenCase(extent, run);
+                    ms = iAttempt == 0 || attemptMs < ms ? attemptMs : ms;
+                });
+                if (options.m_isUpdate || baselineMs < 0.0 || ms <= baselineMs * (1.0 + options.m_timeTolerance))
+                {
+                    break;
+                }
+            }
+            const bool isTimePassed = CheckGoldenTime(options, golden, ms, timings.m_ms[iCase], timings.m_isChanged);
+            numFailed += !isImagePassed || !isTimePassed;
+        }
+
+        if (timings.m_isChanged && !WriteGoldenTimings(options.m_pTimingsPath, timings))
+        {
+            std::fprintf(stderr, "Failed to write %s\n", options.m_pTimingsPath);
+            return false;
+        }
+        std::printf("%u of %u golden cases passed\n", numRun - numFailed, numRun);
+        return numFailed == 0;
+    }
+}
+
+int main(const int argc, char **argv)
+{
+    using namespace Engine;
+
+    GoldenOptions options;
+    if (!ParseGoldenArguments(argc, argv, options))
+    {
+        return 1;
+    }
+
+    constexpr std::size_t kTargetsOffset = AlignUp(sizeof(State), alignof(Targets));
+    const PageAllocation pages = AllocatePages(kTargetsOffset + sizeof(Targets), false);
+    if (!pages.m_pData)
+    {
+        std::fprintf(stderr, "Failed to allocate %zu bytes for the scene\n", pages.m_size);
+        return 1;
+    }
+    GoldenRun run{
+        .m_pState = new (pages.m_pData) State(),
+        .m_pTargets = new (static_cast<U8 *>(pages.m_pData) + kTargetsOffset) Targets(),
+    };
+    const bool isPassed = RunGoldenCases(options, run);
+
+    FreePages(run.m_pixels);
+    FreePages(run.m_pTargets->m_pages);
+    run.m_pState->~State();
+    run.m_pTargets->~Targets();
+    FreePages(pages);
+
+    return isPassed ? 0 : 1;
+}
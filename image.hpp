@@ -0,0 +1,735 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdio>
+
+#include <common.hpp>
+
+namespace Engine
+{
+    // Compressed still image formats for frame dumps, both written as 8 bit RGB with alpha dropped.
+    enum class ImageFormat : U8
+    {
+        kPng,
+        kQoi,
+        kCount,
+    };
+
+    static constexpr const char *kImageFormatNames[] = {"png", "qoi"};
+    static_assert(sizeof(kImageFormatNames) / sizeof(kImageFormatNames[0]) == static_cast<U32>(ImageFormat::kCount));
+
+    // Both encoders split the frame into strips of this many rows that are compressed independently in parallel and
+    // then concatenated. Strips lose a little compression at their first pixels but the result is one valid image.
+    static constexpr U32 kImageStripHeight = 32;
+
+    inline U32 NumImageStrips(const U32 height)
+    {
+        return (height + kImageStripHeight - 1) / kImageStripHeight;
+    }
+
+    inline void StoreBigEndian(U8 *pDst, const U32 value)
+    {
+        pDst[0] = static_cast<U8>(value >> 24);
+        pDst[1] = static_cast<U8>(value >> 16);
+        pDst[2] = static_cast<U8>(value >> 8);
+        pDst[3] = static_cast<U8>(value);
+    }
+
+    // Moves the strips, each written at the start of its fixed size slot, together behind the header.
+    inline std::size_t CompactStrips(U8 *pDst, std::size_t size, const std::size_t slotSize, const std::size_t *pSizes,
+                                     const U32 numStrips)
+    {
+        const std::size_t firstSlot = size;
+        for (U32 iStrip = 0; iStrip < numStrips; ++iStrip)
+        {
+            __builtin_memmove(pDst + size, pDst + firstSlot + iStrip * slotSize, pSizes[iStrip]);
+            size += pSizes[iStrip];
+        }
+        return size;
+    }
+
+    // QOI
+
+    static constexpr U8 kQoiOpIndex = 0x00;
+    static constexpr U8 kQoiOpDiff = 0x40;
+    static constexpr U8 kQoiOpLuma = 0x80;
+    static constexpr U8 kQoiOpRun = 0xC0;
+    static constexpr U8 kQoiOpRgb = 0xFE;
+    static constexpr U32 kQoiHeaderSize = 14;
+    static constexpr U8 kQoiEndMarker[] = {0, 0, 0, 0, 0, 0, 0, 1};
+
+    constexpr U32 QoiHash(const U32 rgb)
+    {
+        return ((rgb >> 16 & 0xFFu) * 3 + (rgb >> 8 & 0xFFu) * 5 + (rgb & 0xFFu) * 7 + 255 * 11) % 64;
+    }
+
+    // Worst case every pixel is a 4 byte RGB op.
+    inline std::size_t QoiStripBound(const U32 width)
+    {
+        return static_cast<std::size_t>(width) * kImageStripHeight * 4;
+    }
+
+    // Encodes count pixels so that they continue any QOI stream. The first pixel is always written in full, and the
+    // index is only referenced for entries this strip has written, which the decoder then holds as well.
+    inline std::size_t EncodeQoiStrip(const U32 *pPixels, const U32 count, U8 *pDst)
+    {
+        U32 index[64];
+        U64 isIndexed = 0;
+        U8 *p = pDst;
+        U32 prev = ~0u;
+        U32 run = 0;
+        for (U32 i = 0; i < count; ++i)
+        {
+            const U32 pixel = pPixels[i] & 0xFFFFFFu;
+            if (pixel == prev)
+            {
+                if (++run == 62)
+                {
+                    *p++ = static_cast<U8>(kQoiOpRun | (run - 1));
+                    run = 0;
+                }
+                continue;
+            }
+            if (run > 0)
+            {
+                *p++ = static_cast<U8>(kQoiOpRun | (run - 1));
+                run = 0;
+            }
+            const U32 hash = QoiHash(pixel);
+            if ((isIndexed >> hash & 1) != 0 && index[hash] == pixel)
+            {
+                *p++ = static_cast<U8>(kQoiOpIndex | hash);
+                prev = pixel;
+                continue;
+            }
+            index[hash] = pixel;
+            isIndexed |= 1ull << hash;
+            // Channel differences wrap like the decoder's byte arithmetic.
+            const I32 dr = static_cast<I8>(static_cast<U8>((pixel >> 16) - (prev >> 16)));
+            const I32 dg = static_cast<I8>(static_cast<U8>((pixel >> 8) - (prev >> 8)));
+            const I32 db = static_cast<I8>(static_cast<U8>(pixel - prev));
+            const I32 drDg = dr - dg;
+            const I32 dbDg = db - dg;
+            if (i == 0)
+            {
+                // Nothing to difference against, the decoder's previous pixel belongs to another strip.
+            }
+            else if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1)
+            {
+                *p++ = static_cast<U8>(kQoiOpDiff | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2));
+                prev = pixel;
+                continue;
+            }
+            else if (dg >= -32 && dg <= 31 && drDg >= -8 && drDg <= 7 && dbDg >= -8 && dbDg <= 7)
+            {
+                *p++ = static_cast<U8>(kQoiOpLuma | (dg + 32));
+                *p++ = static_cast<U8>((drDg + 8) << 4 | (dbDg + 8));
+                prev = pixel;
+                continue;
+            }
+            *p++ = kQoiOpRgb;
+            *p++ = static_cast<U8>(pixel >> 16);
+            *p++ = static_cast<U8>(pixel >> 8);
+            *p++ = static_cast<U8>(pixel);
+            prev = pixel;
+        }
+        if (run > 0)
+        {
+            *p++ = static_cast<U8>(kQoiOpRun | (run - 1));
+        }
+        return static_cast<std::size_t>(p - pDst);
+    }
+
+    inline std::size_t QoiBound(const U32 width, const U32 height)
+    {
+        return kQoiHeaderSize + NumImageStrips(height) * QoiStripBound(width) + sizeof(kQoiEndMarker);
+    }
+
+    // Encodes BGRA pixels, returns the size written to pDst, which must hold QoiBound bytes.
+    inline std::size_t EncodeQoi(const U32 *pPixels, const U32 width, const U32 height, U8 *pDst)
+    {
+        __builtin_memcpy(pDst, "qoif", 4);
+        StoreBigEndian(pDst + 4, width);
+        StoreBigEndian(pDst + 8, height);
+        pDst[12] = 3;
+        pDst[13] = 0;
+
+        const U32 numStrips = NumImageStrips(height);
+        const std::size_t slotSize = QoiStripBound(width);
+        std::size_t stripSizes[(1u << 16) / kImageStripHeight];
+#pragma omp parallel for
+        for (U32 iStrip = 0; iStrip < numStrips; ++iStrip)
+        {
+            const U32 y0 = iStrip * kImageStripHeight;
+            const U32 numRows = Min(y0 + kImageStripHeight, height) - y0;
+            stripSizes[iStrip] = EncodeQoiStrip(pPixels + y0 * width, numRows * width,
+                                                pDst + kQoiHeaderSize + iStrip * slotSize);
+        }
+        const std::size_t size = CompactStrips(pDst, kQoiHeaderSize, slotSize, stripSizes, numStrips);
+        __builtin_memcpy(pDst + size, kQoiEndMarker, sizeof(kQoiEndMarker));
+        return size + sizeof(kQoiEndMarker);
+    }
+
+    inline U32 LoadBigEndian(const U8 *pSrc)
+    {
+        return static_cast<U32>(pSrc[0]) << 24 | static_cast<U32>(pSrc[1]) << 16 | static_cast<U32>(pSrc[2]) << 8 |
+               pSrc[3];
+    }
+
+    // Decodes any QOI image into opaque BGRA pixels, alpha is dropped like the encoders drop it. Returns pixels the
+    // caller deletes with delete[], or nullptr when the data is not a complete QOI image.
+    inline U32 *DecodeQoi(const U8 *pData, const std::size_t size, U32 &width, U32 &height)
+    {
+        if (size < kQoiHeaderSize + sizeof(kQoiEndMarker) || __builtin_memcmp(pData, "qoif", 4) != 0)
+        {
+            return nullptr;
+        }
+        width = LoadBigEndian(pData + 4);
+        height = LoadBigEndian(pData + 8);
+        const U64 numPixels = static_cast<U64>(width) * height;
+        if (numPixels == 0 || numPixels > 1u << 28)
+        {
+            return nullptr;
+        }
+
+        U32 *pPixels = new U32[numPixels];
+        U32 index[64] = {};
+        U8 r = 0;
+        U8 g = 0;
+        U8 b = 0;
+        U8 a = 255;
+        const U8 *p = pData + kQoiHeaderSize;
+        const U8 *pEnd = pData + size - sizeof(kQoiEndMarker);
+        U64 i = 0;
+        while (i < numPixels && p < pEnd)
+        {
+            const U8 op = *p++;
+            U32 run = 1;
+            if (op == kQoiOpRgb || op == kQoiOpRgb + 1)
+            {
+                const U32 numChannels = op == kQoiOpRgb ? 3 : 4;
+                if (static_cast<U32>(pEnd - p) < numChannels)
+                {
+                    break;
+                }
+                r = p[0];
+                g = p[1];
+                b = p[2];
+                a = numChannels == 4 ? p[3] : a;
+                p += numChannels;
+            }
+            else if ((op & 0xC0) == kQoiOpIndex)
+            {
+                const U32 pixel = index[op];
+                a = static_cast<U8>(pixel >> 24);
+                r = static_cast<U8>(pixel >> 16);
+                g = static_cast<U8>(pixel >> 8);
+                b = static_cast<U8>(pixel);
+            }
+            else if ((op & 0xC0) == kQoiOpDiff)
+            {
+                r = static_cast<U8>(r + (op >> 4 & 3) - 2);
+                g = static_cast<U8>(g + (op >> 2 & 3) - 2);
+                b = static_cast<U8>(b + (op & 3) - 2);
+            }
+            else if ((op & 0xC0) == kQoiOpLuma)
+            {
+                if (p == pEnd)
+                {
+                    break;
+                }
+                const I32 dg = (op & 0x3F) - 32;
+                r = static_cast<U8>(r + dg + (*p >> 4) - 8);
+                g = static_cast<U8>(g + dg);
+                b = static_cast<U8>(b + dg + (*p & 0xF) - 8);
+                ++p;
+            }
+            else
+            {
+                run = (op & 0x3Fu) + 1;
+            }
+            const U32 pixel = static_cast<U32>(a) << 24 | static_cast<U32>(r) << 16 | static_cast<U32>(g) << 8 | b;
+            index[(r * 3u + g * 5u + b * 7u + a * 11u) % 64] = pixel;
+            for (; run > 0 && i < numPixels; --run)
+            {
+                pPixels[i++] = pixel | 0xFF000000u;
+            }
+        }
+        if (i < numPixels)
+        {
+            delete[] pPixels;
+            return nullptr;
+        }
+        return pPixels;
+    }
+
+    // PNG
+
+    static constexpr U8 kPngSignature[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    static constexpr U32 kPngChunkOverhead = 12;
+    static constexpr U32 kDeflateHashBits = 14;
+    static constexpr U32 kDeflateMinMatch = 4;
+    static constexpr U32 kDeflateMaxMatch = 258;
+    static constexpr U32 kDeflateMaxDistance = 32768;
+
+    struct Crc32Table
+    {
+        U32 m_entries[256];
+    };
+
+    static constexpr Crc32Table kCrc32Table = [] {
+        Crc32Table table{};
+        for (U32 i = 0; i < 256; ++i)
+        {
+            U32 crc = i;
+            for (U32 bit = 0; bit < 8; ++bit)
+            {
+                crc = crc & 1 ? 0xEDB88320u ^ crc >> 1 : crc >> 1;
+            }
+            table.m_entries[i] = crc;
+        }
+        return table;
+    }();
+
+    inline U32 Crc32(const U8 *pData, const std::size_t size, U32 crc = 0)
+    {
+        crc = ~crc;
+        for (std::size_t i = 0; i < size; ++i)
+        {
+            crc = kCrc32Table.m_entries[(crc ^ pData[i]) & 0xFFu] ^ crc >> 8;
+        }
+        return ~crc;
+    }
+
+    inline U32 Adler32(const U8 *pData, std::size_t size)
+    {
+        // Largest run of bytes before the sums can overflow 32 bits.
+        constexpr std::size_t kBlockSize = 5552;
+        U32 a = 1;
+        U32 b = 0;
+        while (size > 0)
+        {
+            const std::size_t blockSize = size < kBlockSize ? size : kBlockSize;
+            for (std::size_t i = 0; i < blockSize; ++i)
+            {
+                a += pData[i];
+                b += a;
+            }
+            a %= 65521;
+            b %= 65521;
+            pData += blockSize;
+            size -= blockSize;
+        }
+        return b << 16 | a;
+    }
+
+    // Checksum of two buffers back to back from the checksums of each, as in zlib's adler32_combine.
+    inline U32 CombineAdler32(const U32 adler1, const U32 adler2, const std::size_t size2)
+    {
+        constexpr U32 kBase = 65521;
+        const U32 remainder = static_cast<U32>(size2 % kBase);
+        U32 sum1 = adler1 & 0xFFFFu;
+        U32 sum2 = remainder * sum1 % kBase;
+        sum1 += (adler2 & 0xFFFFu) + kBase - 1;
+        sum2 += (adler1 >> 16) + (adler2 >> 16) + kBase - remainder;
+        sum1 = sum1 >= kBase ? sum1 - kBase : sum1;
+        sum1 = sum1 >= kBase ? sum1 - kBase : sum1;
+        sum2 = sum2 >= 2 * kBase ? sum2 - 2 * kBase : sum2;
+        sum2 = sum2 >= kBase ? sum2 - kBase : sum2;
+        return sum2 << 16 | sum1;
+    }
+
+    // Deflate writes bits from the least significant end, Huffman codes most significant bit first.
+    constexpr U32 ReverseBits(const U32 value, const U32 numBits)
+    {
+        U32 result = 0;
+        for (U32 bit = 0; bit < numBits; ++bit)
+        {
+            result |= (value >> bit & 1) << (numBits - 1 - bit);
+        }
+        return result;
+    }
+
+    struct BitCode
+    {
+        U32 m_bits;
+        U32 m_numBits;
+    };
+
+    // Code of a literal or length symbol in the fixed Huffman table, already reversed.
+    constexpr BitCode FixedLiteralCode(const U32 symbol)
+    {
+        if (symbol < 144)
+        {
+            return {ReverseBits(0x30 + symbol, 8), 8};
+        }
+        if (symbol < 256)
+        {
+            return {ReverseBits(0x190 + symbol - 144, 9), 9};
+        }
+        if (symbol < 280)
+        {
+            return {ReverseBits(symbol - 256, 7), 7};
+        }
+        return {ReverseBits(0xC0 + symbol - 280, 8), 8};
+    }
+
+    struct FixedHuffmanTable
+    {
+        BitCode m_literals[256];
+        // Symbol and extra bits of every match length, indexed by length - 3.
+        BitCode m_lengths[kDeflateMaxMatch - 2];
+    };
+
+    static constexpr FixedHuffmanTable kFixedHuffman = [] {
+        FixedHuffmanTable table{};
+        for (U32 literal = 0; literal < 256; ++literal)
+        {
+            table.m_literals[literal] = FixedLiteralCode(literal);
+        }
+        for (U32 offset = 0; offset <= kDeflateMaxMatch - 3; ++offset)
+        {
+            U32 symbol = 257 + offset;
+            U32 numExtraBits = 0;
+            if (offset == kDeflateMaxMatch - 3)
+            {
+                symbol = 285;
+            }
+            else if (offset >= 8)
+            {
+                const U32 log2 = 31 - static_cast<U32>(__builtin_clz(offset));
+                symbol = 257 + 4 * (log2 - 1) + (offset >> (log2 - 2) & 3);
+                numExtraBits = log2 - 2;
+            }
+            const BitCode code = FixedLiteralCode(symbol);
+            const U32 extra = offset & ((1u << numExtraBits) - 1);
+            table.m_lengths[offset] = {code.m_bits | extra << code.m_numBits, code.m_numBits + numExtraBits};
+        }
+        return table;
+    }();
+
+    // Distance symbol and extra bits, fixed distance codes are all 5 bits.
+    constexpr BitCode FixedDistanceCode(const U32 distance)
+    {
+        const U32 offset = distance - 1;
+        if (offset < 4)
+        {
+            return {ReverseBits(offset, 5), 5};
+        }
+        const U32 log2 = 31 - static_cast<U32>(__builtin_clz(offset));
+        const U32 symbol = 2 * log2 + (offset >> (log2 - 1) & 1);
+        const U32 numExtraBits = log2 - 1;
+        return {ReverseBits(symbol, 5) | (offset & ((1u << numExtraBits) - 1)) << 5, 5 + numExtraBits};
+    }
+
+    struct BitWriter
+    {
+        U8 *m_pDst;
+        U64 m_bits = 0;
+        U32 m_numBits = 0;
+    };
+
+    inline void PutBits(BitWriter &writer, const BitCode code)
+    {
+        writer.m_bits |= static_cast<U64>(code.m_bits) << writer.m_numBits;
+        writer.m_numBits += code.m_numBits;
+        if (writer.m_numBits >= 32)
+        {
+            const U32 word = static_cast<U32>(writer.m_bits);
+            __builtin_memcpy(writer.m_pDst, &word, sizeof(word));
+            writer.m_pDst += 4;
+            writer.m_bits >>= 32;
+            writer.m_numBits -= 32;
+        }
+    }
+
+    // Pads to a byte boundary and writes out what is left.
+    inline U8 *FlushBits(BitWriter &writer)
+    {
+        for (; writer.m_numBits > 0; writer.m_numBits = writer.m_numBits > 8 ? writer.m_numBits - 8 : 0)
+        {
+            *writer.m_pDst++ = static_cast<U8>(writer.m_bits);
+            writer.m_bits >>= 8;
+        }
+        return writer.m_pDst;
+    }
+
+    // Compresses one strip as a single fixed Huffman block with greedy hash chain free LZ77 matching. Rendered frames
+    // are mostly flat, so filtered rows become long runs that fixed codes already compress well. Unless isFinal the
+    // block ends with an empty stored block, which byte aligns the output so the next strip's blocks can follow.
+    inline U8 *DeflateStrip(const U8 *pData, const U32 size, const bool isFinal, U8 *pDst)
+    {
+        U32 table[1u << kDeflateHashBits] = {};
+        BitWriter writer{pDst};
+        PutBits(writer, {isFinal ? 0b011u : 0b010u, 3});
+        U32 i = 0;
+        while (i + kDeflateMinMatch <= size)
+        {
+            U32 word;
+            __builtin_memcpy(&word, pData + i, sizeof(word));
+            const U32 hash = word * 0x9E3779B1u >> (32 - kDeflateHashBits);
+            const U32 candidate = table[hash];
+            table[hash] = i + 1;
+            bool isMatch = candidate != 0 && i + 1 - candidate <= kDeflateMaxDistance;
+            if (isMatch)
+            {
+                U32 candidateWord;
+                __builtin_memcpy(&candidateWord, pData + candidate - 1, sizeof(candidateWord));
+                isMatch = candidateWord == word;
+            }
+            if (!isMatch)
+            {
+                PutBits(writer, kFixedHuffman.m_literals[pData[i]]);
+                ++i;
+                continue;
+            }
+            const U32 match = candidate - 1;
+            const U32 maxLength = Min(size - i, kDeflateMaxMatch);
+            U32 length = kDeflateMinMatch;
+            for (;;)
+            {
+                if (length + 8 > maxLength)
+                {
+                    while (length < maxLength && pData[i + length] == pData[match + length])
+                    {
+                        ++length;
+                    }
+                    break;
+                }
+                U64 a, b;
+                __builtin_memcpy(&a, pData + i + length, sizeof(a));
+                __builtin_memcpy(&b, pData + match + length, sizeof(b));
+                if (a != b)
+                {
+                    length += static_cast<U32>(__builtin_ctzll(a ^ b)) / 8;
+                    break;
+                }
+                length += 8;
+            }
+            PutBits(writer, kFixedHuffman.m_lengths[length - 3]);
+            PutBits(writer, FixedDistanceCode(i - match));
+            i += length;
+        }
+        for (; i < size; ++i)
+        {
+            PutBits(writer, kFixedHuffman.m_literals[pData[i]]);
+        }
+        PutBits(writer, FixedLiteralCode(256));
+        if (!isFinal)
+        {
+            PutBits(writer, {0b000u, 3});
+            U8 *p = FlushBits(writer);
+            const U8 kEmptyStored[] = {0x00, 0x00, 0xFF, 0xFF};
+            __builtin_memcpy(p, kEmptyStored, sizeof(kEmptyStored));
+            return p + sizeof(kEmptyStored);
+        }
+        return FlushBits(writer);
+    }
+
+    inline U8x16 MaskAlpha(const U32 *pPixels)
+    {
+        U32x4 pixels;
+        __builtin_memcpy(&pixels, pPixels, sizeof(pixels));
+        return reinterpret_cast<U8x16>(pixels & 0xFFFFFFu);
+    }
+
+    // Sum of the filtered bytes read as signed, the usual heuristic for picking a row filter.
+    inline U32 FilterCost(const U8x16 filtered)
+    {
+        const U8x16 magnitude = filtered < 0x80 ? filtered : 0 - filtered;
+        U32 cost = 0;
+        for (U32 i = 0; i < 16; ++i)
+        {
+            cost += magnitude[i];
+        }
+        return cost;
+    }
+
+    // Writes one filtered row, the filter byte followed by R, G, B per pixel, choosing between the Sub and Up filters.
+    // Lanes are differenced modulo 256 as the filters define, four pixels at a time.
+    inline void FilterPngRow(const U32 *pRow, const U32 *pPrevRow, const U32 width, U8 *pDst)
+    {
+        const auto sub = [pRow](const U32 x) {
+            const U8x16 current = MaskAlpha(pRow + x);
+            const U8x16 left = x > 0 ? MaskAlpha(pRow + x - 1)
+                                     : reinterpret_cast<U8x16>(__builtin_shufflevector(
+                                           U32x4{}, reinterpret_cast<U32x4>(current), 0, 4, 5, 6));
+            return current - left;
+        };
+        const auto up = [pRow, pPrevRow](const U32 x) {
+            return pPrevRow ? MaskAlpha(pRow + x) - MaskAlpha(pPrevRow + x) : MaskAlpha(pRow + x);
+        };
+        const U32 numVectorPixels = width & ~3u;
+        U32 subCost = 0;
+        U32 upCost = 0;
+        for (U32 x = 0; x < numVectorPixels; x += 4)
+        {
+            subCost += FilterCost(sub(x));
+            upCost += FilterCost(up(x));
+        }
+        const bool isSub = subCost <= upCost;
+        *pDst++ = isSub ? 1 : 2;
+        for (U32 x = 0; x < numVectorPixels; x += 4)
+        {
+            const U8x16 filtered = isSub ? sub(x) : up(x);
+            const U8x16 rgb = __builtin_shufflevector(filtered, filtered, 2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, 3, 7,
+                                                      11, 15);
+            __builtin_memcpy(pDst + x * 3, &rgb, 12);
+        }
+        for (U32 x = numVectorPixels; x < width; ++x)
+        {
+            const U32 reference = isSub ? (x > 0 ? pRow[x - 1] : 0) : (pPrevRow ? pPrevRow[x] : 0);
+            pDst[x * 3 + 0] = static_cast<U8>((pRow[x] >> 16) - (reference >> 16));
+            pDst[x * 3 + 1] = static_cast<U8>((pRow[x] >> 8) - (reference >> 8));
+            pDst[x * 3 + 2] = static_cast<U8>(pRow[x] - reference);
+        }
+    }
+
+    inline U32 PngRowSize(const U32 width)
+    {
+        return 1 + width * 3;
+    }
+
+    // Fixed codes spend at most 9 bits per byte, plus the block header, end of block and alignment.
+    inline std::size_t PngStripBound(const U32 width)
+    {
+        const std::size_t rawSize = static_cast<std::size_t>(PngRowSize(width)) * kImageStripHeight;
+        return kPngChunkOverhead + 2 + rawSize + rawSize / 8 + 16;
+    }
+
+    inline std::size_t PngBound(const U32 width, const U32 height)
+    {
+        return sizeof(kPngSignature) + kPngChunkOverhead + 13 + NumImageStrips(height) * PngStripBound(width) +
+               kPngChunkOverhead + 4 + kPngChunkOverhead;
+    }
+
+    inline U8 *WritePngChunk(U8 *pDst, const char *type, const U8 *pData, const U32 size)
+    {
+        StoreBigEndian(pDst, size);
+        __builtin_memcpy(pDst + 4, type, 4);
+        __builtin_memmove(pDst + 8, pData, size);
+        StoreBigEndian(pDst + 8 + size, Crc32(pDst + 4, size + 4));
+        return pDst + kPngChunkOverhead + size;
+    }
+
+    // Encodes BGRA pixels, returns the size written to pDst, which must hold PngBound bytes. Each strip is filtered,
+    // deflated and wrapped in its own IDAT chunk in parallel, the zlib checksum follows in a last small IDAT.
+    inline std::size_t EncodePng(const U32 *pPixels, const U32 width, const U32 height, U8 *pDst)
+    {
+        U8 *p = pDst;
+        __builtin_memcpy(p, kPngSignature, sizeof(kPngSignature));
+        p += sizeof(kPngSignature);
+        U8 header[13];
+        StoreBigEndian(header, width);
+        StoreBigEndian(header + 4, height);
+        header[8] = 8;  // Bit depth.
+        header[9] = 2;  // Truecolor.
+        header[10] = 0; // Deflate.
+        header[11] = 0; // Adaptive filtering.
+        header[12] = 0; // Not interlaced.
+        p = WritePngChunk(p, "IHDR", header, sizeof(header));
+
+        const U32 numStrips = NumImageStrips(height);
+        const U32 rowSize = PngRowSize(width);
+        const std::size_t slotSize = PngStripBound(width);
+        U8 *pFiltered = new U8[static_cast<std::size_t>(rowSize) * height];
+        std::size_t stripSizes[(1u << 16) / kImageStripHeight];
+        U32 stripAdlers[(1u << 16) / kImageStripHeight];
+        U8 *const pSlots = p;
+#pragma omp parallel for
+        for (U32 iStrip = 0; iStrip < numStrips; ++iStrip)
+        {
+            const U32 y0 = iStrip * kImageStripHeight;
+            const U32 numRows = Min(y0 + kImageStripHeight, height) - y0;
+            U8 *pRaw = pFiltered + static_cast<std::size_t>(y0) * rowSize;
+            for (U32 y = y0; y < y0 + numRows; ++y)
+            {
+                FilterPngRow(pPixels + y * width, y > 0 ? pPixels + (y - 1) * width : nullptr, width,
+                             pFiltered + static_cast<std::size_t>(y) * rowSize);
+            }
+            const U32 rawSize = numRows * rowSize;
+            stripAdlers[iStrip] = Adler32(pRaw, rawSize);
+
+            U8 *pChunk = pSlots + iStrip * slotSize;
+            U8 *pData = pChunk + 8;
+            if (iStrip == 0)
+            {
+                // zlib header: deflate with a 32 KB window, fastest compression level.
+                *pData++ = 0x78;
+                *pData++ = 0x01;
+            }
+            pData = DeflateStrip(pRaw, rawSize, iStrip + 1 == numStrips, pData);
+            const U32 dataSize = static_cast<U32>(pData - pChunk - 8);
+            StoreBigEndian(pChunk, dataSize);
+            __builtin_memcpy(pChunk + 4, "IDAT", 4);
+            StoreBigEndian(pData, Crc32(pChunk + 4, dataSize + 4));
+            stripSizes[iStrip] = kPngChunkOverhead + dataSize;
+        }
+        delete[] pFiltered;
+
+        U32 adler = stripAdlers[0];
+        for (U32 iStrip = 1; iStrip < numStrips; ++iStrip)
+        {
+            const U32 numRows = Min((iStrip + 1) * kImageStripHeight, height) - iStrip * kImageStripHeight;
+            adler = CombineAdler32(adler, stripAdlers[iStrip], static_cast<std::size_t>(numRows) * rowSize);
+        }
+        p = pDst + CompactStrips(pDst, static_cast<std::size_t>(p - pDst), slotSize, stripSizes, numStrips);
+        U8 checksum[4];
+        StoreBigEndian(checksum, adler);
+        p = WritePngChunk(p, "IDAT", checksum, sizeof(checksum));
+        p = WritePngChunk(p, "IEND", nullptr, 0);
+        return static_cast<std::size_t>(p - pDst);
+    }
+
+    inline std::size_t EncodedImageBound(const ImageFormat format, const U32 width, const U32 height)
+    {
+        return format == ImageFormat::kPng ? PngBound(width, height) : QoiBound(width, height);
+    }
+
+    inline std::size_t EncodeImage(const ImageFormat format, const U32 *pPixels, const U32 width, const U32 height,
+                                   U8 *pDst)
+    {
+        return format == ImageFormat::kPng ? EncodePng(pPixels, width, height, pDst)
+                                           : EncodeQoi(pPixels, width, height, pDst);
+    }
+
+    inline bool WriteImageFile(const char *path, const ImageFormat format, const U32 *pPixels, const U32 width,
+                               const U32 height)
+    {
+        U8 *pEncoded = new U8[EncodedImageBound(format, width, height)];
+        const std::size_t size = EncodeImage(format, pPixels, width, height, pEncoded);
+        std::FILE *pFile = std::fopen(path, "wb");
+        const bool isWritten = pFile && std::fwrite(pEncoded, 1, size, pFile) == size;
+        if (pFile)
+        {
+            std::fclose(pFile);
+        }
+        delete[] pEncoded;
+        return isWritten;
+    }
+
+    // Reads a QOI file into pixels the caller deletes with delete[], nullptr when it is missing or malformed.
+    inline U32 *ReadQoiFile(const char *path, U32 &width, U32 &height)
+    {
+        std::FILE *pFile = std::fopen(path, "rb");
+        if (!pFile)
+        {
+            return nullptr;
+        }
+        std::fseek(pFile, 0, SEEK_END);
+        const long size = std::ftell(pFile);
+        std::fseek(pFile, 0, SEEK_SET);
+        U32 *pPixels = nullptr;
+        if (size > 0)
+        {
+            U8 *pEncoded = new U8[static_cast<std::size_t>(size)];
+            if (std::fread(pEncoded, 1, static_cast<std::size_t>(size), pFile) == static_cast<std::size_t>(size))
+            {
+                pPixels = DecodeQoi(pEncoded, static_cast<std::size_t>(size), width, height);
+            }
+            delete[] pEncoded;
+        }
+        std::fclose(pFile);
+        return pPixels;
+    }
+}
@@ -0,0 +1,503 @@
+#pragma once
+
+#include <cstddef>
+
+#include <common.hpp>
+#include <image.hpp>
+
+namespace Engine
+{
+    // Baseline JPEG, 4:2:0 with the standard tables of the specification's annex K. Each row of 16x16 pixel MCUs is
+    // a restart interval, so rows are converted, transformed and entropy coded independently in parallel and then
+    // concatenated like the strips of the other encoders.
+    static constexpr U32 kJpegMcuSize = 16;
+    static constexpr U32 kJpegDefaultQuality = 75;
+    // Markers and tables in front of the scan.
+    static constexpr std::size_t kJpegHeaderBound = 1024;
+
+    // Natural order index of each zigzag position.
+    static constexpr U8 kJpegZigzag[64] = {
+        0, 1, 8, 16, 9, 2, 3, 10, 17, 24, 32, 25, 18, 11, 4, 5, 12, 19, 26, 33, 40, 48,
+        41, 34, 27, 20, 13, 6, 7, 14, 21, 28, 35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23,
+        30, 37, 44, 51, 58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63,
+    };
+
+    static constexpr U8 kJpegLumaQuantization[64] = {
+        16, 11, 10, 16, 24, 40, 51, 61, 12, 12, 14, 19, 26, 58, 60, 55,
+        14, 13, 16, 24, 40, 57, 69, 56, 14, 17, 22, 29, 51, 87, 80, 62,
+        18, 22, 37, 56, 68, 109, 103, 77, 24, 35, 55, 64, 81, 104, 113, 92,
+        49, 64, 78, 87, 103, 121, 120, 101, 72, 92, 95, 98, 112, 100, 103, 99,
+    };
+
+    static constexpr U8 kJpegChromaQuantization[64] = {
+        17, 18, 24, 47, 99, 99, 99, 99, 18, 21, 26, 66, 99, 99, 99, 99,
+        24, 26, 56, 99, 99, 99, 99, 99, 47, 66, 99, 99, 99, 99, 99, 99,
+        99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99,
+        99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99,
+    };
+
+    // Number of codes of each length from 1 to 16 followed by the symbols in code order, as stored in DHT segments.
+    static constexpr U8 kJpegLumaDcSpec[] = {
+        0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0,
+        0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11,
+    };
+
+    static constexpr U8 kJpegChromaDcSpec[] = {
+        0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0,
+        0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11,
+    };
+
+    static constexpr U8 kJpegLumaAcSpec[] = {
+        0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7D,
+        0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+        0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xA1, 0x08, 0x23, 0x42, 0xB1, 0xC1, 0x15, 0x52, 0xD1, 0xF0,
+        0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0A, 0x16, 0x17, 0x18, 0x19, 0x1A, 0x25, 0x26, 0x27, 0x28,
+        0x29, 0x2A, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+        0x4A, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5A, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+        0x6A, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7A, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+        0x8A, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9A, 0xA2, 0xA3, 0xA4, 0xA5, 0xA6, 0xA7,
+        0xA8, 0xA9, 0xAA, 0xB2, 0xB3, 0xB4, 0xB5, 0xB6, 0xB7, 0xB8, 0xB9, 0xBA, 0xC2, 0xC3, 0xC4, 0xC5,
+        0xC6, 0xC7, 0xC8, 0xC9, 0xCA, 0xD2, 0xD3, 0xD4, 0xD5, 0xD6, 0xD7, 0xD8, 0xD9, 0xDA, 0xE1, 0xE2,
+        0xE3, 0xE4, 0xE5, 0xE6, 0xE7, 0xE8, 0xE9, 0xEA, 0xF1, 0xF2, 0xF3, 0xF4, 0xF5, 0xF6, 0xF7, 0xF8,
+        0xF9, 0xFA,
+    };
+
+    static constexpr U8 kJpegChromaAcSpec[] = {
+        0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77,
+        0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+        0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xA1, 0xB1, 0xC1, 0x09, 0x23, 0x33, 0x52, 0xF0,
+        0x15, 0x62, 0x72, 0xD1, 0x0A, 0x16, 0x24, 0x34, 0xE1, 0x25, 0xF1, 0x17, 0x18, 0x19, 0x1A, 0x26,
+        0x27, 0x28, 0x29, 0x2A, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+        0x49, 0x4A, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5A, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+        0x69, 0x6A, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7A, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+        0x88, 0x89, 0x8A, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9A, 0xA2, 0xA3, 0xA4, 0xA5,
+        0xA6, 0xA7, 0xA8, 0xA9, 0xAA, 0xB2, 0xB3, 0xB4, 0xB5, 0xB6, 0xB7, 0xB8, 0xB9, 0xBA, 0xC2, 0xC3,
+        0xC4, 0xC5, 0xC6, 0xC7, 0xC8, 0xC9, 0xCA, 0xD2, 0xD3, 0xD4, 0xD5, 0xD6, 0xD7, 0xD8, 0xD9, 0xDA,
+        0xE2, 0xE3, 0xE4, 0xE5, 0xE6, 0xE7, 0xE8, 0xE9, 0xEA, 0xF2, 0xF3, 0xF4, 0xF5, 0xF6, 0xF7, 0xF8,
+        0xF9, 0xFA,
+    };
+
+    // Codes indexed by symbol, built from a table spec the way decoders build them.
+    struct JpegHuffmanTable
+    {
+        BitCode m_codes[256];
+    };
+
+    template<std::size_t kSpecSize>
+    constexpr JpegHuffmanTable MakeJpegHuffmanTable(const U8 (&spec)[kSpecSize])
+    {
+        JpegHuffmanTable table{};
+        U32 code = 0;
+        U32 iSymbol = 16;
+        for (U32 length = 1; length <= 16; ++length)
+        {
+            for (U32 iCode = 0; iCode < spec[length - 1]; ++iCode)
+            {
+                table.m_codes[spec[iSymbol++]] = {code++, length};
+            }
+            code <<= 1;
+        }
+        return table;
+    }
+
+    static constexpr JpegHuffmanTable kJpegHuffman[4] = {
+        MakeJpegHuffmanTable(kJpegLumaDcSpec),
+        MakeJpegHuffmanTable(kJpegLumaAcSpec),
+        MakeJpegHuffmanTable(kJpegChromaDcSpec),
+        MakeJpegHuffmanTable(kJpegChromaAcSpec),
+    };
+
+    // Quantization for one quality setting. The DCT below leaves its outputs scaled by the AAN factors and 8, which
+    // the reciprocals fold in, and leaves blocks transposed, so m_reciprocals is indexed by column * 8 + row.
+    struct JpegQuantization
+    {
+        // Zigzag order, as written to the DQT segment.
+        U8 m_tables[2][64];
+        F32x8 m_reciprocals[2][8];
+    };
+
+    // Quality from 1 to 100 scales the annex tables like libjpeg does, so files match what users expect of a number.
+    inline JpegQuantization MakeJpegQuantization(const U32 quality)
+    {
+        static constexpr F32 kAanScales[8] = {
+            1.0f, 1.387039845f, 1.306562965f, 1.175875602f, 1.0f, 0.785694958f, 0.541196100f, 0.275899379f,
+        };
+        const U32 clamped = Clamp(quality, 1u, 100u);
+        const U32 scale = clamped < 50 ? 5000 / clamped : 200 - clamped * 2;
+        JpegQuantization quantization;
+        for (U32 iTable = 0; iTable < 2; ++iTable)
+        {
+            const U8 *pBase = iTable == 0 ? kJpegLumaQuantization : kJpegChromaQuantization;
+            for (U32 i = 0; i < 64; ++i)
+            {
+                const U32 value = Clamp((pBase[i] * scale + 50) / 100, 1u, 255u);
+                const U32 row = i / 8;
+                const U32 column = i % 8;
+                quantization.m_reciprocals[iTable][column][row] =
+                    1.0f / (static_cast<F32>(value) * kAanScales[row] * kAanScales[column] * 8.0f);
+            }
+            for (U32 iZigzag = 0; iZigzag < 64; ++iZigzag)
+            {
+                quantization.m_tables[iTable][iZigzag] =
+                    static_cast<U8>(Clamp((pBase[kJpegZigzag[iZigzag]] * scale + 50) / 100, 1u, 255u));
+            }
+        }
+        return quantization;
+    }
+
+    // One dimensional AAN DCT across the eight rows, so all eight columns are transformed at once.
+    inline void ForwardDct8(F32x8 (&rows)[8])
+    {
+        const F32x8 tmp0 = rows[0] + rows[7];
+        const F32x8 tmp7 = rows[0] - rows[7];
+        const F32x8 tmp1 = rows[1] + rows[6];
+        const F32x8 tmp6 = rows[1] - rows[6];
+        const F32x8 tmp2 = rows[2] + rows[5];
+        const F32x8 tmp5 = rows[2] - rows[5];
+        const F32x8 tmp3 = rows[3] + rows[4];
+        const F32x8 tmp4 = rows[3] - rows[4];
+
+        const F32x8 even0 = tmp0 + tmp3;
+        const F32x8 even3 = tmp0 - tmp3;
+        const F32x8 even1 = tmp1 + tmp2;
+        const F32x8 even2 = tmp1 - tmp2;
+        rows[0] = even0 + even1;
+        rows[4] = even0 - even1;
+        const F32x8 z1 = (even2 + even3) * 0.707106781f;
+        rows[2] = even3 + z1;
+        rows[6] = even3 - z1;
+
+        const F32x8 odd0 = tmp4 + tmp5;
+        const F32x8 odd1 = tmp5 + tmp6;
+        const F32x8 odd2 = tmp6 + tmp7;
+        const F32x8 z5 = (odd0 - odd2) * 0.382683433f;
+        const F32x8 z2 = odd0 * 0.541196100f + z5;
+        const F32x8 z4 = odd2 * 1.306562965f + z5;
+        const F32x8 z3 = odd1 * 0.707106781f;
+        const F32x8 z11 = tmp7 + z3;
+        const F32x8 z13 = tmp7 - z3;
+        rows[5] = z13 + z2;
+        rows[3] = z13 - z2;
+        rows[1] = z11 + z4;
+        rows[7] = z11 - z4;
+    }
+
+    inline void Transpose8x8(F32x8 (&rows)[8])
+    {
+        F32x8 pairs[8];
+        for (U32 i = 0; i < 8; i += 2)
+        {
+            pairs[i] = __builtin_shufflevector(rows[i], rows[i + 1], 0, 8, 1, 9, 4, 12, 5, 13);
+            pairs[i + 1] = __builtin_shufflevector(rows[i], rows[i + 1], 2, 10, 3, 11, 6, 14, 7, 15);
+        }
+        F32x8 quads[8];
+        for (U32 i = 0; i < 8; i += 4)
+        {
+            quads[i] = __builtin_shufflevector(pairs[i], pairs[i + 2], 0, 1, 8, 9, 4, 5, 12, 13);
+            quads[i + 1] = __builtin_shufflevector(pairs[i], pairs[i + 2], 2, 3, 10, 11, 6, 7, 14, 15);
+            quads[i + 2] = __builtin_shufflevector(pairs[i + 1], pairs[i + 3], 0, 1, 8, 9, 4, 5, 12, 13);
+            quads[i + 3] = __builtin_shufflevector(pairs[i + 1], pairs[i + 3], 2, 3, 10, 11, 6, 7, 14, 15);
+        }
+        for (U32 i = 0; i < 4; ++i)
+        {
+            rows[i] = __builtin_shufflevector(quads[i], quads[i + 4], 0, 1, 2, 3, 8, 9, 10, 11);
+            rows[i + 4] = __builtin_shufflevector(quads[i], quads[i + 4], 4, 5, 6, 7, 12, 13, 14, 15);
+        }
+    }
+
+    // Transforms and quantizes a level shifted block into zigzag order.
+    inline void QuantizeBlock(F32x8 (&rows)[8], const F32x8 (&reciprocals)[8], I32 (&coefficients)[64])
+    {
+        ForwardDct8(rows);
+        Transpose8x8(rows);
+        ForwardDct8(rows);
+        alignas(32) I32 transposed[64];
+        for (U32 i = 0; i < 8; ++i)
+        {
+            // Rounds to nearest by truncating a positive value, magnitudes stay far below the offset.
+            const F32x8 scaled = rows[i] * reciprocals[i] + 16384.5f;
+            const I32x8 rounded = __builtin_convertvector(scaled, I32x8) - 16384;
+            __builtin_memcpy(transposed + i * 8, &rounded, sizeof(rounded));
+        }
+        for (U32 i = 0; i < 64; ++i)
+        {
+            const U32 natural = kJpegZigzag[i];
+            coefficients[i] = transposed[natural % 8 * 8 + natural / 8];
+        }
+    }
+
+    // Most significant bit first, with a zero byte stuffed after every 0xFF so it cannot be taken for a marker.
+    struct JpegBitWriter
+    {
+        U8 *m_pDst;
+        U64 m_bits = 0;
+        U32 m_numBits = 0;
+    };
+
+    inline void PutJpegByte(JpegBitWriter &writer, const U8 byte)
+    {
+        *writer.m_pDst++ = byte;
+        if (byte == 0xFF)
+        {
+            *writer.m_pDst++ = 0;
+        }
+    }
+
+    // Callers put at most 27 bits at a time, a Huffman code with its value bits.
+    inline void PutJpegBits(JpegBitWriter &writer, const U32 bits, const U32 numBits)
+    {
+        writer.m_bits = writer.m_bits << numBits | bits;
+        writer.m_numBits += numBits;
+        if (writer.m_numBits < 32)
+        {
+            return;
+        }
+        writer.m_numBits -= 32;
+        const U32 word = static_cast<U32>(writer.m_bits >> writer.m_numBits);
+        // Whole words go out at once unless one of their bytes needs stuffing.
+        const U32 inverted = ~word;
+        if (((inverted - 0x01010101u) & ~inverted & 0x80808080u) == 0)
+        {
+            const U32 bigEndian = __builtin_bswap32(word);
+            __builtin_memcpy(writer.m_pDst, &bigEndian, sizeof(bigEndian));
+            writer.m_pDst += 4;
+            return;
+        }
+        for (I32 shift = 24; shift >= 0; shift -= 8)
+        {
+            PutJpegByte(writer, static_cast<U8>(word >> shift));
+        }
+    }
+
+    // Pads the last byte with one bits, as the specification asks before a marker.
+    inline U8 *FlushJpegBits(JpegBitWriter &writer)
+    {
+        const U32 padding = (8 - writer.m_numBits % 8) % 8;
+        writer.m_bits = writer.m_bits << padding | ((1u << padding) - 1);
+        writer.m_numBits += padding;
+        for (; writer.m_numBits > 0; writer.m_numBits -= 8)
+        {
+            PutJpegByte(writer, static_cast<U8>(writer.m_bits >> (writer.m_numBits - 8)));
+        }
+        return writer.m_pDst;
+    }
+
+    // Number of bits of a coefficient's magnitude and the bits that code it, negative values are stored minus one.
+    inline void PutJpegValue(JpegBitWriter &writer, const BitCode code, const I32 value, const U32 category)
+    {
+        const U32 bits = static_cast<U32>(value < 0 ? value - 1 : value) & ((1u << category) - 1);
+        PutJpegBits(writer, code.m_bits << category | bits, code.m_numBits + category);
+    }
+
+    inline U32 JpegCategory(const I32 value)
+    {
+        const U32 magnitude = static_cast<U32>(value < 0 ? -value : value);
+        return magnitude == 0 ? 0 : 32 - static_cast<U32>(__builtin_clz(magnitude));
+    }
+
+    inline void EncodeJpegBlock(JpegBitWriter &writer, const I32 (&coefficients)[64], I32 &dcPredictor,
+                                const JpegHuffmanTable &dcTable, const JpegHuffmanTable &acTable)
+    {
+        const I32 dcDifference = coefficients[0] - dcPredictor;
+        dcPredictor = coefficients[0];
+        const U32 dcCategory = JpegCategory(dcDifference);
+        PutJpegValue(writer, dcTable.m_codes[dcCategory], dcDifference, dcCategory);
+
+        // Rendered blocks are mostly flat, so walk only the nonzero coefficients.
+        U64 nonzero = 0;
+        for (U32 i = 1; i < 64; ++i)
+        {
+            nonzero |= static_cast<U64>(coefficients[i] != 0) << i;
+        }
+        U32 last = 0;
+        for (; nonzero != 0; nonzero &= nonzero - 1)
+        {
+            const U32 i = static_cast<U32>(__builtin_ctzll(nonzero));
+            U32 run = i - last - 1;
+            for (; run >= 16; run -= 16)
+            {
+                const BitCode zeroRun = acTable.m_codes[0xF0];
+                PutJpegBits(writer, zeroRun.m_bits, zeroRun.m_numBits);
+            }
+            // Baseline AC values have at most 10 bits.
+            const I32 value = Clamp(coefficients[i], -1023, 1023);
+            const U32 category = JpegCategory(value);
+            PutJpegValue(writer, acTable.m_codes[run << 4 | category], value, category);
+            last = i;
+        }
+        if (last != 63)
+        {
+            const BitCode endOfBlock = acTable.m_codes[0x00];
+            PutJpegBits(writer, endOfBlock.m_bits, endOfBlock.m_numBits);
+        }
+    }
+
+    // A block codes in at most 22 bits of DC and 26 bits for each AC coefficient, all of it possibly stuffed.
+    inline std::size_t JpegRowBound(const U32 width)
+    {
+        const U32 numMcus = (width + kJpegMcuSize - 1) / kJpegMcuSize;
+        return static_cast<std::size_t>(numMcus) * 6 * (22 + 63 * 26) / 8 * 2 + 16;
+    }
+
+    inline std::size_t JpegBound(const U32 width, const U32 height)
+    {
+        return kJpegHeaderBound + (height + kJpegMcuSize - 1) / kJpegMcuSize * JpegRowBound(width);
+    }
+
+    // Codes one row of MCUs as a restart interval, ending with the next restart marker unless it is the last row.
+    inline U8 *EncodeJpegRow(const U32 *pPixels, const U32 width, const U32 height, const U32 iRow, const bool isLast,
+                             const JpegQuantization &quantization, U8 *pDst)
+    {
+        JpegBitWriter writer{pDst};
+        I32 predictors[3] = {};
+        const U32 y0 = iRow * kJpegMcuSize;
+        for (U32 x0 = 0; x0 < width; x0 += kJpegMcuSize)
+        {
+            // Edges repeat the last column and row, which keeps the padding from bleeding into visible pixels.
+            alignas(32) U32 mcu[kJpegMcuSize * kJpegMcuSize];
+            for (U32 y = 0; y < kJpegMcuSize; ++y)
+            {
+                const U32 *pRow = pPixels + Min(y0 + y, height - 1) * width;
+                if (x0 + kJpegMcuSize <= width)
+                {
+                    __builtin_memcpy(mcu + y * kJpegMcuSize, pRow + x0, kJpegMcuSize * sizeof(U32));
+                    continue;
+                }
+                for (U32 x = 0; x < kJpegMcuSize; ++x)
+                {
+                    mcu[y * kJpegMcuSize + x] = pRow[Min(x0 + x, width - 1)];
+                }
+            }
+
+            // Full range BT.601 as JFIF defines it, luma level shifted to be centered on zero like chroma.
+            F32x8 luma[4][8];
+            F32x8 chroma[2][8];
+            for (U32 y = 0; y < kJpegMcuSize; y += 2)
+            {
+                F32x8 cbSums[2];
+                F32x8 crSums[2];
+                for (U32 half = 0; half < 2; ++half)
+                {
+                    cbSums[half] = crSums[half] = F32x8{};
+                    for (U32 row = y; row < y + 2; ++row)
+                    {
+                        U32x8 pixels;
+                        __builtin_memcpy(&pixels, mcu + row * kJpegMcuSize + half * 8, sizeof(pixels));
+                        const F32x8 r = __builtin_convertvector(pixels >> 16 & 0xFFu, F32x8);
+                        const F32x8 g = __builtin_convertvector(pixels >> 8 & 0xFFu, F32x8);
+                        const F32x8 b = __builtin_convertvector(pixels & 0xFFu, F32x8);
+                        luma[row / 8 * 2 + half][row % 8] = r * 0.299f + g * 0.587f + b * 0.114f - 128.0f;
+                        cbSums[half] += r * -0.168736f + g * -0.331264f + b * 0.5f;
+                        crSums[half] += r * 0.5f + g * -0.418688f + b * -0.081312f;
+                    }
+                }
+                // Sum horizontal neighbours for the 2x2 average.
+                chroma[0][y / 2] = (__builtin_shufflevector(cbSums[0], cbSums[1], 0, 2, 4, 6, 8, 10, 12, 14) +
+                                    __builtin_shufflevector(cbSums[0], cbSums[1], 1, 3, 5, 7, 9, 11, 13, 15)) * 0.25f;
+                chroma[1][y / 2] = (__builtin_shufflevector(crSums[0], crSums[1], 0, 2, 4, 6, 8, 10, 12, 14) +
+                                    __builtin_shufflevector(crSums[0], crSums[1], 1, 3, 5, 7, 9, 11, 13, 15)) * 0.25f;
+            }
+
+            I32 coefficients[64];
+            for (U32 iBlock = 0; iBlock < 4; ++iBlock)
+            {
+                QuantizeBlock(luma[iBlock], quantization.m_reciprocals[0], coefficients);
+                EncodeJpegBlock(writer, coefficients, predictors[0], kJpegHuffman[0], kJpegHuffman[1]);
+            }
+            for (U32 iChroma = 0; iChroma < 2; ++iChroma)
+            {
+                QuantizeBlock(chroma[iChroma], quantization.m_reciprocals[1], coefficients);
+                EncodeJpegBlock(writer, coefficients, predictors[1 + iChroma], kJpegHuffman[2], kJpegHuffman[3]);
+            }
+        }
+        U8 *p = FlushJpegBits(writer);
+        if (!isLast)
+        {
+            *p++ = 0xFF;
+            *p++ = static_cast<U8>(0xD0 + iRow % 8);
+        }
+        return p;
+    }
+
+    inline U8 *WriteJpegSegment(U8 *pDst, const U8 marker, const U32 size)
+    {
+        pDst[0] = 0xFF;
+        pDst[1] = marker;
+        pDst[2] = static_cast<U8>((size + 2) >> 8);
+        pDst[3] = static_cast<U8>(size + 2);
+        return pDst + 4;
+    }
+
+    template<std::size_t kSpecSize>
+    U8 *WriteJpegHuffmanTable(U8 *p, const U8 tableClassAndId, const U8 (&spec)[kSpecSize])
+    {
+        *p++ = tableClassAndId;
+        __builtin_memcpy(p, spec, kSpecSize);
+        return p + kSpecSize;
+    }
+
+    // Encodes BGRA pixels, returns the size written to pDst, which must hold JpegBound bytes.
+    inline std::size_t EncodeJpeg(const U32 *pPixels, const U32 width, const U32 height,
+                                  const JpegQuantization &quantization, U8 *pDst)
+    {
+        const U32 numRows = (height + kJpegMcuSize - 1) / kJpegMcuSize;
+        const U32 numMcusPerRow = (width + kJpegMcuSize - 1) / kJpegMcuSize;
+
+        U8 *p = pDst;
+        *p++ = 0xFF;
+        *p++ = 0xD8;
+        static constexpr U8 kJfif[] = {'J', 'F', 'I', 'F', 0, 1, 1, 0, 0, 1, 0, 1, 0, 0};
+        p = WriteJpegSegment(p, 0xE0, sizeof(kJfif));
+        __builtin_memcpy(p, kJfif, sizeof(kJfif));
+        p += sizeof(kJfif);
+
+        p = WriteJpegSegment(p, 0xDB, 2 * 65);
+        for (U32 iTable = 0; iTable < 2; ++iTable)
+        {
+            *p++ = static_cast<U8>(iTable);
+            __builtin_memcpy(p, quantization.m_tables[iTable], 64);
+            p += 64;
+        }
+
+        p = WriteJpegSegment(p, 0xC0, 15);
+        const U8 frame[15] = {
+            8, static_cast<U8>(height >> 8), static_cast<U8>(height), static_cast<U8>(width >> 8),
+            static_cast<U8>(width), 3,
+            // Luma sampled 2x2 with table 0, chroma 1x1 with table 1.
+            1, 0x22, 0, 2, 0x11, 1, 3, 0x11, 1,
+        };
+        __builtin_memcpy(p, frame, sizeof(frame));
+        p += sizeof(frame);
+
+        p = WriteJpegSegment(p, 0xC4, 4 + sizeof(kJpegLumaDcSpec) + sizeof(kJpegLumaAcSpec) +
+                                          sizeof(kJpegChromaDcSpec) + sizeof(kJpegChromaAcSpec));
+        p = WriteJpegHuffmanTable(p, 0x00, kJpegLumaDcSpec);
+        p = WriteJpegHuffmanTable(p, 0x10, kJpegLumaAcSpec);
+        p = WriteJpegHuffmanTable(p, 0x01, kJpegChromaDcSpec);
+        p = WriteJpegHuffmanTable(p, 0x11, kJpegChromaAcSpec);
+
+        p = WriteJpegSegment(p, 0xDD, 2);
+        *p++ = static_cast<U8>(numMcusPerRow >> 8);
+        *p++ = static_cast<U8>(numMcusPerRow);
+
+        p = WriteJpegSegment(p, 0xDA, 10);
+        static constexpr U8 kScan[] = {3, 1, 0x00, 2, 0x11, 3, 0x11, 0, 63, 0};
+        __builtin_memcpy(p, kScan, sizeof(kScan));
+        p += sizeof(kScan);
+
+        const std::size_t slotSize = JpegRowBound(width);
+        std::size_t rowSizes[(1u << 16) / kJpegMcuSize];
+        U8 *const pSlots = p;
+#pragma omp parallel for
+        for (U32 iRow = 0; iRow < numRows; ++iRow)
+        {
+            U8 *pSlot = pSlots + iRow * slotSize;
+            const U8 *pEnd = EncodeJpegRow(pPixels, width, height, iRow, iRow + 1 == numRows, quantization, pSlot);
+            rowSizes[iRow] = static_cast<std::size_t>(pEnd - pSlot);
+        }
+        p = pDst + CompactStrips(pDst, static_cast<std::size_t>(p - pDst), slotSize, rowSizes, numRows);
+        *p++ = 0xFF;
+        *p++ = 0xD9;
+        return static_cast<std::size_t>(p - pDst);
+    }
+}
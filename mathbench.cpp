@@ -0,0 +1,307 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#include <x86intrin.h>
+
+#include <common.hpp>
+
+namespace Engine
+{
+    static constexpr const char *kMathBenchUsage =
+        "Usage: %s [options]\n"
+        "  --ops COUNT   Operations per measurement, defaults to 1048576\n"
+        "  --runs COUNT  Measurements per primitive, the fastest is reported, defaults to 7\n"
+        "  --json        Report as a JSON array instead of CSV\n"
+        "Latency chains every result into the next call, throughput runs a batch of independent calls.\n"
+        "Ticks come from the TSC, which counts at the nominal clock whatever the core clock is.\n";
+
+    // Independent inputs per throughput pass, small enough for every array to stay in L1.
+    static constexpr U32 kBatchSize = 256;
+
+    struct MathBenchOptions
+    {
+        U32 m_numOps = 1u << 20;
+        U32 m_numRuns = 7;
+        bool m_isJson = false;
+    };
+
+    struct MathResult
+    {
+        F64 m_latencyTicks;
+        F64 m_throughputTicks;
+    };
+
+    // Hides the value from the optimizer, so it can neither fold the work that made it nor skip the work that uses it.
+    // The value stays in its register, the guard itself costs nothing.
+    inline void Opaque(F32 &value)
+    {
+        asm volatile("" : "+x"(value));
+    }
+
+    inline void Opaque(F32x4 &value)
+    {
+        asm volatile("" : "+x"(value));
+    }
+
+    inline void Opaque(Vec3f &v)
+    {
+        Opaque(v.m_v);
+    }
+
+    inline void Opaque(Quatf &q)
+    {
+        Opaque(q.m_v);
+    }
+
+    inline void Opaque(Pose &pose)
+    {
+        Opaque(pose.m_pos);
+        Opaque(pose.m_ori);
+    }
+
+    // Fences keep the timed instructions from leaking past either end of the measurement.
+    inline U64 ReadTicks()
+    {
+        _mm_lfence();
+        const U64 ticks = __rdtsc();
+        _mm_lfence();
+        return ticks;
+    }
+
+    inline F64 MeasureTicksPerNanosecond()
+    {
+        const auto start = std::chrono::steady_clock::now();
+        const U64 startTicks = ReadTicks();
+        auto now = start;
+        while (now - start < std::chrono::milliseconds(50))
+        {
+            now = std::chrono::steady_clock::now();
+        }
+        const U64 endTicks = ReadTicks();
+        return static_cast<F64>(endTicks - startTicks) / std::chrono::duration<F64, std::nano>(now - start).count();
+    }
+
+    // Ticks per call of step, each fed the result of the one before.
+    template<typename T, typename Step>
+    F64 MeasureLatency(const MathBenchOptions &options, const T seed, const Step step)
+    {
+        U64 bestTicks = ~0ull;
+        for (U32 iRun = 0; iRun < options.m_numRuns; ++iRun)
+        {
+            T value = seed;
+            const U64 start = ReadTicks();
+            for (U32 iOp = 0; iOp < options.m_numOps; ++iOp)
+            {
+                Opaque(value);
+                value = step(value);
+            }
+            Opaque(value);
+            const U64 ticks = ReadTicks() - start;
+            bestTicks = ticks < bestTicks ? ticks : bestTicks;
+        }
+        return static_cast<F64>(bestTicks) / options.m_numOps;
+    }
+
+    // Ticks per call of step over a batch of independent inputs, which the core is free to overlap.
+    template<typename T, typename Step>
+    F64 MeasureThroughput(const MathBenchOptions &options, const T *pInputs, T *pOutputs, const Step step)
+    {
+        const U32 numPasses = Max(options.m_numOps / kBatchSize, 1u);
+        U64 bestTicks = ~0ull;
+        for (U32 iRun = 0; iRun < options.m_numRuns; ++iRun)
+        {
+            const U64 start = ReadTicks();
+            for (U32 iPass = 0; iPass < numPasses; ++iPass)
+            {
+                for (U32 i = 0; i < kBatchSize; ++i)
+                {
+                    T value = pInputs[i];
+                    Opaque(value);
+                    pOutputs[i] = step(value);
+                }
+                // Every pass has to store its outputs, otherwise only the last one would.
+                asm volatile("" : : "r"(pOutputs) : "memory");
+            }
+            const U64 ticks = ReadTicks() - start;
+            bestTicks = ticks < bestTicks ? ticks : bestTicks;
+        }
+        return static_cast<F64>(bestTicks) / (static_cast<F64>(numPasses) * kBatchSize);
+    }
+
+    // makeInput(i) gives the i-th input, the first one seeds the latency chain. The primitives have no default
+    // constructors, so the batches are built in raw storage.
+    template<typename T, typename MakeInput, typename Step>
+    MathResult MeasurePrimitive(const MathBenchOptions &options, const MakeInput makeInput, const Step step)
+    {
+        alignas(64) U8 inputStorage[kBatchSize * sizeof(T)];
+        alignas(64) U8 outputStorage[kBatchSize * sizeof(T)];
+        T *pInputs = reinterpret_cast<T *>(inputStorage);
+        T *pOutputs = reinterpret_cast<T *>(outputStorage);
+        for (U32 i = 0; i < kBatchSize; ++i)
+        {
+            new (&pInputs[i]) T(makeInput(i));
+            new (&pOutputs[i]) T(makeInput(i));
+        }
+        return MathResult{
+            .m_latencyTicks = MeasureLatency(options, pInputs[0], step),
+            .m_throughputTicks = MeasureThroughput(options, pInputs, pOutputs, step),
+        };
+    }
+
+    inline F32 Spread(const U32 i, const F32 min, const F32 max)
+    {
+        return min + (max - min) * static_cast<F32>(i) / static_cast<F32>(kBatchSize);
+    }
+
+    inline Vec3f UnitVector(const U32 i)
+    {
+        const F32 angle = Spread(i, -kPi, kPi);
+        return Vec3f(Cos(angle), Sin(angle), 0.0f);
+    }
+
+    inline Quatf UnitQuaternion(const U32 i)
+    {
+        return FromAngleAxis(Spread(i, -kPi, kPi), Vec3f(1.0f, 2.0f, 3.0f));
+    }
+
+    inline void PrintMathResult(const MathBenchOptions &options, const char *name, const MathResult &result,
+                                const F64 ticksPerNanosecond, const bool isFirst)
+    {
+        const F64 latencyNs = result.m_latencyTicks / ticksPerNanosecond;
+        const F64 throughputNs = result.m_throughputTicks / ticksPerNanosecond;
+        if (options.m_isJson)
+        {
+            std::printf("%s\n  {\"primitive\": \"%s\", \"latency_ticks\": %.3f, \"latency_ns\": %.3f, "
+                        "\"throughput_ticks\": %.3f, \"throughput_ns\": %.3f}",
+                        isFirst ? "[" : ",", name, result.m_latencyTicks, latencyNs, result.m_throughputTicks,
+                        throughputNs);
+            return;
+        }
+        if (isFirst)
+        {
+            std::printf("primitive,latency_ticks,latency_ns,throughput_ticks,throughput_ns\n");
+        }
+        std::printf("%s,%.3f,%.3f,%.3f,%.3f\n", name, result.m_latencyTicks, latencyNs, result.m_throughputTicks,
+                    throughputNs);
+    }
+
+    inline bool ParseMathBenchArguments(const int argc, char **argv, MathBenchOptions &options)
+    {
+        for (int i = 1; i < argc; ++i)
+        {
+            const char *arg = argv[i];
+            const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+            if ((std::strcmp(arg, "--ops") == 0 || std::strcmp(arg, "--runs") == 0) && value)
+            {
+                char *end;
+                const U64 count = std::strtoull(value, &end, 10);
+                if (*end != '\0' || count == 0 || count > 1u << 30)
+                {
+                    std::fprintf(stderr, "%s must be from 1 to %u: %s\n", arg, 1u << 30, value);
+                    return false;
+                }
+                (arg[2] == 'o' ? options.m_numOps : options.m_numRuns) = static_cast<U32>(count);
+                ++i;
+            }
+            else if (std::strcmp(arg, "--json") == 0)
+            {
+                options.m_isJson = true;
+            }
+            else
+            {
+                std::fprintf(stderr, kMathBenchUsage, argv[0]);
+                return false;
+            }
+        }
+        return true;
+    }
+}
+
+int main(const int argc, char **argv)
+{
+    using namespace Engine;
+
+    MathBenchOptions options;
+    if (!ParseMathBenchArguments(argc, argv, options))
+    {
+        return 1;
+    }
+    const F64 ticksPerNanosecond = MeasureTicksPerNanosecond();
+
+    // Every step keeps its result in range, so neither denormals nor infinities skew the chains.
+    const Vec3f axisZ(0.0f, 0.0f, 1.0f);
+    const F32x4 quarter{0.25f, 0.25f, 0.25f, 0.25f};
+    const Quatf rotation = FromAngleAxis(0.1f, Vec3f(1.0f, 2.0f, 3.0f));
+    const Pose step(Vec3f(0.001f, 0.0f, 0.0f), rotation);
+    const Pose pose(Vec3f(1.0f, 2.0f, 3.0f), rotation);
+
+    struct Primitive
+    {
+        const char *m_name;
+        MathResult m_result;
+    };
+    const Primitive primitives[] = {
+        {
+            "Cross",
+            MeasurePrimitive<Vec3f>(options, UnitVector, [&](const Vec3f v) { return Cross(v, axisZ); }),
+        },
+        {
+            // The dot product is broadcast back into a vector to chain it.
+            "Dot",
+            MeasurePrimitive<F32x4>(options,
+                                    [](const U32 i) {
+                                        const F32 x = Spread(i, 0.5f, 1.5f);
+                                        return F32x4{x, x, x, x};
+                                    },
+                                    [&](const F32x4 v) {
+                                        const F32 d = Dot(v, quarter);
+                                        return F32x4{d, d, d, d};
+                                    }),
+        },
+        {
+            "QuatMultiply",
+            MeasurePrimitive<Quatf>(options, UnitQuaternion, [&](const Quatf q) { return q * rotation; }),
+        },
+        {
+            "Rotate",
+            MeasurePrimitive<Vec3f>(options, UnitVector, [&](const Vec3f v) { return Rotate(rotation, v); }),
+        },
+        {
+            "TransformPose",
+            MeasurePrimitive<Pose>(options, [&](const U32 i) { return Pose(UnitVector(i), UnitQuaternion(i)); },
+                                   [&](const Pose &p) { return Transform(p, step); }),
+        },
+        {
+            "TransformPoint",
+            MeasurePrimitive<Vec3f>(options, UnitVector, [&](const Vec3f v) { return Transform(pose, v); }),
+        },
+        {
+            "Inverse",
+            MeasurePrimitive<Pose>(options, [&](const U32 i) { return Pose(UnitVector(i), UnitQuaternion(i)); },
+                                   [](const Pose &p) { return Inverse(p); }),
+        },
+        {
+            // Inputs cover several periods so the range reduction takes every branch. Chained as x = Sin(x) the
+            // values would settle at 0, x = 10 Sin(x) keeps wandering over [-10, 10] instead. Both measurements include
+            // the multiply.
+            "Sin",
+            MeasurePrimitive<F32>(options, [](const U32 i) { return Spread(i, -10.0f, 10.0f); },
+                                  [](const F32 x) { return 10.0f * Sin(x); }),
+        },
+    };
+
+    bool isFirst = true;
+    for (const Primitive &primitive: primitives)
+    {
+        PrintMathResult(options, primitive.m_name, primitive.m_result, ticksPerNanosecond, isFirst);
+        isFirst = false;
+    }
+    if (options.m_isJson)
+    {
+        std::printf("\n]\n");
+    }
+    return 0;
+}
@@ -0,0 +1,189 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+
+#include <common.hpp>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+namespace Engine
+{
+    // Copies pixels with non-temporal stores wherever the destination is 16 byte aligned. Frames handed to the
+    // presenter are never read back by the renderer, so streaming them past the cache keeps the scene data the
+    // intersection loop needs resident. The unaligned head and tail of a row use ordinary stores.
+    inline void StreamPixels(U32 *pDst, const U32 *pSrc, U32 count)
+    {
+#if defined(__SSE2__)
+        for (; count > 0 && (reinterpret_cast<std::uintptr_t>(pDst) & 15) != 0; --count)
+        {
+            *pDst++ = *pSrc++;
+        }
+        for (; count >= 4; count -= 4, pDst += 4, pSrc += 4)
+        {
+            _mm_stream_si128(reinterpret_cast<__m128i *>(pDst),
+                             _mm_loadu_si128(reinterpret_cast<const __m128i *>(pSrc)));
+        }
+#endif
+        for (; count > 0; --count)
+        {
+            *pDst++ = *pSrc++;
+        }
+    }
+
+    // Non-temporal stores are weakly ordered, each thread fences before its results are consumed elsewhere.
+    inline void StreamFence()
+    {
+#if defined(__SSE2__)
+        _mm_sfence();
+#endif
+    }
+
+    static constexpr std::size_t kHugePageSize = 2 * 1024 * 1024;
+    static constexpr std::size_t kPageAlignment = 4096;
+
+    enum class PageKind : U8
+    {
+        // Ordinary 4 KB pages.
+        kSmall,
+        // Transparent huge pages were requested, the kernel promotes the range as 2 MB pages become available.
+        kTransparentHuge,
+        // Explicit 2 MB pages, reserved up front.
+        kHuge,
+    };
+
+    inline const char *PageKindName(const PageKind kind)
+    {
+        switch (kind)
+        {
+            case PageKind::kHuge:
+                return "2 MB pages";
+            case PageKind::kTransparentHuge:
+                return "transparent huge pages (requested)";
+            default:
+                return "4 KB pages";
+        }
+    }
+
+    struct PageAllocation
+    {
+        void *m_pData = nullptr;
+        std::size_t m_size = 0;
+        PageKind m_kind = PageKind::kSmall;
+    };
+
+    constexpr std::size_t AlignUp(const std::size_t size, const std::size_t alignment)
+    {
+        return (size + alignment - 1) / alignment * alignment;
+    }
+
+#if defined(_WIN32)
+    // Large pages need the "Lock pages in memory" right, which is granted per user but disabled in the token.
+    inline bool EnableLockMemoryPrivilege()
+    {
+        HANDLE hToken;
+        if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &hToken))
+        {
+            return false;
+        }
+        TOKEN_PRIVILEGES privileges{.PrivilegeCount = 1};
+        privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+        const bool isEnabled = LookupPrivilegeValue(nullptr, SE_LOCK_MEMORY_NAME, &privileges.Privileges[0].Luid) &&
+                               AdjustTokenPrivileges(hToken, FALSE, &privileges, 0, nullptr, nullptr) &&
+                               GetLastError() == ERROR_SUCCESS;
+        CloseHandle(hToken);
+        return isEnabled;
+    }
+#endif
+
+    // Zeroed, page aligned memory for the frame sized arrays. Tiled passes touch a few rows of several targets at
+    // once, with 4 KB pages every row is its own TLB entry. When huge pages are requested each step falls back to
+    // the next if the system refuses, check the returned kind to see what was obtained.
+    inline PageAllocation AllocatePages(const std::size_t size, const bool isHugePages)
+    {
+        PageAllocation allocation;
+#if defined(_WIN32)
+        const std::size_t largePageSize = GetLargePageMinimum();
+        if (isHugePages && largePageSize > 0 && EnableLockMemoryPrivilege())
+        {
+            allocation.m_size = AlignUp(size, largePageSize);
+            allocation.m_pData = VirtualAlloc(nullptr, allocation.m_size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES,
+                                              PAGE_READWRITE);
+            allocation.m_kind = PageKind::kHuge;
+        }
+        if (!allocation.m_pData)
+        {
+            allocation.m_size = AlignUp(size, kPageAlignment);
+            allocation.m_pData = VirtualAlloc(nullptr, allocation.m_size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+            allocation.m_kind = PageKind::kSmall;
+        }
+#elif defined(__linux__)
+        constexpr int kProtection = PROT_READ | PROT_WRITE;
+        constexpr int kFlags = MAP_PRIVATE | MAP_ANONYMOUS;
+        allocation.m_size = AlignUp(size, isHugePages ? kHugePageSize : kPageAlignment);
+        if (isHugePages)
+        {
+            // Only succeeds when pages were reserved through vm.nr_hugepages.
+            void *pData = mmap(nullptr, allocation.m_size, kProtection, kFlags | MAP_HUGETLB, -1, 0);
+            if (pData != MAP_FAILED)
+            {
+                allocation.m_pData = pData;
+                allocation.m_kind = PageKind::kHuge;
+                return allocation;
+            }
+            // Transparent huge pages only back 2 MB aligned ranges, over map and trim to the alignment.
+            pData = mmap(nullptr, allocation.m_size + kHugePageSize, kProtection, kFlags, -1, 0);
+            if (pData != MAP_FAILED)
+            {
+                const std::uintptr_t address = reinterpret_cast<std::uintptr_t>(pData);
+                const std::uintptr_t aligned = AlignUp(address, kHugePageSize);
+                if (aligned > address)
+                {
+                    munmap(pData, aligned - address);
+                }
+                munmap(reinterpret_cast<void *>(aligned + allocation.m_size), address + kHugePageSize - aligned);
+                allocation.m_pData = reinterpret_cast<void *>(aligned);
+                allocation.m_kind = madvise(allocation.m_pData, allocation.m_size, MADV_HUGEPAGE) == 0
+                                        ? PageKind::kTransparentHuge
+                                        : PageKind::kSmall;
+                return allocation;
+            }
+        }
+        void *pData = mmap(nullptr, allocation.m_size, kProtection, kFlags, -1, 0);
+        allocation.m_pData = pData != MAP_FAILED ? pData : nullptr;
+#else
+        (void)isHugePages;
+        allocation.m_size = AlignUp(size, kPageAlignment);
+        allocation.m_pData = std::aligned_alloc(kPageAlignment, allocation.m_size);
+        if (allocation.m_pData)
+        {
+            __builtin_memset(allocation.m_pData, 0, allocation.m_size);
+        }
+#endif
+        return allocation;
+    }
+
+    inline void FreePages(const PageAllocation &allocation)
+    {
+        if (!allocation.m_pData)
+        {
+            return;
+        }
+#if defined(_WIN32)
+        VirtualFree(allocation.m_pData, 0, MEM_RELEASE);
+#elif defined(__linux__)
+        munmap(allocation.m_pData, allocation.m_size);
+#else
+        std::free(allocation.m_pData);
+#endif
+    }
+}
@@ -0,0 +1,264 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
+#include <common.hpp>
+#include <jpeg.hpp>
+#include <memory.hpp>
+#include <socket.hpp>
+
+namespace Engine
+{
+    // HTTP server on the loopback interface that answers GET / with a multipart/x-mixed-replace stream of JPEG
+    // frames, which browsers show as a live image. Frames are encoded once on the server thread and sent to every
+    // viewer.
+    static constexpr U32 kMaxMjpegClients = 8;
+    static constexpr U32 kMjpegAcceptIntervalMs = 20;
+    // How long a new connection may take to send its request.
+    static constexpr U32 kMjpegRequestTimeoutMs = 500;
+    // Room for the part header in front of each encoded frame.
+    static constexpr std::size_t kMjpegPartHeaderBound = 128;
+    static constexpr const char *kMjpegResponse =
+        "HTTP/1.0 200 OK\r\n"
+        "Content-Type: multipart/x-mixed-replace; boundary=frame\r\n"
+        "Cache-Control: no-cache\r\n"
+        "Connection: close\r\n"
+        "\r\n";
+    static constexpr const char *kMjpegNotFound =
+        "HTTP/1.0 404 Not Found\r\n"
+        "Content-Length: 0\r\n"
+        "Connection: close\r\n"
+        "\r\n";
+
+    // Same hand over as the frame server, the renderer copies and newer frames replace one the server has not taken.
+    struct MjpegServer
+    {
+        Socket m_listener = kInvalidSocket;
+        U32 m_width = 0;
+        U32 m_height = 0;
+        JpegQuantization m_quantization;
+        Socket m_clients[kMaxMjpegClients];
+        U32 m_numClients = 0;
+
+        PageAllocation m_buffers;
+        U32 *m_pPending = nullptr;
+        U32 *m_pCurrent = nullptr;
+        // Frames are encoded behind room for their part header.
+        U8 *m_pEncoded = nullptr;
+        // Part header, JPEG and trailing line break of the newest frame, new viewers get it right away.
+        const U8 *m_pMessage = nullptr;
+        std::size_t m_messageSize = 0;
+        bool m_hasPending = false;
+
+        std::thread m_thread;
+        std::mutex m_mutex;
+        std::condition_variable m_wake;
+        bool m_isClosing = false;
+        U32 m_numFrames = 0;
+        U64 m_numEncodedBytes = 0;
+        U64 m_encodeNanoseconds = 0;
+        U64 m_numReplaced = 0;
+    };
+
+    inline bool IsMjpegServerOpen(const MjpegServer &server)
+    {
+        return server.m_listener != kInvalidSocket;
+    }
+
+    inline bool SendText(const Socket socket, const char *text)
+    {
+        return SendAll(socket, reinterpret_cast<const U8 *>(text), std::strlen(text));
+    }
+
+    // Reads the request line and headers, only GET / is served. Anything else, favicon requests included, is
+    // refused so it does not hold one of the viewer slots.
+    inline bool IsMjpegRequest(const Socket client)
+    {
+        SetReceiveTimeout(client, kMjpegRequestTimeoutMs);
+        char request[2048];
+        std::size_t size = 0;
+        while (size < sizeof(request) - 1)
+        {
+            const std::size_t received = Receive(client, reinterpret_cast<U8 *>(request) + size,
+                                                 sizeof(request) - 1 - size);
+            if (received == 0)
+            {
+                return false;
+            }
+            size += received;
+            request[size] = '\0';
+            if (std::strstr(request, "\r\n\r\n"))
+            {
+                break;
+            }
+        }
+        // A query string is allowed, viewers use one to get around caches.
+        return std::strncmp(request, "GET / ", 6) == 0 || std::strncmp(request, "GET /?", 6) == 0;
+    }
+
+    inline void AcceptMjpegClients(MjpegServer &server)
+    {
+        for (Socket client; server.m_numClients < kMaxMjpegClients &&
+                            (client = AcceptClient(server.m_listener)) != kInvalidSocket;)
+        {
+            if (!IsMjpegRequest(client))
+            {
+                SendText(client, kMjpegNotFound);
+                CloseSocket(client);
+                continue;
+            }
+            const bool isSent = SendText(client, kMjpegResponse) &&
+                                (server.m_messageSize == 0 || SendAll(client, server.m_pMessage,
+                                                                      server.m_messageSize));
+            if (isSent)
+            {
+                server.m_clients[server.m_numClients++] = client;
+            }
+            else
+            {
+                CloseSocket(client);
+            }
+        }
+    }
+
+    inline void EncodeMjpegFrame(MjpegServer &server)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        U8 *pJpeg = server.m_pEncoded + kMjpegPartHeaderBound;
+        const std::size_t size = EncodeJpeg(server.m_pCurrent, server.m_width, server.m_height, server.m_quantization,
+                                            pJpeg);
+        server.m_encodeNanoseconds += static_cast<U64>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count());
+        server.m_numEncodedBytes += size;
+
+        char header[kMjpegPartHeaderBound];
+        const int headerSize = std::snprintf(header, sizeof(header),
+                                             "--frame\r\nContent-Type: image/jpeg\r\nContent-Length: %zu\r\n\r\n",
+                                             size);
+        U8 *pMessage = pJpeg - headerSize;
+        std::memcpy(pMessage, header, static_cast<std::size_t>(headerSize));
+        std::memcpy(pJpeg + size, "\r\n", 2);
+        server.m_pMessage = pMessage;
+        server.m_messageSize = static_cast<std::size_t>(headerSize) + size + 2;
+    }
+
+    inline void MjpegServerMain(MjpegServer &server)
+    {
+        for (;;)
+        {
+            bool hasFrame;
+            {
+                std::unique_lock lock(server.m_mutex);
+                server.m_wake.wait_for(lock, std::chrono::milliseconds(kMjpegAcceptIntervalMs),
+                                       [&server] { return server.m_isClosing || server.m_hasPending; });
+                if (server.m_isClosing)
+                {
+                    return;
+                }
+                hasFrame = server.m_hasPending;
+                if (hasFrame)
+                {
+                    U32 *pFrame = server.m_pCurrent;
+                    server.m_pCurrent = server.m_pPending;
+                    server.m_pPending = pFrame;
+                    server.m_hasPending = false;
+                }
+            }
+            if (hasFrame)
+            {
+                // Nobody watching, nothing to encode. The first viewer waits for the next frame.
+                if (server.m_numClients == 0)
+                {
+                    server.m_messageSize = 0;
+                }
+                else
+                {
+                    EncodeMjpegFrame(server);
+                    ++server.m_numFrames;
+                    for (U32 iClient = 0; iClient < server.m_numClients;)
+                    {
+                        if (SendAll(server.m_clients[iClient], server.m_pMessage, server.m_messageSize))
+                        {
+                            ++iClient;
+                            continue;
+                        }
+                        CloseSocket(server.m_clients[iClient]);
+                        server.m_clients[iClient] = server.m_clients[--server.m_numClients];
+                    }
+                }
+            }
+            AcceptMjpegClients(server);
+        }
+    }
+
+    inline bool OpenMjpegServer(MjpegServer &server, const U16 port, const U32 width, const U32 height,
+                                const U32 quality)
+    {
+        if (!InitializeSockets())
+        {
+            return false;
+        }
+        server.m_listener = ListenTcp(port);
+        if (server.m_listener == kInvalidSocket)
+        {
+            ShutdownSockets();
+            return false;
+        }
+        server.m_width = width;
+        server.m_height = height;
+        server.m_quantization = MakeJpegQuantization(quality);
+        const std::size_t frameSize = AlignUp(static_cast<std::size_t>(width) * height * sizeof(U32), 64);
+        server.m_buffers = AllocatePages(frameSize * 2 + kMjpegPartHeaderBound + JpegBound(width, height) + 2, false);
+        U8 *pBuffers = static_cast<U8 *>(server.m_buffers.m_pData);
+        server.m_pPending = reinterpret_cast<U32 *>(pBuffers);
+        server.m_pCurrent = reinterpret_cast<U32 *>(pBuffers + frameSize);
+        server.m_pEncoded = pBuffers + 2 * frameSize;
+        server.m_thread = std::thread(MjpegServerMain, std::ref(server));
+        return true;
+    }
+
+    inline void SubmitMjpegFrame(MjpegServer &server, const U32 *pPixels)
+    {
+        {
+            const std::lock_guard lock(server.m_mutex);
+            server.m_numReplaced += server.m_hasPending ? 1 : 0;
+            std::memcpy(server.m_pPending, pPixels, static_cast<std::size_t>(server.m_width) * server.m_height * 4);
+            server.m_hasPending = true;
+        }
+        server.m_wake.notify_one();
+    }
+
+    inline void CloseMjpegServer(MjpegServer &server)
+    {
+        if (!IsMjpegServerOpen(server))
+        {
+            return;
+        }
+        {
+            const std::lock_guard lock(server.m_mutex);
+            server.m_isClosing = true;
+        }
+        server.m_wake.notify_one();
+        server.m_thread.join();
+        for (U32 iClient = 0; iClient < server.m_numClients; ++iClient)
+        {
+            CloseSocket(server.m_clients[iClient]);
+        }
+        CloseSocket(server.m_listener);
+        ShutdownSockets();
+        const U32 numFrames = Max(server.m_numFrames, 1u);
+        std::fprintf(stderr, "Served %u MJPEG frames, %llu KB and %.2f ms to encode each, %llu replaced\n",
+                     server.m_numFrames, static_cast<unsigned long long>(server.m_numEncodedBytes / numFrames / 1024),
+                     static_cast<double>(server.m_encodeNanoseconds) / numFrames * 1e-6,
+                     static_cast<unsigned long long>(server.m_numReplaced));
+        FreePages(server.m_buffers);
+        server.m_buffers = PageAllocation{};
+        server.m_listener = kInvalidSocket;
+        server.m_numClients = 0;
+    }
+}
@@ -0,0 +1,379 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <common.hpp>
+#include <format.hpp>
+#include <image.hpp>
+#include <post.hpp>
+#include <render.hpp>
+
+namespace Engine
+{
+    static constexpr const char *kUsage =
+        "Usage: %s [options]\n"
+        "  --size WIDTHxHEIGHT        Frame size, defaults to 800x600. Even, up to 7680x4320\n"
+        "  --aa none|fxaa|edge|taa    Anti-aliasing mode, defaults to fxaa\n"
+        "  --edge-samples 4|8|16      Rays per edge pixel for --aa edge, defaults to 8\n"
+        "  --half-res                 Trace at half resolution and upscale\n"
+        "  --ortho HEIGHT             Orthographic projection showing HEIGHT world units vertically\n"
+        "  --views COLUMNSxROWS       Split the frame into a grid of views around the scene, up to 4x4\n"
+        "  --stereo SEPARATION        Side by side stereo with the eyes SEPARATION world units apart\n"
+        "  --foveate RADIUS           Full resolution within RADIUS pixels of the cursor, coarser blocks outside\n"
+        "  --gaze X,Y                 Fixed focus for --foveate as fractions of the frame size, e.g. 0.5,0.5\n"
+        "  --panorama cubemap|equirect\n"
+        "                             All directions around the camera as six faces in a 3:2 grid or one 2:1 image\n"
+        "  --post EFFECT[,EFFECT...]  Post effects after anti-aliasing: fxaa, sharpen, vignette\n"
+        "  --no-stream                Write the window pixels with ordinary instead of non-temporal stores\n"
+        "  --format FORMAT            Also convert each frame to bgra, rgb565, rgb24, i420 or nv12\n"
+        "  --record PATH              Record frames in --format to PATH, or - for stdout. A .y4m PATH writes I420 Y4M\n"
+        "  --dump-format png|qoi      Format of the frames F12 dumps, defaults to png\n"
+        "  --share                    Export frames to other processes through a shared memory ring\n"
+        "  --serve tcp:PORT|unix:PATH Stream changed frame tiles to local viewers\n"
+        "  --mjpeg PORT               Serve an MJPEG stream for browsers at http://127.0.0.1:PORT/\n"
+        "  --jpeg-quality 1-100       Quality of the MJPEG frames, defaults to 75\n"
+        "  --huge-pages               Back the scene and render targets with 2 MB pages where available\n"
+        "  --profile PATH             Time the stages of every frame and write them to PATH as Chrome trace JSON\n";
+
+    inline bool IsY4mPath(const char *path)
+    {
+        const std::size_t length = std::strlen(path);
+        return length >= 4 && std::strcmp(path + length - 4, ".y4m") == 0;
+    }
+
+    inline bool HasArgument(const int argc, char **argv, const char *name)
+    {
+        for (int i = 1; i < argc; ++i)
+        {
+            if (std::strcmp(argv[i], name) == 0)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    inline bool IsValidFrameSize(const U64 width, const U64 height)
+    {
+        return width % 2 == 0 && height % 2 == 0 && width >= kMinFrameSize && height >= kMinFrameSize &&
+               width <= kMaxFrameWidth && height <= kMaxFrameHeight;
+    }
+
+    inline bool ParseArguments(const int argc, char **argv, State &state)
+    {
+        for (int i = 1; i < argc; ++i)
+        {
+            const char *arg = argv[i];
+            const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+            if (std::strcmp(arg, "--size") == 0 && value)
+            {
+                char *end;
+                const U64 width = std::strtoull(value, &end, 10);
+                const U64 height = *end == 'x' ? std::strtoull(end + 1, &end, 10) : 0;
+                if (*end != '\0' || !IsValidFrameSize(width, height))
+                {
+                    std::fprintf(stderr, "Frame size must be WIDTHxHEIGHT, even and from %ux%u to %ux%u: %s\n",
+                                 kMinFrameSize, kMinFrameSize, kMaxFrameWidth, kMaxFrameHeight, value);
+                    return false;
+                }
+                state.m_width = static_cast<U32>(width);
+                state.m_height = static_cast<U32>(height);
+                ++i;
+            }
+            else if (std::strcmp(arg, "--aa") == 0 && value)
+            {
+                if (std::strcmp(value, "none") == 0)
+                {
+                    state.m_antiAliasing = AntiAliasing::kNone;
+                }
+                else if (std::strcmp(value, "fxaa") == 0)
+                {
+                    state.m_antiAliasing = AntiAliasing::kFxaa;
+                }
+                else if (std::strcmp(value, "edge") == 0)
+                {
+                    state.m_antiAliasing = AntiAliasing::kEdgeSupersample;
+                }
+                else if (std::strcmp(value, "taa") == 0)
+                {
+                    state.m_antiAliasing = AntiAliasing::kTemporal;
+                }
+                else
+                {
+                    std::fprintf(stderr, "Unknown anti-aliasing mode: %s\n", value);
+                    return false;
+                }
+                ++i;
+            }
+            else if (std::strcmp(arg, "--format") == 0 && value)
+            {
+                U32 iFormat = 0;
+                while (iFormat < static_cast<U32>(PixelFormat::kCount) &&
+                       std::strcmp(kPixelFormatNames[iFormat], value) != 0)
+                {
+                    ++iFormat;
+                }
+                if (iFormat == static_cast<U32>(PixelFormat::kCount))
+                {
+                    std::fprintf(stderr, "Unknown pixel format: %s\n", value);
+                    return false;
+                }
+                state.m_outputFormat = static_cast<PixelFormat>(iFormat);
+                ++i;
+            }
+            else if (std::strcmp(arg, "--record") == 0 && value)
+            {
+                state.m_pRecordPath = value;
+                ++i;
+            }
+            else if (std::strcmp(arg, "--dump-format") == 0 && value)
+            {
+                if (std::strcmp(value, "png") == 0)
+                {
+                    state.m_dumpFormat = ImageFormat::kPng;
+                }
+                else if (std::strcmp(value, "qoi") == 0)
+                {
+                    state.m_dumpFormat = ImageFormat::kQoi;
+                }
+                else
+                {
+                    std::fprintf(stderr, "Unknown dump format: %s\n", value);
+                    return false;
+                }
+                ++i;
+            }
+            else if (std::strcmp(arg, "--share") == 0)
+            {
+                state.m_isSharingFrames = true;
+            }
+            else if (std::strcmp(arg, "--serve") == 0 && value)
+            {
+                state.m_pServeAddress = value;
+                ++i;
+            }
+            else if (std::strcmp(arg, "--mjpeg") == 0 && value)
+            {
+                const int port = std::atoi(value);
+                if (port <= 0 || port > 0xFFFF)
+                {
+                    std::fprintf(stderr, "Invalid MJPEG port: %s\n", value);
+                    return false;
+                }
+                state.m_mjpegPort = static_cast<U16>(port);
+                ++i;
+            }
+            else if (std::strcmp(arg, "--jpeg-quality") == 0 && value)
+            {
+                const int quality = std::atoi(value);
+                if (quality < 1 || quality > 100)
+                {
+                    std::fprintf(stderr, "JPEG quality must be from 1 to 100: %s\n", value);
+                    return false;
+                }
+                state.m_jpegQuality = static_cast<U32>(quality);
+                ++i;
+            }
+            else if (std::strcmp(arg, "--profile") == 0 && value)
+            {
+                state.m_pProfilePath = value;
+                ++i;
+            }
+            else if (std::strcmp(arg, "--huge-pages") == 0)
+            {
+                // Handled in main, the state already lives in the requested pages by now.
+            }
+            else if (std::strcmp(arg, "--no-stream") == 0)
+            {
+                state.m_isStreamingStores = false;
+            }
+            else if (std::strcmp(arg, "--ortho") == 0 && value)
+            {
+                const F32 height = std::strtof(value, nullptr);
+                if (!(height > 0.0f && height <= kFarDepth))
+                {
+                    std::fprintf(stderr, "Orthographic height must be above 0 and at most %g: %s\n",
+                                 static_cast<double>(kFarDepth), value);
+                    return false;
+                }
+                state.m_projection = Projection::kOrthographic;
+                state.m_orthoHeight = height;
+                ++i;
+            }
+            else if (std::strcmp(arg, "--views") == 0 && value)
+            {
+                char *end;
+                const U64 columns = std::strtoull(value, &end, 10);
+                const U64 rows = *end == 'x' ? std::strtoull(end + 1, &end, 10) : 0;
+                if (*end != '\0' || columns < 1 || rows < 1 || columns > 4 || rows > 4)
+                {
+                    std::fprintf(stderr, "Views must be COLUMNSxROWS, from 1x1 to 4x4: %s\n", value);
+                    return false;
+                }
+                state.m_viewColumns = static_cast<U32>(columns);
+                state.m_viewRows = static_cast<U32>(rows);
+                ++i;
+            }
+            else if (std::strcmp(arg, "--stereo") == 0 && value)
+            {
+                const F32 separation = std::strtof(value, nullptr);
+                if (!(separation > 0.0f && separation <= 1.0f))
+                {
+                    std::fprintf(stderr, "Eye separation must be above 0 and at most 1: %s\n", value);
+                    return false;
+                }
+                state.m_eyeSeparation = separation;
+                ++i;
+            }
+            else if (std::strcmp(arg, "--panorama") == 0 && value)
+            {
+                if (std::strcmp(value, "cubemap") == 0)
+                {
+                    state.m_panorama = Panorama::kCubemap;
+                }
+                else if (std::strcmp(value, "equirect") == 0)
+                {
+                    state.m_panorama = Panorama::kEquirectangular;
+                }
+                else
+                {
+                    std::fprintf(stderr, "Unknown panorama layout: %s\n", value);
+                    return false;
+                }
+                ++i;
+            }
+            else if (std::strcmp(arg, "--foveate") == 0 && value)
+            {
+                const F32 radius = std::strtof(value, nullptr);
+                if (!(radius >= 1.0f && radius <= static_cast<F32>(kMaxFrameWidth)))
+                {
+                    std::fprintf(stderr, "Fovea radius must be from 1 to %u pixels: %s\n", kMaxFrameWidth, value);
+                    return false;
+                }
+                state.m_foveaRadius = radius;
+                ++i;
+            }
+            else if (std::strcmp(arg, "--gaze") == 0 && value)
+            {
+                char *end;
+                const F32 x = std::strtof(value, &end);
+                const F32 y = *end == ',' ? std::strtof(end + 1, &end) : -1.0f;
+                if (*end != '\0' || !(x >= 0.0f && x <= 1.0f && y >= 0.0f && y <= 1.0f))
+                {
+                    std::fprintf(stderr, "Gaze must be X,Y with both from 0 to 1: %s\n", value);
+                    return false;
+                }
+                state.m_hasGaze = true;
+                state.m_gazeX = x;
+                state.m_gazeY = y;
+                ++i;
+            }
+            else if (std::strcmp(arg, "--half-res") == 0)
+            {
+                state.m_isHalfResolution = true;
+            }
+            else if (std::strcmp(arg, "--post") == 0 && value)
+            {
+                // Comma separated effect names, e.g. --post sharpen,vignette.
+                state.m_numPostEffects = 0;
+                for (const char *name = value; *name;)
+                {
+                    const char *end = std::strchr(name, ',');
+                    const U32 length = static_cast<U32>(end ? static_cast<std::size_t>(end - name) : std::strlen(name));
+                    U32 iEffect = 0;
+                    while (iEffect < static_cast<U32>(PostEffect::kCount) &&
+                           (std::strncmp(kPostEffects[iEffect].m_name, name, length) != 0 ||
+                            kPostEffects[iEffect].m_name[length] != '\0'))
+                    {
+                        ++iEffect;
+                    }
+                    if (iEffect == static_cast<U32>(PostEffect::kCount) ||
+                        state.m_numPostEffects == sizeof(state.m_postEffects) / sizeof(state.m_postEffects[0]))
+                    {
+                        std::fprintf(stderr, "Unknown or too many post effects: %s\n", value);
+                        return false;
+                    }
+                    state.m_postEffects[state.m_numPostEffects++] = static_cast<PostEffect>(iEffect);
+                    name = end ? end + 1 : name + length;
+                }
+                ++i;
+            }
+            else if (std::strcmp(arg, "--edge-samples") == 0 && value)
+            {
+                state.m_numEdgeSamples = static_cast<U32>(std::atoi(value));
+                if (state.m_numEdgeSamples != 4 && state.m_numEdgeSamples != 8 && state.m_numEdgeSamples != 16)
+                {
+                    std::fprintf(stderr, "Edge samples must be 4, 8 or 16: %s\n", value);
+                    return false;
+                }
+                ++i;
+            }
+            else
+            {
+                std::fprintf(stderr, kUsage, argv[0]);
+                return false;
+            }
+        }
+
+        if (state.m_pRecordPath && IsY4mPath(state.m_pRecordPath))
+        {
+            if (state.m_outputFormat == PixelFormat::kBgra32)
+            {
+                state.m_outputFormat = PixelFormat::kI420;
+            }
+            else if (state.m_outputFormat != PixelFormat::kI420)
+            {
+                std::fprintf(stderr, "Y4M recordings are written as i420\n");
+                return false;
+            }
+        }
+
+        // Edge supersampling, the temporal history and the half resolution upscale assume one camera per frame.
+        const bool isRetraced = state.m_antiAliasing == AntiAliasing::kEdgeSupersample ||
+                                state.m_antiAliasing == AntiAliasing::kTemporal || state.m_isHalfResolution;
+        const bool isStereo = state.m_eyeSeparation > 0.0f;
+        const bool isPanorama = state.m_panorama != Panorama::kNone;
+        const bool isGrid = state.m_viewColumns * state.m_viewRows > 1;
+        const bool isFoveated = state.m_foveaRadius > 0.0f;
+        const U32 numLayouts = 0u + isGrid + isStereo + isPanorama + isFoveated;
+        if (numLayouts > 1)
+        {
+            std::fprintf(stderr, "Only one of --views, --stereo, --panorama and --foveate can be used\n");
+            return false;
+        }
+        if (numLayouts > 0 && isRetraced)
+        {
+            std::fprintf(stderr, "--views, --stereo, --panorama and --foveate only work with --aa none or fxaa at "
+                                 "full resolution\n");
+            return false;
+        }
+        if ((isStereo || isPanorama) && state.m_projection != Projection::kPerspective)
+        {
+            std::fprintf(stderr, "--stereo and --panorama bring their own projection, --ortho does not apply\n");
+            return false;
+        }
+
+        U32 apron = 0;
+        if (state.m_antiAliasing == AntiAliasing::kTemporal)
+        {
+            apron += 1;
+        }
+        else if (state.m_antiAliasing == AntiAliasing::kFxaa)
+        {
+            apron += kPostEffects[static_cast<U32>(PostEffect::kFxaa)].m_apron;
+        }
+        for (U32 iEffect = 0; iEffect < state.m_numPostEffects; ++iEffect)
+        {
+            apron += kPostEffects[static_cast<U32>(state.m_postEffects[iEffect])].m_apron;
+        }
+        if (apron > kMaxPostApron)
+        {
+            std::fprintf(stderr, "Post effects read %u pixels around each tile, at most %u are supported\n", apron,
+                         kMaxPostApron);
+            return false;
+        }
+        return true;
+    }
+}
@@ -0,0 +1,464 @@
+#pragma once
+
+#include <common.hpp>
+#include <format.hpp>
+#include <memory.hpp>
+#include <profile.hpp>
+
+namespace Engine
+{
+    // Fragment IDs pack the index of the cube that was hit with the face that was hit.
+    // Post passes use them to find geometric edges exactly, flat-shaded faces often have near identical luma.
+    using FragmentId = U16;
+
+    static constexpr FragmentId kMissId = 0xFFFF;
+
+    constexpr FragmentId MakeFragmentId(const U32 iCube, const U32 face)
+    {
+        return static_cast<FragmentId>(iCube << 3 | face);
+    }
+
+    constexpr U32 FragmentFace(const FragmentId id)
+    {
+        return id & 0x7u;
+    }
+
+    // Tiles are sized so the colors and IDs of a tile plus the search apron stay in L1.
+    static constexpr U32 kPostTileWidth = 64;
+    static constexpr U32 kPostTileHeight = 32;
+    // How many pixels the edge search walks in each direction before giving up.
+    static constexpr I32 kFxaaSearchSteps = 8;
+
+    inline U16x8 LoadU16x8(const U16 *p)
+    {
+        U16x8 v;
+        __builtin_memcpy(&v, p, sizeof(v));
+        return v;
+    }
+
+    inline FragmentId FetchId(const FragmentId *pIds, const U32 width, const U32 height, I32 x, I32 y)
+    {
+        // Clamp to the border so out of bounds neighbors never register as an edge.
+        x = Clamp(x, 0, static_cast<I32>(width) - 1);
+        y = Clamp(y, 0, static_cast<I32>(height) - 1);
+        return pIds[static_cast<U32>(y) * width + static_cast<U32>(x)];
+    }
+
+    inline U32x4 UnpackColor(const U32 color)
+    {
+        return U32x4{color, color, color, color} >> U32x4{0, 8, 16, 24} & 0xFFu;
+    }
+
+    inline U32 PackColor(const U32x4 channels)
+    {
+        const U32x4 c = channels << U32x4{0, 8, 16, 24};
+        return c[0] | c[1] | c[2] | c[3];
+    }
+
+    inline U32 LerpColor(const U32 a, const U32 b, const F32 t)
+    {
+        const F32x4 fa = __builtin_convertvector(UnpackColor(a), F32x4);
+        const F32x4 fb = __builtin_convertvector(UnpackColor(b), F32x4);
+        return PackColor(__builtin_convertvector(fa + (fb - fa) * t + 0.5f, U32x4));
+    }
+
+    inline bool IsEdgePixel(const FragmentId *pIds, const U32 width, const U32 height, const I32 x, const I32 y)
+    {
+        const FragmentId id = pIds[static_cast<U32>(y) * width + static_cast<U32>(x)];
+        return FetchId(pIds, width, height, x, y - 1) != id || FetchId(pIds, width, height, x, y + 1) != id ||
+               FetchId(pIds, width, height, x - 1, y) != id || FetchId(pIds, width, height, x + 1, y) != id;
+    }
+
+    // Calls visit(x) for every pixel in [x0, x1) of row y whose ID differs from one of its four neighbors.
+    // Most of the frame is flat, so interior pixels are tested eight at a time and flat runs skipped outright.
+    template<typename Visit>
+    void ForEachEdgePixel(const FragmentId *pIds, const U32 width, const U32 height, const U32 y, const U32 x0,
+                          const U32 x1, Visit &&visit)
+    {
+        const bool isInterior = y > 0 && y + 1 < height;
+        U32 x = x0;
+        while (x < x1)
+        {
+            if (isInterior && x > 0 && x + 9 <= width && x + 8 <= x1)
+            {
+                const U16 *pRow = pIds + y * width + x;
+                const U16x8 c = LoadU16x8(pRow);
+                const U16x8 diff = (c != LoadU16x8(pRow - 1)) | (c != LoadU16x8(pRow + 1)) |
+                                   (c != LoadU16x8(pRow - width)) | (c != LoadU16x8(pRow + width));
+                U64 halves[2];
+                __builtin_memcpy(halves, &diff, sizeof(halves));
+                if (halves[0] | halves[1])
+                {
+                    for (U32 lane = 0; lane < 8; ++lane)
+                    {
+                        if (diff[lane])
+                        {
+                            visit(x + lane);
+                        }
+                    }
+                }
+                x += 8;
+            }
+            else
+            {
+                if (IsEdgePixel(pIds, width, height, static_cast<I32>(x), static_cast<I32>(y)))
+                {
+                    visit(x);
+                }
+                ++x;
+            }
+        }
+    }
+
+    // FXAA 3.11 quality preset adapted to the ID buffer:
+    // edges are found by ID discontinuities instead of luma contrast, then walked in both directions to find
+    // which end of the staircase step is closest, and the pixel is blended with its neighbor across the edge
+    // by the coverage the ideal edge line would have.
+    inline U32 ResolveFxaaPixel(const U32 *pColor, const FragmentId *pIds, const U32 width, const U32 height,
+                                const I32 x, const I32 y)
+    {
+        const U32 i = static_cast<U32>(y) * width + static_cast<U32>(x);
+        const FragmentId idM = pIds[i];
+        const FragmentId idN = FetchId(pIds, width, height, x, y - 1);
+        const FragmentId idS = FetchId(pIds, width, height, x, y + 1);
+        const FragmentId idW = FetchId(pIds, width, height, x - 1, y);
+        const FragmentId idE = FetchId(pIds, width, height, x + 1, y);
+        const bool diffN = idN != idM;
+        const bool diffS = idS != idM;
+        const bool diffW = idW != idM;
+        const bool diffE = idE != idM;
+        const U32 numDiff = U32{diffN} + U32{diffS} + U32{diffW} + U32{diffE};
+        if (numDiff == 0)
+        {
+            return pColor[i];
+        }
+
+        // Score how strongly the neighborhood changes across rows versus across columns.
+        const U32 horzScore = 2 * (U32{diffN} + U32{diffS}) +
+                              U32{FetchId(pIds, width, height, x - 1, y - 1) != idW} +
+                              U32{FetchId(pIds, width, height, x - 1, y + 1) != idW} +
+                              U32{FetchId(pIds, width, height, x + 1, y - 1) != idE} +
+                              U32{FetchId(pIds, width, height, x + 1, y + 1) != idE};
+        const U32 vertScore = 2 * (U32{diffW} + U32{diffE}) +
+                              U32{FetchId(pIds, width, height, x - 1, y - 1) != idN} +
+                              U32{FetchId(pIds, width, height, x + 1, y - 1) != idN} +
+                              U32{FetchId(pIds, width, height, x - 1, y + 1) != idS} +
+                              U32{FetchId(pIds, width, height, x + 1, y + 1) != idS};
+        const bool isHorizontal = (diffN || diffS) && (!(diffW || diffE) || horzScore >= vertScore);
+
+        // Step along the edge, and across it toward the neighbor that will be blended in.
+        const I32 alongX = isHorizontal ? 1 : 0;
+        const I32 alongY = isHorizontal ? 0 : 1;
+        const I32 acrossX = isHorizontal ? 0 : diffW ? -1 : 1;
+        const I32 acrossY = isHorizontal ? diffN ? -1 : 1 : 0;
+
+        // The edge ends where either side stops matching. If the side of this pixel ends first the edge line
+        // steps into this pixel, otherwise it steps into the neighbor and the neighbor does the blending.
+        I32 dist[2] = {kFxaaSearchSteps + 1, kFxaaSearchSteps + 1};
+        bool isGoodEnd[2] = {false, false};
+        for (U32 iDir = 0; iDir < 2; ++iDir)
+        {
+            const I32 sign = iDir == 0 ? -1 : 1;
+            for (I32 k = 1; k <= kFxaaSearchSteps; ++k)
+            {
+                const I32 px = x + sign * k * alongX;
+                const I32 py = y + sign * k * alongY;
+                if (px < 0 || py < 0 || px >= static_cast<I32>(width) || py >= static_cast<I32>(height))
+                {
+                    break;
+                }
+                if (FetchId(pIds, width, height, px, py) != idM)
+                {
+                    dist[iDir] = k;
+                    isGoodEnd[iDir] = true;
+                    break;
+                }
+                if (FetchId(pIds, width, height, px + acrossX, py + acrossY) == idM)
+                {
+                    dist[iDir] = k;
+                    break;
+                }
+            }
+        }
+
+        const bool isGood = (dist[0] <= dist[1] && isGoodEnd[0]) || (dist[1] <= dist[0] && isGoodEnd[1]);
+        const F32 nearest = static_cast<F32>(dist[0] < dist[1] ? dist[0] : dist[1]) - 0.5f;
+        const F32 span = static_cast<F32>(dist[0] + dist[1] - 1);
+        const F32 edgeOffset = isGood ? 0.5f - nearest / span : 0.0f;
+        // Pixels that stick out of their surroundings get pulled toward the neighbor regardless of edge shape.
+        const F32 subpixOffset = static_cast<F32>(numDiff - 1) * 0.125f;
+
+        const U32 partner = static_cast<U32>(y + acrossY) * width + static_cast<U32>(x + acrossX);
+        return LerpColor(pColor[i], pColor[partner], Max(edgeOffset, subpixOffset));
+    }
+
+    struct PostRect
+    {
+        I32 m_x0;
+        I32 m_y0;
+        I32 m_x1;
+        I32 m_y1;
+    };
+
+    inline PostRect GrowRect(const PostRect &rect, const U32 amount, const U32 width, const U32 height)
+    {
+        const I32 a = static_cast<I32>(amount);
+        return PostRect{
+            Max(rect.m_x0 - a, 0),
+            Max(rect.m_y0 - a, 0),
+            Min(rect.m_x1 + a, static_cast<I32>(width)),
+            Min(rect.m_y1 + a, static_cast<I32>(height)),
+        };
+    }
+
+    // A block of colors and IDs addressed in frame coordinates: pixel (x, y) lives at
+    // m_pColor[(y - m_y0) * m_width + (x - m_x0)]. Reads past the block are clamped to it, which is only ever
+    // needed at frame borders because tiles are loaded with enough apron for every pass.
+    struct PostTile
+    {
+        U32 *m_pColor;
+        const FragmentId *m_pIds;
+        I32 m_x0;
+        I32 m_y0;
+        U32 m_width;
+        U32 m_height;
+
+        U32 Index(const I32 x, const I32 y) const
+        {
+            const I32 lx = Clamp(x - m_x0, 0, static_cast<I32>(m_width) - 1);
+            const I32 ly = Clamp(y - m_y0, 0, static_cast<I32>(m_height) - 1);
+            return static_cast<U32>(ly) * m_width + static_cast<U32>(lx);
+        }
+    };
+
+    struct PostPassArgs
+    {
+        const void *m_pContext;
+        PostTile m_src;
+        PostTile m_dst;
+        // Pixels of dst to write. This covers the tile plus whatever apron later passes still need.
+        PostRect m_region;
+        // The tile itself. Passes with side effects outside dst only apply them here,
+        // so neighboring tiles never write the same memory.
+        PostRect m_tile;
+        U32 m_frameWidth;
+        U32 m_frameHeight;
+    };
+
+    // One step of the post pipeline. Passes run back to back on a tile-local copy of the frame, so a pass costs
+    // compute rather than another round trip through memory.
+    struct PostPass
+    {
+        const char *m_name;
+        // Pixels of input read around each output pixel.
+        U32 m_apron;
+        void (*m_run)(const PostPassArgs &args);
+        const void *m_pContext;
+    };
+
+    inline void RunFxaaPass(const PostPassArgs &args)
+    {
+        const PostTile &src = args.m_src;
+        const PostTile &dst = args.m_dst;
+        const U32 x0 = static_cast<U32>(args.m_region.m_x0 - src.m_x0);
+        const U32 x1 = static_cast<U32>(args.m_region.m_x1 - src.m_x0);
+        for (I32 y = args.m_region.m_y0; y < args.m_region.m_y1; ++y)
+        {
+            const U32 ly = static_cast<U32>(y - src.m_y0);
+            U32 *pDstRow = dst.m_pColor + dst.Index(args.m_region.m_x0, y);
+            __builtin_memcpy(pDstRow, src.m_pColor + ly * src.m_width + x0, (x1 - x0) * sizeof(U32));
+            ForEachEdgePixel(src.m_pIds, src.m_width, src.m_height, ly, x0, x1, [&](const U32 x) {
+                pDstRow[x - x0] = ResolveFxaaPixel(src.m_pColor, src.m_pIds, src.m_width, src.m_height,
+                                                   static_cast<I32>(x), static_cast<I32>(ly));
+            });
+        }
+    }
+
+    // Unsharp mask against the four neighbors.
+    inline void RunSharpenPass(const PostPassArgs &args)
+    {
+        constexpr F32 kStrength = 0.25f;
+        const PostTile &src = args.m_src;
+        const PostTile &dst = args.m_dst;
+        for (I32 y = args.m_region.m_y0; y < args.m_region.m_y1; ++y)
+        {
+            for (I32 x = args.m_region.m_x0; x < args.m_region.m_x1; ++x)
+            {
+                const U32 center = src.m_pColor[src.Index(x, y)];
+                const U32 north = src.m_pColor[src.Index(x, y - 1)];
+                const U32 south = src.m_pColor[src.Index(x, y + 1)];
+                const U32 west = src.m_pColor[src.Index(x - 1, y)];
+                const U32 east = src.m_pColor[src.Index(x + 1, y)];
+                U32 &out = dst.m_pColor[dst.Index(x, y)];
+                if (north == center && south == center && west == center && east == center)
+                {
+                    out = center;
+                    continue;
+                }
+                const F32x4 c = __builtin_convertvector(UnpackColor(center), F32x4);
+                const F32x4 sum = __builtin_convertvector(
+                    UnpackColor(north) + UnpackColor(south) + UnpackColor(west) + UnpackColor(east), F32x4);
+                const F32x4 sharpened = c + (c * 4.0f - sum) * kStrength;
+                out = PackColor(__builtin_convertvector(Min(Max(sharpened, F32x4{}), F32x4{} + 255.0f) + 0.5f, U32x4));
+            }
+        }
+    }
+
+    // Darkens toward the corners with a quadratic falloff.
+    inline void RunVignettePass(const PostPassArgs &args)
+    {
+        constexpr F32 kStrength = 0.35f;
+        const F32 halfWidth = 0.5f * static_cast<F32>(args.m_frameWidth);
+        const F32 halfHeight = 0.5f * static_cast<F32>(args.m_frameHeight);
+        const F32 invRadius2 = 1.0f / (halfWidth * halfWidth + halfHeight * halfHeight);
+        for (I32 y = args.m_region.m_y0; y < args.m_region.m_y1; ++y)
+        {
+            const F32 dy = static_cast<F32>(y) + 0.5f - halfHeight;
+            const U32 *pSrc = args.m_src.m_pColor + args.m_src.Index(args.m_region.m_x0, y);
+            U32 *pDst = args.m_dst.m_pColor + args.m_dst.Index(args.m_region.m_x0, y);
+            for (I32 x = args.m_region.m_x0; x < args.m_region.m_x1; ++x)
+            {
+                const F32 dx = static_cast<F32>(x) + 0.5f - halfWidth;
+                const F32 scale = 1.0f - kStrength * (dx * dx + dy * dy) * invRadius2;
+                const F32x4 c = __builtin_convertvector(UnpackColor(*pSrc++), F32x4) * F32x4{scale, scale, scale, 1.0f};
+                *pDst++ = PackColor(__builtin_convertvector(c + 0.5f, U32x4));
+            }
+        }
+    }
+
+    enum class PostEffect : U8
+    {
+        kFxaa,
+        kSharpen,
+        kVignette,
+        kCount,
+    };
+
+    constexpr PostPass kPostEffects[] = {
+        {"fxaa", kFxaaSearchSteps + 1, RunFxaaPass, nullptr},
+        {"sharpen", 1, RunSharpenPass, nullptr},
+        {"vignette", 0, RunVignettePass, nullptr},
+    };
+    static_assert(sizeof(kPostEffects) / sizeof(kPostEffects[0]) == static_cast<U32>(PostEffect::kCount));
+
+    static constexpr U32 kMaxPostPasses = 8;
+    // Upper bound on the summed aprons of a pipeline, which sizes the tile-local scratch.
+    static constexpr U32 kMaxPostApron = 16;
+    static constexpr U32 kPostScratchSize =
+        (kPostTileWidth + 2 * kMaxPostApron) * (kPostTileHeight + 2 * kMaxPostApron);
+
+    inline U32 PostApron(const PostPass *pPasses, const U32 numPasses)
+    {
+        U32 apron = 0;
+        for (U32 iPass = 0; iPass < numPasses; ++iPass)
+        {
+            apron += pPasses[iPass].m_apron;
+        }
+        return apron;
+    }
+
+    // Runs a list of passes from pColor into pOut. Each tile is loaded once with the apron all passes need,
+    // the passes ping-pong between two tile-local buffers shrinking the apron as they go, and the last pass
+    // writes straight into the output, so the frame crosses memory once however many passes there are.
+    // Streamed output has the last pass write into scratch, and the finished tile rows are then stored
+    // non-temporally since nothing downstream in the renderer reads them.
+    inline void RunPostPipeline(const PostPass *pPasses, const U32 numPasses, const U32 *pColor,
+                                const FragmentId *pIds, const U32 width, const U32 height, U32 *pOut,
+                                const bool isStreamed, const FrameImage *pImage)
+    {
+        const ProfileZone zone("RunPostPipeline");
+        const U32 apron = PostApron(pPasses, numPasses);
+        const U32 numTilesX = (width + kPostTileWidth - 1) / kPostTileWidth;
+        const U32 numTilesY = (height + kPostTileHeight - 1) / kPostTileHeight;
+        const PostTile out{pOut, pIds, 0, 0, width, height};
+#pragma omp parallel for
+        for (U32 iTile = 0; iTile < numTilesX * numTilesY; ++iTile)
+        {
+            const ProfileZone tileZone("PostTile");
+            const I32 x0 = static_cast<I32>(iTile % numTilesX * kPostTileWidth);
+            const I32 y0 = static_cast<I32>(iTile / numTilesX * kPostTileHeight);
+            const PostRect tile{
+                x0,
+                y0,
+                Min(x0 + static_cast<I32>(kPostTileWidth), static_cast<I32>(width)),
+                Min(y0 + static_cast<I32>(kPostTileHeight), static_cast<I32>(height)),
+            };
+            const U32 tileWidth = static_cast<U32>(tile.m_x1 - tile.m_x0);
+            if (numPasses == 0)
+            {
+                for (I32 y = tile.m_y0; y < tile.m_y1; ++y)
+                {
+                    if (isStreamed)
+                    {
+                        StreamPixels(pOut + out.Index(tile.m_x0, y), pColor + out.Index(tile.m_x0, y), tileWidth);
+                    }
+                    else
+                    {
+                        __builtin_memcpy(pOut + out.Index(tile.m_x0, y), pColor + out.Index(tile.m_x0, y),
+                                         tileWidth * sizeof(U32));
+                    }
+                }
+                StreamFence();
+                if (pImage)
+                {
+                    ConvertPixels(pColor + out.Index(tile.m_x0, tile.m_y0), width, *pImage, static_cast<U32>(tile.m_x0),
+                                  static_cast<U32>(tile.m_y0), tileWidth, static_cast<U32>(tile.m_y1 - tile.m_y0));
+                }
+                continue;
+            }
+
+            alignas(64) U32 scratchColors[2][kPostScratchSize];
+            alignas(64) FragmentId scratchIds[kPostScratchSize];
+            const PostRect loaded = GrowRect(tile, apron, width, height);
+            const U32 loadedWidth = static_cast<U32>(loaded.m_x1 - loaded.m_x0);
+            const U32 loadedHeight = static_cast<U32>(loaded.m_y1 - loaded.m_y0);
+            const PostTile buffers[2] = {
+                {scratchColors[0], scratchIds, loaded.m_x0, loaded.m_y0, loadedWidth, loadedHeight},
+                {scratchColors[1], scratchIds, loaded.m_x0, loaded.m_y0, loadedWidth, loadedHeight},
+            };
+            for (U32 ly = 0; ly < loadedHeight; ++ly)
+            {
+                const U32 iFrame = out.Index(loaded.m_x0, loaded.m_y0 + static_cast<I32>(ly));
+                __builtin_memcpy(scratchColors[0] + ly * loadedWidth, pColor + iFrame, loadedWidth * sizeof(U32));
+                __builtin_memcpy(scratchIds + ly * loadedWidth, pIds + iFrame, loadedWidth * sizeof(FragmentId));
+            }
+
+            U32 remaining = apron;
+            U32 iSrc = 0;
+            for (U32 iPass = 0; iPass < numPasses; ++iPass)
+            {
+                const PostPass &pass = pPasses[iPass];
+                const ProfileZone passZone(pass.m_name);
+                remaining -= pass.m_apron;
+                const bool isLast = iPass + 1 == numPasses;
+                pass.m_run(PostPassArgs{
+                    .m_pContext = pass.m_pContext,
+                    .m_src = buffers[iSrc],
+                    .m_dst = isLast && !isStreamed ? out : buffers[iSrc ^ 1],
+                    .m_region = isLast ? tile : GrowRect(tile, remaining, width, height),
+                    .m_tile = tile,
+                    .m_frameWidth = width,
+                    .m_frameHeight = height,
+                });
+                iSrc ^= 1;
+            }
+            if (isStreamed)
+            {
+                for (I32 y = tile.m_y0; y < tile.m_y1; ++y)
+                {
+                    const U32 *pRow = buffers[iSrc].m_pColor + buffers[iSrc].Index(tile.m_x0, y);
+                    StreamPixels(pOut + out.Index(tile.m_x0, y), pRow, tileWidth);
+                }
+                StreamFence();
+            }
+            if (pImage)
+            {
+                // Convert while the resolved tile is still cached instead of in a separate pass over the frame.
+                const PostTile &result = isStreamed ? buffers[iSrc] : out;
+                ConvertPixels(result.m_pColor + result.Index(tile.m_x0, tile.m_y0), result.m_width, *pImage,
+                              static_cast<U32>(tile.m_x0), static_cast<U32>(tile.m_y0), tileWidth,
+                              static_cast<U32>(tile.m_y1 - tile.m_y0));
+            }
+        }
+    }
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <common.hpp>
+
+namespace Engine
+{
+    // Input gathered by the presenter's window. Keys stay down until released, mouse motion is raw and accumulated
+    // until the caller clears it.
+    struct PresenterInput
+    {
+        I32 m_mouseX = 0;
+        I32 m_mouseY = 0;
+        // Pointer position in the client area, -1 while the pointer is outside of it.
+        I32 m_cursorX = -1;
+        I32 m_cursorY = -1;
+        bool m_forward = false;
+        bool m_backward = false;
+        bool m_left = false;
+        bool m_right = false;
+        bool m_isDumpRequested = false;
+        bool m_isClosed = false;
+        // Client area size after the window was resized, 0 until then and once the caller took it.
+        U32 m_resizeWidth = 0;
+        U32 m_resizeHeight = 0;
+    };
+
+    // Keys are identified by PC set 1 scan codes. Win32 raw input reports these directly and Linux evdev codes,
+    // which X11 keycodes carry offset by 8, match them for every key used here.
+    inline void ApplyScanCode(PresenterInput &input, const U32 scanCode, const bool isDown)
+    {
+        switch (scanCode)
+        {
+            case 0x11: // W
+                input.m_forward = isDown;
+                break;
+            case 0x1F: // S
+                input.m_backward = isDown;
+                break;
+            case 0x1E: // A
+                input.m_left = isDown;
+                break;
+            case 0x20: // D
+                input.m_right = isDown;
+                break;
+            case 0x58: // F12
+                input.m_isDumpRequested |= isDown;
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+// Each platform defines struct Presenter and:
+//  bool OpenPresenter(Presenter &, const char *title, U32 width, U32 height, const SharedFrameRing *pRing,
+//                     bool isResizable)
+//      Opens a window showing width x height BGRA pixels. With a shared frame ring the frames are rendered into its
+//      slots instead of the presenter's own buffer. Only a resizable window reports new sizes to PollPresenter.
+//  bool ResizePresenter(Presenter &, U32 width, U32 height)
+//      Replaces the frame buffer with one of the new size. Not supported with a shared frame ring.
+//  void ClosePresenter(Presenter &)
+//  void PollPresenter(Presenter &, PresenterInput &)
+//      Handles pending window events without blocking.
+//  U32 *BeginPresenterFrame(Presenter &, U32 iSlot)
+//      Returns the pixels to render the next frame into, iSlot is the shared ring slot claimed for it, if any.
+//  void EndPresenterFrame(Presenter &)
+//      Shows the frame. The pixels may be written again once this returns.
+//  void WaitForNextFrame(Presenter &)
+//      Paces the render loop.
+#if defined(_WIN32)
+#include <presenter_win32.hpp>
+#else
+#include <presenter_linux.hpp>
+#endif
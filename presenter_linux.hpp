@@ -0,0 +1,113 @@
+#pragma once
+
+#include <cstdlib>
+
+#include <common.hpp>
+#include <presenter.hpp>
+#include <presenter_x11.hpp>
+#if defined(ENGINE_WAYLAND)
+#include <presenter_wayland.hpp>
+#endif
+#include <shared.hpp>
+
+namespace Engine
+{
+    // Picks the backend at run time. Wayland is used when WAYLAND_DISPLAY is set and the build has it, X11 otherwise
+    // or when the compositor cannot be reached. Run with an empty WAYLAND_DISPLAY to force X11 through Xwayland.
+    struct Presenter
+    {
+        X11Presenter m_x11;
+#if defined(ENGINE_WAYLAND)
+        WaylandPresenter m_wayland;
+        bool m_isWayland = false;
+#endif
+    };
+
+    inline bool OpenPresenter(Presenter &presenter, const char *title, const U32 width, const U32 height,
+                              const SharedFrameRing *pRing, const bool isResizable)
+    {
+#if defined(ENGINE_WAYLAND)
+        const char *pWaylandDisplay = std::getenv("WAYLAND_DISPLAY");
+        if (pWaylandDisplay && pWaylandDisplay[0] != '\0')
+        {
+            presenter.m_isWayland = OpenWaylandPresenter(presenter.m_wayland, title, width, height, pRing,
+                                                         isResizable);
+            if (presenter.m_isWayland)
+            {
+                return true;
+            }
+        }
+#endif
+        return OpenX11Presenter(presenter.m_x11, title, width, height, pRing, isResizable);
+    }
+
+    inline void ClosePresenter(Presenter &presenter)
+    {
+#if defined(ENGINE_WAYLAND)
+        if (presenter.m_isWayland)
+        {
+            CloseWaylandPresenter(presenter.m_wayland);
+            presenter.m_isWayland = false;
+            return;
+        }
+#endif
+        CloseX11Presenter(presenter.m_x11);
+    }
+
+    inline bool ResizePresenter(Presenter &presenter, const U32 width, const U32 height)
+    {
+#if defined(ENGINE_WAYLAND)
+        if (presenter.m_isWayland)
+        {
+            return ResizeWaylandPresenter(presenter.m_wayland, width, height);
+        }
+#endif
+        return ResizeX11Presenter(presenter.m_x11, width, height);
+    }
+
+    inline void PollPresenter(Presenter &presenter, PresenterInput &input)
+    {
+#if defined(ENGINE_WAYLAND)
+        if (presenter.m_isWayland)
+        {
+            PollWaylandPresenter(presenter.m_wayland, input);
+            return;
+        }
+#endif
+        PollX11Presenter(presenter.m_x11, input);
+    }
+
+    inline U32 *BeginPresenterFrame(Presenter &presenter, const U32 iSlot)
+    {
+#if defined(ENGINE_WAYLAND)
+        if (presenter.m_isWayland)
+        {
+            return BeginWaylandFrame(presenter.m_wayland, iSlot);
+        }
+#endif
+        return BeginX11Frame(presenter.m_x11, iSlot);
+    }
+
+    inline void EndPresenterFrame(Presenter &presenter)
+    {
+#if defined(ENGINE_WAYLAND)
+        if (presenter.m_isWayland)
+        {
+            EndWaylandFrame(presenter.m_wayland);
+            return;
+        }
+#endif
+        EndX11Frame(presenter.m_x11);
+    }
+
+    // X11 frames are paced by the XSync when they are presented, Wayland ones by frame callbacks.
+    inline void WaitForNextFrame([[maybe_unused]] Presenter &presenter)
+    {
+#if defined(ENGINE_WAYLAND)
+        if (presenter.m_isWayland)
+        {
+            WaitForWaylandFrame(presenter.m_wayland);
+        }
+#endif
+    }
+}
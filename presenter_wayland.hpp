@@ -0,0 +1,589 @@
+#pragma once
+
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+#include <poll.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <wayland-client.h>
+#include <xdg-shell-client-protocol.h>
+
+#include <common.hpp>
+#include <presenter.hpp>
+#include <shared.hpp>
+
+namespace Engine
+{
+    // Frames are rendered straight into wl_shm buffers carved out of one memfd pool. The compositor reads a buffer
+    // until it releases it, so the renderer cycles through a few of them and picks whichever is free. Frame callbacks
+    // pace the loop to the compositor's repaints.
+    // Test headless with: weston --backend=headless-backend.so --socket=wayland-engine &
+    //                     WAYLAND_DISPLAY=wayland-engine ./engine
+    static constexpr U32 kWaylandBuffers = 3;
+    // Hidden windows get no frame callbacks, keep rendering at a low rate for recording and serving.
+    static constexpr int kWaylandFrameTimeoutMs = 100;
+
+    struct WaylandBuffer
+    {
+        wl_buffer *m_pBuffer = nullptr;
+        U32 *m_pPixels = nullptr;
+        // Attached and not yet released by the compositor.
+        bool m_isBusy = false;
+    };
+
+    struct WaylandPresenter
+    {
+        wl_display *m_pDisplay = nullptr;
+        wl_registry *m_pRegistry = nullptr;
+        wl_compositor *m_pCompositor = nullptr;
+        wl_shm *m_pShm = nullptr;
+        xdg_wm_base *m_pWmBase = nullptr;
+        wl_seat *m_pSeat = nullptr;
+        wl_keyboard *m_pKeyboard = nullptr;
+        wl_pointer *m_pPointer = nullptr;
+
+        wl_surface *m_pSurface = nullptr;
+        xdg_surface *m_pXdgSurface = nullptr;
+        xdg_toplevel *m_pToplevel = nullptr;
+        wl_callback *m_pFrameCallback = nullptr;
+        bool m_isConfigured = false;
+        bool m_isResizable = false;
+        U32 m_width = 0;
+        U32 m_height = 0;
+
+        int m_poolFd = -1;
+        void *m_pPool = nullptr;
+        std::size_t m_poolSize = 0;
+        WaylandBuffer m_buffers[kWaylandBuffers];
+        WaylandBuffer *m_pBackBuffer = nullptr;
+
+        const SharedFrameRing *m_pRing = nullptr;
+        U32 *m_pFramePixels = nullptr;
+        // Events are dispatched while waiting for buffers and frames as well, so input collects here until polled.
+        PresenterInput m_input;
+        // Pointer motion is only reported in surface coordinates, deltas come from the last position.
+        bool m_hasPointer = false;
+        wl_fixed_t m_lastPointerX = 0;
+        wl_fixed_t m_lastPointerY = 0;
+    };
+
+    inline void HandleWaylandGlobal(void *pData, wl_registry *pRegistry, const uint32_t name, const char *pInterface,
+                                    uint32_t)
+    {
+        WaylandPresenter &presenter = *static_cast<WaylandPresenter *>(pData);
+        if (std::strcmp(pInterface, wl_compositor_interface.name) == 0)
+        {
+            presenter.m_pCompositor = static_cast<wl_compositor *>(
+                wl_registry_bind(pRegistry, name, &wl_compositor_interface, 1));
+        }
+        else if (std::strcmp(pInterface, wl_shm_interface.name) == 0)
+        {
+            presenter.m_pShm = static_cast<wl_shm *>(wl_registry_bind(pRegistry, name, &wl_shm_interface, 1));
+        }
+        else if (std::strcmp(pInterface, xdg_wm_base_interface.name) == 0)
+        {
+            presenter.m_pWmBase = static_cast<xdg_wm_base *>(
+                wl_registry_bind(pRegistry, name, &xdg_wm_base_interface, 1));
+        }
+        else if (std::strcmp(pInterface, wl_seat_interface.name) == 0 && !presenter.m_pSeat)
+        {
+            presenter.m_pSeat = static_cast<wl_seat *>(wl_registry_bind(pRegistry, name, &wl_seat_interface, 1));
+        }
+    }
+
+    inline void HandleWaylandGlobalRemove(void *, wl_registry *, uint32_t)
+    {
+    }
+
+    static constexpr wl_registry_listener kWaylandRegistryListener = {
+        .global = HandleWaylandGlobal,
+        .global_remove = HandleWaylandGlobalRemove,
+    };
+
+    inline void HandleWaylandPing(void *, xdg_wm_base *pWmBase, const uint32_t serial)
+    {
+        xdg_wm_base_pong(pWmBase, serial);
+    }
+
+    static constexpr xdg_wm_base_listener kWaylandWmBaseListener = {
+        .ping = HandleWaylandPing,
+    };
+
+    inline void HandleWaylandSurfaceConfigure(void *pData, xdg_surface *pXdgSurface, const uint32_t serial)
+    {
+        xdg_surface_ack_configure(pXdgSurface, serial);
+        static_cast<WaylandPresenter *>(pData)->m_isConfigured = true;
+    }
+
+    static constexpr xdg_surface_listener kWaylandSurfaceListener = {
+        .configure = HandleWaylandSurfaceConfigure,
+    };
+
+    // A size of 0 leaves it to the client, fixed size windows ignore the suggestions.
+    inline void HandleWaylandToplevelConfigure(void *pData, xdg_toplevel *, const int32_t width, const int32_t height,
+                                               wl_array *)
+    {
+        WaylandPresenter &presenter = *static_cast<WaylandPresenter *>(pData);
+        const bool isNewSize = static_cast<U32>(width) != presenter.m_width ||
+                               static_cast<U32>(height) != presenter.m_height;
+        if (presenter.m_isResizable && width > 0 && height > 0 && isNewSize)
+        {
+            presenter.m_input.m_resizeWidth = static_cast<U32>(width);
+            presenter.m_input.m_resizeHeight = static_cast<U32>(height);
+        }
+    }
+
+    inline void HandleWaylandToplevelClose(void *pData, xdg_toplevel *)
+    {
+        static_cast<WaylandPresenter *>(pData)->m_input.m_isClosed = true;
+    }
+
+    static constexpr xdg_toplevel_listener kWaylandToplevelListener = {
+        .configure = HandleWaylandToplevelConfigure,
+        .close = HandleWaylandToplevelClose,
+    };
+
+    inline void HandleWaylandBufferRelease(void *pData, wl_buffer *)
+    {
+        static_cast<WaylandBuffer *>(pData)->m_isBusy = false;
+    }
+
+    static constexpr wl_buffer_listener kWaylandBufferListener = {
+        .release = HandleWaylandBufferRelease,
+    };
+
+    inline void HandleWaylandFrameDone(void *pData, wl_callback *pCallback, uint32_t)
+    {
+        WaylandPresenter &presenter = *static_cast<WaylandPresenter *>(pData);
+        wl_callback_destroy(pCallback);
+        presenter.m_pFrameCallback = nullptr;
+    }
+
+    static constexpr wl_callback_listener kWaylandFrameListener = {
+        .done = HandleWaylandFrameDone,
+    };
+
+    // Keys are evdev codes, the same scan codes ApplyScanCode expects. No keymap is needed for them.
+    inline void HandleWaylandKeymap(void *, wl_keyboard *, uint32_t, const int32_t fd, uint32_t)
+    {
+        close(fd);
+    }
+
+    inline void HandleWaylandKeyboardEnter(void *, wl_keyboard *, uint32_t, wl_surface *, wl_array *)
+    {
+    }
+
+    // Releases are not sent once focus is gone.
+    inline void HandleWaylandKeyboardLeave(void *pData, wl_keyboard *, uint32_t, wl_surface *)
+    {
+        PresenterInput &input = static_cast<WaylandPresenter *>(pData)->m_input;
+        input.m_forward = false;
+        input.m_backward = false;
+        input.m_left = false;
+        input.m_right = false;
+    }
+
+    inline void HandleWaylandKey(void *pData, wl_keyboard *, uint32_t, uint32_t, const uint32_t key,
+                                 const uint32_t state)
+    {
+        ApplyScanCode(static_cast<WaylandPresenter *>(pData)->m_input, key, state == WL_KEYBOARD_KEY_STATE_PRESSED);
+    }
+
+    inline void HandleWaylandModifiers(void *, wl_keyboard *, uint32_t, uint32_t, uint32_t, uint32_t, uint32_t)
+    {
+    }
+
+    static constexpr wl_keyboard_listener kWaylandKeyboardListener = {
+        .keymap = HandleWaylandKeymap,
+        .enter = HandleWaylandKeyboardEnter,
+        .leave = HandleWaylandKeyboardLeave,
+        .key = HandleWaylandKey,
+        .modifiers = HandleWaylandModifiers,
+    };
+
+    inline void HandleWaylandPointerEnter(void *pData, wl_pointer *, uint32_t, wl_surface *, const wl_fixed_t x,
+                                          const wl_fixed_t y)
+    {
+        WaylandPresenter &presenter = *static_cast<WaylandPresenter *>(pData);
+        presenter.m_hasPointer = true;
+        presenter.m_lastPointerX = x;
+        presenter.m_lastPointerY = y;
+        presenter.m_input.m_cursorX = wl_fixed_to_int(x);
+        presenter.m_input.m_cursorY = wl_fixed_to_int(y);
+    }
+
+    inline void HandleWaylandPointerLeave(void *pData, wl_pointer *, uint32_t, wl_surface *)
+    {
+        WaylandPresenter &presenter = *static_cast<WaylandPresenter *>(pData);
+        presenter.m_hasPointer = false;
+        presenter.m_input.m_cursorX = -1;
+        presenter.m_input.m_cursorY = -1;
+    }
+
+    inline void HandleWaylandPointerMotion(void *pData, wl_pointer *, uint32_t, const wl_fixed_t x, const wl_fixed_t y)
+    {
+        WaylandPresenter &presenter = *static_cast<WaylandPresenter *>(pData);
+        presenter.m_input.m_cursorX = wl_fixed_to_int(x);
+        presenter.m_input.m_cursorY = wl_fixed_to_int(y);
+        if (presenter.m_hasPointer)
+        {
+            presenter.m_input.m_mouseX += wl_fixed_to_int(x - presenter.m_lastPointerX);
+            presenter.m_input.m_mouseY += wl_fixed_to_int(y - presenter.m_lastPointerY);
+            // Keep the fraction the whole pixels left behind.
+            presenter.m_lastPointerX = x - (x - presenter.m_lastPointerX) % wl_fixed_from_int(1);
+            presenter.m_lastPointerY = y - (y - presenter.m_lastPointerY) % wl_fixed_from_int(1);
+        }
+    }
+
+    inline void HandleWaylandPointerButton(void *, wl_pointer *, uint32_t, uint32_t, uint32_t, uint32_t)
+    {
+    }
+
+    inline void HandleWaylandPointerAxis(void *, wl_pointer *, uint32_t, uint32_t, wl_fixed_t)
+    {
+    }
+
+    static constexpr wl_pointer_listener kWaylandPointerListener = {
+        .enter = HandleWaylandPointerEnter,
+        .leave = HandleWaylandPointerLeave,
+        .motion = HandleWaylandPointerMotion,
+        .button = HandleWaylandPointerButton,
+        .axis = HandleWaylandPointerAxis,
+    };
+
+    inline void HandleWaylandSeatCapabilities(void *pData, wl_seat *pSeat, const uint32_t capabilities)
+    {
+        WaylandPresenter &presenter = *static_cast<WaylandPresenter *>(pData);
+        if ((capabilities & WL_SEAT_CAPABILITY_KEYBOARD) && !presenter.m_pKeyboard)
+        {
+            presenter.m_pKeyboard = wl_seat_get_keyboard(pSeat);
+            wl_keyboard_add_listener(presenter.m_pKeyboard, &kWaylandKeyboardListener, &presenter);
+        }
+        if ((capabilities & WL_SEAT_CAPABILITY_POINTER) && !presenter.m_pPointer)
+        {
+            presenter.m_pPointer = wl_seat_get_pointer(pSeat);
+            wl_pointer_add_listener(presenter.m_pPointer, &kWaylandPointerListener, &presenter);
+        }
+    }
+
+    static constexpr wl_seat_listener kWaylandSeatListener = {
+        .capabilities = HandleWaylandSeatCapabilities,
+    };
+
+    // Dispatches queued events and then waits up to timeoutMs for more, false once the connection is lost.
+    inline bool DispatchWaylandEvents(const WaylandPresenter &presenter, const int timeoutMs)
+    {
+        wl_display *pDisplay = presenter.m_pDisplay;
+        while (wl_display_prepare_read(pDisplay) != 0)
+        {
+            if (wl_display_dispatch_pending(pDisplay) < 0)
+            {
+                return false;
+            }
+        }
+        if (wl_display_flush(pDisplay) < 0 && errno != EAGAIN)
+        {
+            wl_display_cancel_read(pDisplay);
+            return false;
+        }
+        pollfd descriptor{wl_display_get_fd(pDisplay), POLLIN, 0};
+        if (poll(&descriptor, 1, timeoutMs) > 0)
+        {
+            if (wl_display_read_events(pDisplay) < 0)
+            {
+                return false;
+            }
+        }
+        else
+        {
+            wl_display_cancel_read(pDisplay);
+        }
+        return wl_display_dispatch_pending(pDisplay) >= 0;
+    }
+
+    inline bool CreateWaylandBuffers(WaylandPresenter &presenter)
+    {
+        const U32 stride = presenter.m_width * sizeof(U32);
+        const std::size_t bufferSize = static_cast<std::size_t>(stride) * presenter.m_height;
+        presenter.m_poolSize = bufferSize * kWaylandBuffers;
+        presenter.m_poolFd = memfd_create("engine-frames", MFD_CLOEXEC);
+        if (presenter.m_poolFd < 0 || ftruncate(presenter.m_poolFd, static_cast<off_t>(presenter.m_poolSize)) != 0)
+        {
+            return false;
+        }
+        void *pPool = mmap(nullptr, presenter.m_poolSize, PROT_READ | PROT_WRITE, MAP_SHARED, presenter.m_poolFd, 0);
+        if (pPool == MAP_FAILED)
+        {
+            return false;
+        }
+        presenter.m_pPool = pPool;
+
+        // Buffers keep the pool's memory alive, the pool object itself is not needed once they exist.
+        wl_shm_pool *pShmPool = wl_shm_create_pool(presenter.m_pShm, presenter.m_poolFd,
+                                                   static_cast<int32_t>(presenter.m_poolSize));
+        for (U32 iBuffer = 0; iBuffer < kWaylandBuffers; ++iBuffer)
+        {
+            WaylandBuffer &buffer = presenter.m_buffers[iBuffer];
+            const std::size_t offset = bufferSize * iBuffer;
+            // XRGB8888 is the little endian 0xXXRRGGBB word the renderer writes, and every compositor supports it.
+            buffer.m_pBuffer = wl_shm_pool_create_buffer(pShmPool, static_cast<int32_t>(offset),
+                                                         static_cast<int32_t>(presenter.m_width),
+                                                         static_cast<int32_t>(presenter.m_height),
+                                                         static_cast<int32_t>(stride), WL_SHM_FORMAT_XRGB8888);
+            buffer.m_pPixels = reinterpret_cast<U32 *>(static_cast<U8 *>(pPool) + offset);
+            wl_buffer_add_listener(buffer.m_pBuffer, &kWaylandBufferListener, &buffer);
+        }
+        wl_shm_pool_destroy(pShmPool);
+        return true;
+    }
+
+    // The compositor keeps showing the last committed buffer after it is destroyed.
+    inline void DestroyWaylandBuffers(WaylandPresenter &presenter)
+    {
+        for (WaylandBuffer &buffer: presenter.m_buffers)
+        {
+            if (buffer.m_pBuffer)
+            {
+                wl_buffer_destroy(buffer.m_pBuffer);
+            }
+            buffer = WaylandBuffer{};
+        }
+        if (presenter.m_pPool)
+        {
+            munmap(presenter.m_pPool, presenter.m_poolSize);
+            presenter.m_pPool = nullptr;
+        }
+        if (presenter.m_poolFd >= 0)
+        {
+            close(presenter.m_poolFd);
+            presenter.m_poolFd = -1;
+        }
+        presenter.m_pBackBuffer = nullptr;
+    }
+
+    inline void CloseWaylandPresenter(WaylandPresenter &presenter)
+    {
+        if (!presenter.m_pDisplay)
+        {
+            return;
+        }
+        if (presenter.m_pFrameCallback)
+        {
+            wl_callback_destroy(presenter.m_pFrameCallback);
+        }
+        DestroyWaylandBuffers(presenter);
+        if (presenter.m_pToplevel)
+        {
+            xdg_toplevel_destroy(presenter.m_pToplevel);
+        }
+        if (presenter.m_pXdgSurface)
+        {
+            xdg_surface_destroy(presenter.m_pXdgSurface);
+        }
+        if (presenter.m_pSurface)
+        {
+            wl_surface_destroy(presenter.m_pSurface);
+        }
+        if (presenter.m_pKeyboard)
+        {
+            wl_keyboard_destroy(presenter.m_pKeyboard);
+        }
+        if (presenter.m_pPointer)
+        {
+            wl_pointer_destroy(presenter.m_pPointer);
+        }
+        if (presenter.m_pSeat)
+        {
+            wl_seat_destroy(presenter.m_pSeat);
+        }
+        if (presenter.m_pWmBase)
+        {
+            xdg_wm_base_destroy(presenter.m_pWmBase);
+        }
+        if (presenter.m_pShm)
+        {
+            wl_shm_destroy(presenter.m_pShm);
+        }
+        if (presenter.m_pCompositor)
+        {
+            wl_compositor_destroy(presenter.m_pCompositor);
+        }
+        if (presenter.m_pRegistry)
+        {
+            wl_registry_destroy(presenter.m_pRegistry);
+        }
+        wl_display_disconnect(presenter.m_pDisplay);
+        presenter = WaylandPresenter{};
+    }
+
+    inline bool OpenWaylandPresenter(WaylandPresenter &presenter, const char *title, const U32 width, const U32 height,
+                                     const SharedFrameRing *pRing, const bool isResizable)
+    {
+        presenter.m_pDisplay = wl_display_connect(nullptr);
+        if (!presenter.m_pDisplay)
+        {
+            std::fprintf(stderr, "Cannot connect to the Wayland display\n");
+            return false;
+        }
+        presenter.m_width = width;
+        presenter.m_height = height;
+        presenter.m_pRing = pRing;
+        presenter.m_isResizable = isResizable;
+
+        presenter.m_pRegistry = wl_display_get_registry(presenter.m_pDisplay);
+        wl_registry_add_listener(presenter.m_pRegistry, &kWaylandRegistryListener, &presenter);
+        wl_display_roundtrip(presenter.m_pDisplay);
+        if (!presenter.m_pCompositor || !presenter.m_pShm || !presenter.m_pWmBase)
+        {
+            std::fprintf(stderr, "The Wayland compositor lacks wl_compositor, wl_shm or xdg_wm_base\n");
+            CloseWaylandPresenter(presenter);
+            return false;
+        }
+        xdg_wm_base_add_listener(presenter.m_pWmBase, &kWaylandWmBaseListener, &presenter);
+        if (presenter.m_pSeat)
+        {
+            wl_seat_add_listener(presenter.m_pSeat, &kWaylandSeatListener, &presenter);
+        }
+        if (!CreateWaylandBuffers(presenter))
+        {
+            std::fprintf(stderr, "Failed to create the Wayland frame buffers\n");
+            CloseWaylandPresenter(presenter);
+            return false;
+        }
+
+        presenter.m_pSurface = wl_compositor_create_surface(presenter.m_pCompositor);
+        presenter.m_pXdgSurface = xdg_wm_base_get_xdg_surface(presenter.m_pWmBase, presenter.m_pSurface);
+        xdg_surface_add_listener(presenter.m_pXdgSurface, &kWaylandSurfaceListener, &presenter);
+        presenter.m_pToplevel = xdg_surface_get_toplevel(presenter.m_pXdgSurface);
+        xdg_toplevel_add_listener(presenter.m_pToplevel, &kWaylandToplevelListener, &presenter);
+        xdg_toplevel_set_title(presenter.m_pToplevel, title);
+        xdg_toplevel_set_app_id(presenter.m_pToplevel, "engine");
+        if (!isResizable)
+        {
+            xdg_toplevel_set_min_size(presenter.m_pToplevel, static_cast<int32_t>(width),
+                                      static_cast<int32_t>(height));
+            xdg_toplevel_set_max_size(presenter.m_pToplevel, static_cast<int32_t>(width),
+                                      static_cast<int32_t>(height));
+        }
+        // Buffers may only be attached once the first configure is acknowledged.
+        wl_surface_commit(presenter.m_pSurface);
+        while (!presenter.m_isConfigured)
+        {
+            if (wl_display_dispatch(presenter.m_pDisplay) < 0)
+            {
+                std::fprintf(stderr, "Lost the Wayland connection while mapping the window\n");
+                CloseWaylandPresenter(presenter);
+                return false;
+            }
+        }
+        std::fprintf(stderr, "Presenting through Wayland shm buffers\n");
+        return true;
+    }
+
+    inline void PollWaylandPresenter(WaylandPresenter &presenter, PresenterInput &input)
+    {
+        PresenterInput &events = presenter.m_input;
+        events.m_isClosed |= !DispatchWaylandEvents(presenter, 0);
+        input.m_mouseX += events.m_mouseX;
+        input.m_mouseY += events.m_mouseY;
+        input.m_cursorX = events.m_cursorX;
+        input.m_cursorY = events.m_cursorY;
+        input.m_forward = events.m_forward;
+        input.m_backward = events.m_backward;
+        input.m_left = events.m_left;
+        input.m_right = events.m_right;
+        input.m_isDumpRequested |= events.m_isDumpRequested;
+        input.m_isClosed |= events.m_isClosed;
+        if (events.m_resizeWidth != 0)
+        {
+            input.m_resizeWidth = events.m_resizeWidth;
+            input.m_resizeHeight = events.m_resizeHeight;
+        }
+        events.m_mouseX = 0;
+        events.m_mouseY = 0;
+        events.m_isDumpRequested = false;
+        events.m_resizeWidth = 0;
+        events.m_resizeHeight = 0;
+    }
+
+    inline bool ResizeWaylandPresenter(WaylandPresenter &presenter, const U32 width, const U32 height)
+    {
+        if (presenter.m_pRing)
+        {
+            return false;
+        }
+        DestroyWaylandBuffers(presenter);
+        presenter.m_width = width;
+        presenter.m_height = height;
+        return CreateWaylandBuffers(presenter);
+    }
+
+    // Frames go straight into a free buffer of the pool. The compositor cannot take buffers from the frame ring's
+    // POSIX shared memory without risking it reading a slot the renderer reuses, so shared frames are rendered into
+    // their slot and copied over when presented.
+    inline U32 *BeginWaylandFrame(WaylandPresenter &presenter, const U32 iSlot)
+    {
+        WaylandBuffer *pFree = nullptr;
+        while (!pFree)
+        {
+            for (WaylandBuffer &buffer: presenter.m_buffers)
+            {
+                if (!buffer.m_isBusy)
+                {
+                    pFree = &buffer;
+                    break;
+                }
+            }
+            // Without a connection nothing will be released, the closed window ends the loop after this frame.
+            if (!pFree && !DispatchWaylandEvents(presenter, -1))
+            {
+                presenter.m_input.m_isClosed = true;
+                pFree = &presenter.m_buffers[0];
+            }
+        }
+        presenter.m_pBackBuffer = pFree;
+        presenter.m_pFramePixels = presenter.m_pRing ? SharedFramePixels(*presenter.m_pRing, iSlot)
+                                                     : pFree->m_pPixels;
+        return presenter.m_pFramePixels;
+    }
+
+    inline void EndWaylandFrame(WaylandPresenter &presenter)
+    {
+        WaylandBuffer &buffer = *presenter.m_pBackBuffer;
+        if (presenter.m_pFramePixels != buffer.m_pPixels)
+        {
+            std::memcpy(buffer.m_pPixels, presenter.m_pFramePixels,
+                        static_cast<std::size_t>(presenter.m_width) * presenter.m_height * sizeof(U32));
+        }
+        buffer.m_isBusy = true;
+        wl_surface_attach(presenter.m_pSurface, buffer.m_pBuffer, 0, 0);
+        wl_surface_damage(presenter.m_pSurface, 0, 0, static_cast<int32_t>(presenter.m_width),
+                          static_cast<int32_t>(presenter.m_height));
+        if (!presenter.m_pFrameCallback)
+        {
+            presenter.m_pFrameCallback = wl_surface_frame(presenter.m_pSurface);
+            wl_callback_add_listener(presenter.m_pFrameCallback, &kWaylandFrameListener, &presenter);
+        }
+        wl_surface_commit(presenter.m_pSurface);
+        wl_display_flush(presenter.m_pDisplay);
+    }
+
+    // Blocks until the compositor asks for the next frame, or the timeout for hidden windows runs out.
+    inline void WaitForWaylandFrame(WaylandPresenter &presenter)
+    {
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(kWaylandFrameTimeoutMs);
+        while (presenter.m_pFrameCallback && !presenter.m_input.m_isClosed)
+        {
+            const auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+                deadline - std::chrono::steady_clock::now()).count();
+            if (remaining <= 0)
+            {
+                return;
+            }
+            presenter.m_input.m_isClosed |= !DispatchWaylandEvents(presenter, static_cast<int>(remaining));
+        }
+    }
+}
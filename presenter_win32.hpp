@@ -0,0 +1,282 @@
+#pragma once
+
+#include <windows.h>
+
+#include <common.hpp>
+#include <presenter.hpp>
+#include <shared.hpp>
+
+namespace Engine
+{
+    // Window pixels live in a DIB section that WM_PAINT blits to the window.
+    struct Presenter
+    {
+        HWND m_hWindow = nullptr;
+        BITMAPINFO m_bitmapInfo;
+        void *m_pPixels = nullptr;
+        HBITMAP m_hBitmap = nullptr;
+        HDC m_hMemDC = nullptr;
+        U32 m_width = 0;
+        U32 m_height = 0;
+        const SharedFrameRing *m_pRing = nullptr;
+        // A fixed size window can still be resized by snapping or DPI changes, those sizes are dropped.
+        bool m_isResizable = false;
+        // DIB sections over the shared slots, so the window shows the exported frames without a copy.
+        HBITMAP m_hSlotBitmaps[kSharedFrameSlots] = {};
+        // Where window messages deliver input, only set while PollPresenter dispatches them.
+        PresenterInput *m_pInput = nullptr;
+    };
+
+    // Creates the DIB section for the presenter's current size and selects it for WM_PAINT.
+    inline bool CreateWindowBitmap(Presenter &presenter, const HDC hDC)
+    {
+        presenter.m_bitmapInfo = {
+            .bmiHeader = {
+                .biSize = sizeof(BITMAPINFOHEADER),
+                .biWidth = static_cast<LONG>(presenter.m_width),
+                .biHeight = -static_cast<LONG>(presenter.m_height),
+                .biPlanes = 1,
+                .biBitCount = 32,
+                .biCompression = BI_RGB
+            },
+        };
+        presenter.m_hBitmap = CreateDIBSection(
+            hDC,
+            &presenter.m_bitmapInfo,
+            DIB_RGB_COLORS,
+            &presenter.m_pPixels,
+            nullptr,
+            0
+            );
+        if (!presenter.m_hBitmap)
+        {
+            presenter.m_pPixels = nullptr;
+            return false;
+        }
+        SelectObject(presenter.m_hMemDC, presenter.m_hBitmap);
+        return true;
+    }
+
+    inline LRESULT CALLBACK ProcessCallback(const HWND hWnd, const UINT uMsg, const WPARAM wParam, const LPARAM lParam)
+    {
+        Presenter &presenter = *reinterpret_cast<Presenter *>(GetWindowLongPtr(hWnd, GWLP_USERDATA));
+        switch (uMsg)
+        {
+            case WM_NCCREATE: {
+                const CREATESTRUCT *const pCreateStruct = reinterpret_cast<CREATESTRUCT *>(lParam);
+                SetWindowLongPtr(hWnd, GWLP_USERDATA, reinterpret_cast<LONG_PTR>(pCreateStruct->lpCreateParams));
+                return true;
+            }
+            case WM_CREATE: {
+                const HDC hDC = GetDC(hWnd);
+                presenter.m_hMemDC = CreateCompatibleDC(hDC);
+                CreateWindowBitmap(presenter, hDC);
+                const SharedFrameRing *pRing = presenter.m_pRing;
+                for (U32 iSlot = 0; pRing && iSlot < kSharedFrameSlots; ++iSlot)
+                {
+                    void *pSlotPixels;
+                    presenter.m_hSlotBitmaps[iSlot] = CreateDIBSection(
+                        hDC,
+                        &presenter.m_bitmapInfo,
+                        DIB_RGB_COLORS,
+                        &pSlotPixels,
+                        pRing->m_hMapping,
+                        static_cast<DWORD>(pRing->m_pHeader->m_slots[iSlot].m_offset)
+                        );
+                }
+                ReleaseDC(hWnd, hDC);
+                return 0;
+            }
+            case WM_SIZE: {
+                const U32 width = LOWORD(lParam);
+                const U32 height = HIWORD(lParam);
+                const bool isNewSize = width != presenter.m_width || height != presenter.m_height;
+                if (presenter.m_pInput && presenter.m_isResizable && wParam != SIZE_MINIMIZED && width > 0 &&
+                    height > 0 && isNewSize)
+                {
+                    presenter.m_pInput->m_resizeWidth = width;
+                    presenter.m_pInput->m_resizeHeight = height;
+                }
+                return 0;
+            }
+            case WM_DESTROY: {
+                DeleteDC(presenter.m_hMemDC);
+                DeleteObject(presenter.m_hBitmap);
+                for (const HBITMAP hSlotBitmap: presenter.m_hSlotBitmaps)
+                {
+                    if (hSlotBitmap)
+                    {
+                        DeleteObject(hSlotBitmap);
+                    }
+                }
+                presenter.m_hWindow = nullptr;
+                PostQuitMessage(0);
+                return 0;
+            }
+            case WM_PAINT: {
+                PAINTSTRUCT ps;
+                const HDC hDC = BeginPaint(hWnd, &ps);
+                BitBlt(hDC, 0, 0, static_cast<int>(presenter.m_width), static_cast<int>(presenter.m_height),
+                       presenter.m_hMemDC, 0, 0, SRCCOPY);
+                EndPaint(hWnd, &ps);
+                return 0;
+            }
+            case WM_INPUT: {
+                UINT dwSize = sizeof(RAWINPUT);
+                RAWINPUT raw;
+                GetRawInputData(reinterpret_cast<HRAWINPUT>(lParam), RID_INPUT, &raw, &dwSize, sizeof(RAWINPUTHEADER));
+
+                PresenterInput *pInput = presenter.m_pInput;
+                if (!pInput)
+                {
+                    return 0;
+                }
+                if (raw.header.dwType == RIM_TYPEMOUSE)
+                {
+                    pInput->m_mouseX += raw.data.mouse.lLastX;
+                    pInput->m_mouseY += raw.data.mouse.lLastY;
+                }
+                else if (raw.header.dwType == RIM_TYPEKEYBOARD)
+                {
+                    const bool isBreak = (raw.data.keyboard.Flags & RI_KEY_BREAK) != 0;
+                    ApplyScanCode(*pInput, raw.data.keyboard.MakeCode, !isBreak);
+                }
+                return 0;
+            }
+            default: {
+                return DefWindowProc(hWnd, uMsg, wParam, lParam);
+            }
+        }
+    }
+
+    inline bool OpenPresenter(Presenter &presenter, const char *title, const U32 width, const U32 height,
+                              const SharedFrameRing *pRing, const bool isResizable)
+    {
+        presenter.m_width = width;
+        presenter.m_height = height;
+        presenter.m_pRing = pRing;
+        presenter.m_isResizable = isResizable;
+
+        constexpr WNDCLASSEX kWindowClass = {
+            .cbSize = sizeof(WNDCLASSEX),
+            .style = CS_HREDRAW | CS_VREDRAW,
+            .lpfnWndProc = ProcessCallback,
+            .lpszClassName = "engine",
+        };
+        RegisterClassEx(&kWindowClass);
+
+        // Sized so the client area matches the frame.
+        const DWORD style = isResizable ? WS_OVERLAPPEDWINDOW | WS_VISIBLE
+                                        : WS_OVERLAPPED | WS_CAPTION | WS_SYSMENU | WS_VISIBLE;
+        RECT rect{0, 0, static_cast<LONG>(width), static_cast<LONG>(height)};
+        AdjustWindowRect(&rect, style, FALSE);
+        presenter.m_hWindow = CreateWindowEx(
+            0,
+            kWindowClass.lpszClassName,
+            title,
+            style,
+            CW_USEDEFAULT, CW_USEDEFAULT, static_cast<int>(rect.right - rect.left),
+            static_cast<int>(rect.bottom - rect.top),
+            nullptr,
+            nullptr,
+            GetModuleHandle(nullptr),
+            &presenter
+            );
+        if (!presenter.m_hWindow || !presenter.m_pPixels)
+        {
+            return false;
+        }
+
+        const RAWINPUTDEVICE rid[] = {
+            {
+                .usUsagePage = 0x01,
+                .usUsage = 0x02,
+                .dwFlags = RIDEV_INPUTSINK,
+                .hwndTarget = presenter.m_hWindow,
+            },
+            {
+                .usUsagePage = 0x01,
+                .usUsage = 0x06,
+                .dwFlags = RIDEV_INPUTSINK,
+                .hwndTarget = presenter.m_hWindow,
+            }
+        };
+        RegisterRawInputDevices(rid, 2, sizeof(RAWINPUTDEVICE));
+
+        ShowWindow(presenter.m_hWindow, SW_SHOW);
+        UpdateWindow(presenter.m_hWindow);
+        return true;
+    }
+
+    inline void ClosePresenter(Presenter &presenter)
+    {
+        if (presenter.m_hWindow)
+        {
+            DestroyWindow(presenter.m_hWindow);
+        }
+    }
+
+    inline bool ResizePresenter(Presenter &presenter, const U32 width, const U32 height)
+    {
+        if (presenter.m_pRing)
+        {
+            return false;
+        }
+        const HBITMAP hOldBitmap = presenter.m_hBitmap;
+        presenter.m_width = width;
+        presenter.m_height = height;
+        const HDC hDC = GetDC(presenter.m_hWindow);
+        const bool isCreated = CreateWindowBitmap(presenter, hDC);
+        ReleaseDC(presenter.m_hWindow, hDC);
+        DeleteObject(hOldBitmap);
+        return isCreated;
+    }
+
+    inline void PollPresenter(Presenter &presenter, PresenterInput &input)
+    {
+        presenter.m_pInput = &input;
+        MSG msg;
+        while (PeekMessage(&msg, nullptr, 0, 0, PM_REMOVE))
+        {
+            if (msg.message == WM_QUIT)
+            {
+                input.m_isClosed = true;
+            }
+
+            TranslateMessage(&msg);
+            DispatchMessage(&msg);
+        }
+        presenter.m_pInput = nullptr;
+
+        POINT cursor;
+        const bool isInClient = GetCursorPos(&cursor) && ScreenToClient(presenter.m_hWindow, &cursor) &&
+                                cursor.x >= 0 && cursor.y >= 0 && static_cast<U32>(cursor.x) < presenter.m_width &&
+                                static_cast<U32>(cursor.y) < presenter.m_height;
+        input.m_cursorX = isInClient ? static_cast<I32>(cursor.x) : -1;
+        input.m_cursorY = isInClient ? static_cast<I32>(cursor.y) : -1;
+    }
+
+    // Shared frames are rendered straight into the ring slot, whose DIB section the window then displays.
+    inline U32 *BeginPresenterFrame(Presenter &presenter, const U32 iSlot)
+    {
+        if (!presenter.m_pRing)
+        {
+            return static_cast<U32 *>(presenter.m_pPixels);
+        }
+        if (presenter.m_hSlotBitmaps[iSlot])
+        {
+            SelectObject(presenter.m_hMemDC, presenter.m_hSlotBitmaps[iSlot]);
+        }
+        return SharedFramePixels(*presenter.m_pRing, iSlot);
+    }
+
+    inline void EndPresenterFrame(Presenter &presenter)
+    {
+        InvalidateRect(presenter.m_hWindow, nullptr, FALSE);
+    }
+
+    inline void WaitForNextFrame(Presenter &)
+    {
+        Sleep(1);
+    }
+}
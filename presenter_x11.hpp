@@ -0,0 +1,429 @@
+#pragma once
+
+#include <cstdio>
+#include <cstring>
+
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/extensions/XInput2.h>
+#include <X11/extensions/XShm.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+
+#include <common.hpp>
+#include <memory.hpp>
+#include <presenter.hpp>
+#include <shared.hpp>
+
+namespace Engine
+{
+    // Frames are rendered into a MIT-SHM segment the X server maps as well. Where the server supports shared pixmaps
+    // the segment backs a pixmap and presenting is a server side copy to the window, otherwise the segment is put
+    // with XShmPutImage. Remote displays without MIT-SHM fall back to XPutImage over the connection.
+    // Test headless with: xvfb-run -s "-screen 0 1024x768x24" ./engine
+    struct X11Presenter
+    {
+        Display *m_pDisplay = nullptr;
+        ::Window m_window = 0;
+        GC m_gc = nullptr;
+        Atom m_deleteAtom = 0;
+        // Major opcode of XInput2 events, 0 when the server has no XInput 2 and core events are used.
+        int m_xiOpcode = 0;
+        Visual *m_pVisual = nullptr;
+        // Window managers are free to ignore the fixed size hints, so other windows drop the sizes they are given.
+        bool m_isResizable = false;
+        U32 m_width = 0;
+        U32 m_height = 0;
+
+        XShmSegmentInfo m_shmInfo{};
+        bool m_isShmAttached = false;
+        Pixmap m_pixmap = 0;
+        XImage *m_pImage = nullptr;
+        PageAllocation m_fallbackPixels;
+        U32 *m_pPixels = nullptr;
+
+        const SharedFrameRing *m_pRing = nullptr;
+        U32 *m_pFramePixels = nullptr;
+        // Sub-pixel remainder of the raw mouse motion.
+        F32 m_mouseRemainderX = 0.0f;
+        F32 m_mouseRemainderY = 0.0f;
+        // Last pointer position of core motion events, for deltas without XInput 2.
+        int m_lastPointerX = -1;
+        int m_lastPointerY = -1;
+    };
+
+    // Attaching a segment fails asynchronously on displays that cannot map it, which Xlib reports to the error
+    // handler instead of the caller.
+    inline bool gHasX11Error = false;
+
+    inline int RecordX11Error(Display *, XErrorEvent *)
+    {
+        gHasX11Error = true;
+        return 0;
+    }
+
+    inline bool AttachSharedSegment(X11Presenter &presenter, const std::size_t size)
+    {
+        Display *pDisplay = presenter.m_pDisplay;
+        if (!XShmQueryExtension(pDisplay))
+        {
+            return false;
+        }
+        XShmSegmentInfo &info = presenter.m_shmInfo;
+        info.shmid = shmget(IPC_PRIVATE, size, IPC_CREAT | 0600);
+        if (info.shmid < 0)
+        {
+            return false;
+        }
+        info.shmaddr = static_cast<char *>(shmat(info.shmid, nullptr, 0));
+        info.readOnly = False;
+        // Marked for removal right away, the segment goes when both sides have detached, even after a crash.
+        shmctl(info.shmid, IPC_RMID, nullptr);
+        if (info.shmaddr == reinterpret_cast<char *>(-1))
+        {
+            info.shmaddr = nullptr;
+            return false;
+        }
+        XSync(pDisplay, False);
+        gHasX11Error = false;
+        int (*previousHandler)(Display *, XErrorEvent *) = XSetErrorHandler(RecordX11Error);
+        XShmAttach(pDisplay, &info);
+        XSync(pDisplay, False);
+        XSetErrorHandler(previousHandler);
+        presenter.m_isShmAttached = !gHasX11Error;
+        if (!presenter.m_isShmAttached)
+        {
+            shmdt(info.shmaddr);
+            info.shmaddr = nullptr;
+        }
+        return presenter.m_isShmAttached;
+    }
+
+    inline void SelectX11Input(X11Presenter &presenter)
+    {
+        Display *pDisplay = presenter.m_pDisplay;
+        // Pointer events track the cursor position, raw motion only carries deltas.
+        long eventMask = ExposureMask | StructureNotifyMask | PointerMotionMask | EnterWindowMask | LeaveWindowMask;
+        int event;
+        int error;
+        int major = 2;
+        int minor = 0;
+        if (XQueryExtension(pDisplay, "XInputExtension", &presenter.m_xiOpcode, &event, &error) &&
+            XIQueryVersion(pDisplay, &major, &minor) == Success)
+        {
+            // Raw events on the root window arrive whatever window has focus, like Win32 raw input with
+            // RIDEV_INPUTSINK, and carry unaccelerated motion.
+            unsigned char mask[XIMaskLen(XI_LASTEVENT)] = {};
+            XISetMask(mask, XI_RawMotion);
+            XISetMask(mask, XI_RawKeyPress);
+            XISetMask(mask, XI_RawKeyRelease);
+            XIEventMask eventMasks{XIAllMasterDevices, sizeof(mask), mask};
+            XISelectEvents(pDisplay, DefaultRootWindow(pDisplay), &eventMasks, 1);
+        }
+        else
+        {
+            presenter.m_xiOpcode = 0;
+            eventMask |= KeyPressMask | KeyReleaseMask;
+        }
+        XSelectInput(pDisplay, presenter.m_window, eventMask);
+    }
+
+    inline void DestroyX11Buffer(X11Presenter &presenter)
+    {
+        Display *pDisplay = presenter.m_pDisplay;
+        if (presenter.m_pixmap)
+        {
+            XFreePixmap(pDisplay, presenter.m_pixmap);
+            presenter.m_pixmap = 0;
+        }
+        if (presenter.m_pImage)
+        {
+            // The pixels belong to the segment or the page allocation, not to Xlib.
+            presenter.m_pImage->data = nullptr;
+            XDestroyImage(presenter.m_pImage);
+            presenter.m_pImage = nullptr;
+        }
+        if (presenter.m_isShmAttached)
+        {
+            XShmDetach(pDisplay, &presenter.m_shmInfo);
+            XSync(pDisplay, False);
+            shmdt(presenter.m_shmInfo.shmaddr);
+            presenter.m_shmInfo = XShmSegmentInfo{};
+            presenter.m_isShmAttached = false;
+        }
+        FreePages(presenter.m_fallbackPixels);
+        presenter.m_fallbackPixels = PageAllocation{};
+        presenter.m_pPixels = nullptr;
+    }
+
+    // Creates the frame buffer for the presenter's current size, in the best way the display supports.
+    inline bool CreateX11Buffer(X11Presenter &presenter)
+    {
+        Display *pDisplay = presenter.m_pDisplay;
+        const U32 width = presenter.m_width;
+        const U32 height = presenter.m_height;
+        const U32 stride = width * sizeof(U32);
+        const std::size_t size = static_cast<std::size_t>(stride) * height;
+        if (AttachSharedSegment(presenter, size))
+        {
+            presenter.m_pPixels = reinterpret_cast<U32 *>(presenter.m_shmInfo.shmaddr);
+            int major;
+            int minor;
+            Bool hasSharedPixmaps = False;
+            XShmQueryVersion(pDisplay, &major, &minor, &hasSharedPixmaps);
+            if (hasSharedPixmaps && XShmPixmapFormat(pDisplay) == ZPixmap)
+            {
+                presenter.m_pixmap = XShmCreatePixmap(pDisplay, presenter.m_window, presenter.m_shmInfo.shmaddr,
+                                                      &presenter.m_shmInfo, width, height, 24);
+            }
+            else
+            {
+                presenter.m_pImage = XShmCreateImage(pDisplay, presenter.m_pVisual, 24, ZPixmap,
+                                                     presenter.m_shmInfo.shmaddr, &presenter.m_shmInfo, width,
+                                                     height);
+            }
+        }
+        else
+        {
+            presenter.m_fallbackPixels = AllocatePages(size, false);
+            presenter.m_pPixels = static_cast<U32 *>(presenter.m_fallbackPixels.m_pData);
+            presenter.m_pImage = XCreateImage(pDisplay, presenter.m_pVisual, 24, ZPixmap, 0,
+                                              reinterpret_cast<char *>(presenter.m_pPixels), width, height, 32,
+                                              static_cast<int>(stride));
+        }
+        return presenter.m_pPixels && (presenter.m_pixmap || presenter.m_pImage) &&
+               (!presenter.m_pImage || presenter.m_pImage->bytes_per_line == static_cast<int>(stride));
+    }
+
+    inline void CloseX11Presenter(X11Presenter &presenter)
+    {
+        Display *pDisplay = presenter.m_pDisplay;
+        if (!pDisplay)
+        {
+            return;
+        }
+        DestroyX11Buffer(presenter);
+        if (presenter.m_gc)
+        {
+            XFreeGC(pDisplay, presenter.m_gc);
+        }
+        if (presenter.m_window)
+        {
+            XDestroyWindow(pDisplay, presenter.m_window);
+        }
+        XCloseDisplay(pDisplay);
+        presenter = X11Presenter{};
+    }
+
+    inline bool OpenX11Presenter(X11Presenter &presenter, const char *title, const U32 width, const U32 height,
+                                 const SharedFrameRing *pRing, const bool isResizable)
+    {
+        presenter.m_pDisplay = XOpenDisplay(nullptr);
+        Display *pDisplay = presenter.m_pDisplay;
+        if (!pDisplay)
+        {
+            std::fprintf(stderr, "Cannot open X display %s\n", XDisplayName(nullptr));
+            return false;
+        }
+        // Rendered words are 0xAARRGGBB, which needs a 24 bit TrueColor visual with the usual masks.
+        const int screen = DefaultScreen(pDisplay);
+        Visual *pVisual = DefaultVisual(pDisplay, screen);
+        if (DefaultDepth(pDisplay, screen) != 24 || pVisual->red_mask != 0xFF0000 || pVisual->green_mask != 0xFF00 ||
+            pVisual->blue_mask != 0xFF || ImageByteOrder(pDisplay) != LSBFirst)
+        {
+            std::fprintf(stderr, "The X screen needs a 24 bit RGB TrueColor visual\n");
+            CloseX11Presenter(presenter);
+            return false;
+        }
+        presenter.m_pVisual = pVisual;
+        presenter.m_width = width;
+        presenter.m_height = height;
+        presenter.m_pRing = pRing;
+        presenter.m_isResizable = isResizable;
+
+        presenter.m_window = XCreateSimpleWindow(pDisplay, RootWindow(pDisplay, screen), 0, 0, width, height, 0,
+                                                 BlackPixel(pDisplay, screen), BlackPixel(pDisplay, screen));
+        XStoreName(pDisplay, presenter.m_window, title);
+        if (!isResizable)
+        {
+            XSizeHints *pHints = XAllocSizeHints();
+            pHints->flags = PMinSize | PMaxSize;
+            pHints->min_width = pHints->max_width = static_cast<int>(width);
+            pHints->min_height = pHints->max_height = static_cast<int>(height);
+            XSetWMNormalHints(pDisplay, presenter.m_window, pHints);
+            XFree(pHints);
+        }
+        presenter.m_deleteAtom = XInternAtom(pDisplay, "WM_DELETE_WINDOW", False);
+        XSetWMProtocols(pDisplay, presenter.m_window, &presenter.m_deleteAtom, 1);
+        SelectX11Input(presenter);
+        presenter.m_gc = XCreateGC(pDisplay, presenter.m_window, 0, nullptr);
+
+        if (!CreateX11Buffer(presenter))
+        {
+            std::fprintf(stderr, "Failed to create the X11 frame buffer\n");
+            CloseX11Presenter(presenter);
+            return false;
+        }
+        std::fprintf(stderr, "Presenting through %s\n", presenter.m_pixmap   ? "MIT-SHM shared pixmaps"
+                                                         : presenter.m_isShmAttached ? "MIT-SHM images"
+                                                                                     : "XPutImage");
+        XMapWindow(pDisplay, presenter.m_window);
+        XFlush(pDisplay);
+        return true;
+    }
+
+    inline void CopyX11Frame(X11Presenter &presenter)
+    {
+        Display *pDisplay = presenter.m_pDisplay;
+        if (presenter.m_pixmap)
+        {
+            XCopyArea(pDisplay, presenter.m_pixmap, presenter.m_window, presenter.m_gc, 0, 0, presenter.m_width,
+                      presenter.m_height, 0, 0);
+        }
+        else if (presenter.m_isShmAttached)
+        {
+            XShmPutImage(pDisplay, presenter.m_window, presenter.m_gc, presenter.m_pImage, 0, 0, 0, 0,
+                         presenter.m_width, presenter.m_height, False);
+        }
+        else
+        {
+            XPutImage(pDisplay, presenter.m_window, presenter.m_gc, presenter.m_pImage, 0, 0, 0, 0,
+                      presenter.m_width, presenter.m_height);
+        }
+    }
+
+    inline void HandleX11RawEvent(X11Presenter &presenter, XGenericEventCookie &cookie, PresenterInput &input)
+    {
+        const XIRawEvent &raw = *static_cast<const XIRawEvent *>(cookie.data);
+        switch (cookie.evtype)
+        {
+            case XI_RawMotion: {
+                // Values are only sent for the valuators that changed, in valuator order.
+                const double *pValue = raw.raw_values;
+                for (int iValuator = 0; iValuator < 2 && iValuator < raw.valuators.mask_len * 8; ++iValuator)
+                {
+                    if (!XIMaskIsSet(raw.valuators.mask, iValuator))
+                    {
+                        continue;
+                    }
+                    F32 &remainder = iValuator == 0 ? presenter.m_mouseRemainderX : presenter.m_mouseRemainderY;
+                    I32 &delta = iValuator == 0 ? input.m_mouseX : input.m_mouseY;
+                    remainder += static_cast<F32>(*pValue++);
+                    const I32 whole = static_cast<I32>(remainder);
+                    delta += whole;
+                    remainder -= static_cast<F32>(whole);
+                }
+                break;
+            }
+            case XI_RawKeyPress:
+            case XI_RawKeyRelease:
+                // Raw key events are not auto-repeated, so presses and releases pair up.
+                ApplyScanCode(input, static_cast<U32>(raw.detail) - 8, cookie.evtype == XI_RawKeyPress);
+                break;
+            default:
+                break;
+        }
+    }
+
+    inline bool ResizeX11Presenter(X11Presenter &presenter, const U32 width, const U32 height)
+    {
+        if (presenter.m_pRing)
+        {
+            return false;
+        }
+        DestroyX11Buffer(presenter);
+        presenter.m_width = width;
+        presenter.m_height = height;
+        return CreateX11Buffer(presenter);
+    }
+
+    inline void PollX11Presenter(X11Presenter &presenter, PresenterInput &input)
+    {
+        Display *pDisplay = presenter.m_pDisplay;
+        while (XPending(pDisplay) > 0)
+        {
+            XEvent event;
+            XNextEvent(pDisplay, &event);
+            switch (event.type)
+            {
+                case ClientMessage:
+                    if (static_cast<Atom>(event.xclient.data.l[0]) == presenter.m_deleteAtom)
+                    {
+                        input.m_isClosed = true;
+                    }
+                    break;
+                case ConfigureNotify: {
+                    const U32 width = static_cast<U32>(event.xconfigure.width);
+                    const U32 height = static_cast<U32>(event.xconfigure.height);
+                    if (presenter.m_isResizable && (width != presenter.m_width || height != presenter.m_height))
+                    {
+                        input.m_resizeWidth = width;
+                        input.m_resizeHeight = height;
+                    }
+                    break;
+                }
+                case Expose:
+                    if (event.xexpose.count == 0)
+                    {
+                        CopyX11Frame(presenter);
+                    }
+                    break;
+                case GenericEvent:
+                    if (event.xcookie.extension == presenter.m_xiOpcode && XGetEventData(pDisplay, &event.xcookie))
+                    {
+                        HandleX11RawEvent(presenter, event.xcookie, input);
+                        XFreeEventData(pDisplay, &event.xcookie);
+                    }
+                    break;
+                case KeyPress:
+                case KeyRelease:
+                    ApplyScanCode(input, event.xkey.keycode - 8, event.type == KeyPress);
+                    break;
+                case EnterNotify:
+                    input.m_cursorX = event.xcrossing.x;
+                    input.m_cursorY = event.xcrossing.y;
+                    break;
+                case LeaveNotify:
+                    input.m_cursorX = -1;
+                    input.m_cursorY = -1;
+                    break;
+                case MotionNotify:
+                    input.m_cursorX = event.xmotion.x;
+                    input.m_cursorY = event.xmotion.y;
+                    // Without XInput2 the pointer deltas stand in for raw motion.
+                    if (presenter.m_xiOpcode == 0 && presenter.m_lastPointerX >= 0)
+                    {
+                        input.m_mouseX += event.xmotion.x - presenter.m_lastPointerX;
+                        input.m_mouseY += event.xmotion.y - presenter.m_lastPointerY;
+                    }
+                    presenter.m_lastPointerX = event.xmotion.x;
+                    presenter.m_lastPointerY = event.xmotion.y;
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+
+    // The X server cannot map the POSIX shared memory of the frame ring, so shared frames are rendered into their
+    // slot and copied into the segment when presented.
+    inline U32 *BeginX11Frame(X11Presenter &presenter, const U32 iSlot)
+    {
+        presenter.m_pFramePixels = presenter.m_pRing ? SharedFramePixels(*presenter.m_pRing, iSlot)
+                                                     : presenter.m_pPixels;
+        return presenter.m_pFramePixels;
+    }
+
+    inline void EndX11Frame(X11Presenter &presenter)
+    {
+        if (presenter.m_pFramePixels != presenter.m_pPixels)
+        {
+            std::memcpy(presenter.m_pPixels, presenter.m_pFramePixels,
+                        static_cast<std::size_t>(presenter.m_width) * presenter.m_height * sizeof(U32));
+        }
+        CopyX11Frame(presenter);
+        // The server reads the segment while it executes the request. Waiting for it to be processed keeps the next
+        // frame from tearing the one on screen, and paces the loop to what the server keeps up with.
+        XSync(presenter.m_pDisplay, False);
+    }
+}
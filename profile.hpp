@@ -0,0 +1,189 @@
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+
+#include <common.hpp>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace Engine
+{
+    // Zones are recorded into a buffer per thread that only its thread writes, so recording takes no locks. Buffers
+    // that fill up drop further zones. Without --profile a zone costs one load and a branch.
+    static constexpr U32 kMaxProfileThreads = 256;
+    static constexpr U32 kMaxProfileEvents = 1u << 18;
+
+    // The TSC on x86, the steady clock elsewhere. WriteProfile converts either against the steady clock.
+    inline U64 ReadProfileTicks()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return static_cast<U64>(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+    }
+
+    // A finished zone in ReadProfileTicks ticks.
+    struct ProfileEvent
+    {
+        const char *m_name;
+        U64 m_begin;
+        U64 m_end;
+    };
+
+    struct ProfileBuffer
+    {
+        // Published with a release store after each event, so the writer of the profile sees whole events.
+        U32 m_numEvents = 0;
+        U32 m_numDropped = 0;
+        ProfileEvent m_events[kMaxProfileEvents];
+    };
+
+    struct Profiler
+    {
+        bool m_isEnabled = false;
+        U64 m_startTicks = 0;
+        std::chrono::steady_clock::time_point m_start;
+        // Claimed by each thread on its first zone, the slot index is the thread's ID in the trace.
+        U32 m_numBuffers = 0;
+        ProfileBuffer *m_pBuffers[kMaxProfileThreads] = {};
+    };
+
+    inline Profiler gProfiler;
+    inline thread_local ProfileBuffer *tpProfileBuffer = nullptr;
+
+    inline void StartProfiler()
+    {
+        gProfiler.m_start = std::chrono::steady_clock::now();
+        gProfiler.m_startTicks = ReadProfileTicks();
+        __atomic_store_n(&gProfiler.m_isEnabled, true, __ATOMIC_RELEASE);
+    }
+
+    inline bool IsProfiling()
+    {
+        return __atomic_load_n(&gProfiler.m_isEnabled, __ATOMIC_RELAXED);
+    }
+
+    inline ProfileBuffer *ClaimProfileBuffer()
+    {
+        const U32 iBuffer = __atomic_fetch_add(&gProfiler.m_numBuffers, 1, __ATOMIC_RELAXED);
+        if (iBuffer >= kMaxProfileThreads)
+        {
+            return nullptr;
+        }
+        // The events are left uninitialized, pages are only touched as zones fill them.
+        ProfileBuffer *pBuffer = new ProfileBuffer;
+        __atomic_store_n(&gProfiler.m_pBuffers[iBuffer], pBuffer, __ATOMIC_RELEASE);
+        return pBuffer;
+    }
+
+    inline void RecordProfileEvent(const char *name, const U64 begin, const U64 end)
+    {
+        ProfileBuffer *pBuffer = tpProfileBuffer;
+        if (!pBuffer)
+        {
+            pBuffer = tpProfileBuffer = ClaimProfileBuffer();
+            if (!pBuffer)
+            {
+                return;
+            }
+        }
+        const U32 iEvent = pBuffer->m_numEvents;
+        if (iEvent == kMaxProfileEvents)
+        {
+            ++pBuffer->m_numDropped;
+            return;
+        }
+        pBuffer->m_events[iEvent] = ProfileEvent{name, begin, end};
+        __atomic_store_n(&pBuffer->m_numEvents, iEvent + 1, __ATOMIC_RELEASE);
+    }
+
+    // Times the enclosing scope. Zones nest, the trace viewer stacks the zones of a thread by time. name must be a
+    // string literal, it is written to the trace as is.
+    struct ProfileZone
+    {
+        const char *m_name;
+        // Zero when not profiling.
+        U64 m_begin;
+
+        explicit ProfileZone(const char *name) :
+            m_name{name}, m_begin{IsProfiling() ? ReadProfileTicks() : 0}
+        {
+        }
+
+        ~ProfileZone()
+        {
+            if (m_begin != 0)
+            {
+                RecordProfileEvent(m_name, m_begin, ReadProfileTicks());
+            }
+        }
+
+        ProfileZone(const ProfileZone &) = delete;
+        ProfileZone &operator=(const ProfileZone &) = delete;
+    };
+
+    // Writes every zone recorded so far as Chrome trace JSON, which chrome://tracing and ui.perfetto.dev open.
+    // Call it when no thread is recording, e.g. after the last frame.
+    inline bool WriteProfile(const char *path)
+    {
+        std::FILE *pFile = std::fopen(path, "w");
+        if (!pFile)
+        {
+            return false;
+        }
+        // The tick rate is measured over the whole profile against the steady clock.
+        const U64 ticks = ReadProfileTicks() - gProfiler.m_startTicks;
+        const F64 us = std::chrono::duration<F64, std::micro>(std::chrono::steady_clock::now() - gProfiler.m_start)
+                           .count();
+        const F64 usPerTick = us / static_cast<F64>(ticks > 0 ? ticks : 1);
+
+        std::fprintf(pFile, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+        std::fprintf(pFile, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,\"args\":{\"name\":\"Engine\"}}");
+        U64 numDropped = 0;
+        const U32 numBuffers = Min(__atomic_load_n(&gProfiler.m_numBuffers, __ATOMIC_RELAXED), kMaxProfileThreads);
+        for (U32 iBuffer = 0; iBuffer < numBuffers; ++iBuffer)
+        {
+            const ProfileBuffer *pBuffer = __atomic_load_n(&gProfiler.m_pBuffers[iBuffer], __ATOMIC_ACQUIRE);
+            if (!pBuffer)
+            {
+                continue;
+            }
+            std::fprintf(pFile, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%u,"
+                                "\"args\":{\"name\":\"Thread %u\"}}",
+                         iBuffer, iBuffer);
+            const U32 numEvents = __atomic_load_n(&pBuffer->m_numEvents, __ATOMIC_ACQUIRE);
+            for (U32 iEvent = 0; iEvent < numEvents; ++iEvent)
+            {
+                const ProfileEvent &event = pBuffer->m_events[iEvent];
+                std::fprintf(pFile, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                             event.m_name, iBuffer,
+                             static_cast<F64>(event.m_begin - gProfiler.m_startTicks) * usPerTick,
+                             static_cast<F64>(event.m_end - event.m_begin) * usPerTick);
+            }
+            numDropped += pBuffer->m_numDropped;
+        }
+        std::fprintf(pFile, "\n]}\n");
+        if (numDropped > 0)
+        {
+            std::fprintf(stderr, "Profile: %llu zones dropped after the buffers filled up\n",
+                         static_cast<unsigned long long>(numDropped));
+        }
+        return std::fclose(pFile) == 0;
+    }
+
+    // Frees the buffers. Threads that recorded must not record again afterwards.
+    inline void StopProfiler()
+    {
+        __atomic_store_n(&gProfiler.m_isEnabled, false, __ATOMIC_RELEASE);
+        const U32 numBuffers = Min(gProfiler.m_numBuffers, kMaxProfileThreads);
+        for (U32 iBuffer = 0; iBuffer < numBuffers; ++iBuffer)
+        {
+            delete gProfiler.m_pBuffers[iBuffer];
+            gProfiler.m_pBuffers[iBuffer] = nullptr;
+        }
+    }
+}
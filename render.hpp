@@ -0,0 +1,1356 @@
+#pragma once
+
+#include <cstdio>
+#include <cstring>
+
+#include <common.hpp>
+#include <format.hpp>
+#include <image.hpp>
+#include <memory.hpp>
+#include <mjpeg.hpp>
+#include <post.hpp>
+#include <profile.hpp>
+
+namespace Engine
+{
+    // Coordinate systems:
+    //
+    //  World: right-handed, +X forward,  +Y left, +Z up
+    // Camera: right-handed, +Z forward, +X right, +Y down
+    //    NDC: right-handed, +Z forward, +X right, +Y down, X,Y in [-1, 1], Z in [0, 1]
+
+    static constexpr U32 kDefaultWidth = 800;
+    static constexpr U32 kDefaultHeight = 600;
+    // Half resolution and YUV output need even frame dimensions, the post tiles a few rows and columns to work with.
+    static constexpr U32 kMinFrameSize = 16;
+    static constexpr U32 kMaxFrameWidth = 7680;
+    static constexpr U32 kMaxFrameHeight = 4320;
+    static constexpr U32 kMaxCubes = 1024;
+    // Most cameras rendered into one frame, e.g. a 4x4 grid of viewports.
+    static constexpr U32 kMaxViews = 16;
+    static constexpr F32 kFarDepth = 4096.0f;
+    // Weight of the current frame when blended into the temporal history.
+    static constexpr F32 kTemporalBlend = 0.1f;
+    // Foveated frames are sampled in square tiles, each traced with blocks of one size up to the tile size.
+    static constexpr U32 kFoveaTileSize = 8;
+    static constexpr U32 kMaxFoveaLevel = 3;
+    // Number of Halton points cycled through for the temporal jitter.
+    static constexpr U32 kTemporalJitterPhases = 16;
+
+    constexpr F32 kFovY = 80.0f * (3.14159265f / 180.0f);
+    constexpr F32 kTanHalfFov = Tan(kFovY * 0.5f);
+
+    // Frame dimensions as the per-pixel kernels see them. Common resolutions get kernels compiled for their exact
+    // size, so indexing, loop bounds and the ray setup fold into constants like they did when the window size was
+    // fixed at compile time. Any other size runs the generic kernels, which read it from the extent.
+    template<U32 kWidth, U32 kHeight>
+    struct FixedExtent
+    {
+        static_assert(kWidth % 2 == 0 && kHeight % 2 == 0, "Frame dimensions must be even");
+        // Room for one row of pixels.
+        static constexpr U32 kRowCapacity = kWidth;
+
+        static constexpr U32 Width() { return kWidth; }
+        static constexpr U32 Height() { return kHeight; }
+        static constexpr F32 Aspect() { return static_cast<F32>(kWidth) / static_cast<F32>(kHeight); }
+    };
+
+    struct DynamicExtent
+    {
+        static constexpr U32 kRowCapacity = kMaxFrameWidth;
+
+        U32 m_width;
+        U32 m_height;
+        F32 m_aspect;
+
+        U32 Width() const { return m_width; }
+        U32 Height() const { return m_height; }
+        F32 Aspect() const { return m_aspect; }
+    };
+
+    // Calls function with the extent kernels for a width x height frame are instantiated with.
+    template<typename Function>
+    void WithExtent(const U32 width, const U32 height, Function &&function)
+    {
+        if (width == 800 && height == 600)
+        {
+            function(FixedExtent<800, 600>{});
+        }
+        else if (width == 1280 && height == 720)
+        {
+            function(FixedExtent<1280, 720>{});
+        }
+        else if (width == 1920 && height == 1080)
+        {
+            function(FixedExtent<1920, 1080>{});
+        }
+        else if (width == 2560 && height == 1440)
+        {
+            function(FixedExtent<2560, 1440>{});
+        }
+        else if (width == 3840 && height == 2160)
+        {
+            function(FixedExtent<3840, 2160>{});
+        }
+        else
+        {
+            function(DynamicExtent{width, height, static_cast<F32>(width) / static_cast<F32>(height)});
+        }
+    }
+
+    enum class AntiAliasing : U8
+    {
+        kNone,
+        kFxaa,
+        // Re-trace only pixels on ID discontinuities with multiple subpixel rays.
+        kEdgeSupersample,
+        // Jitter the camera each frame and accumulate into a reprojected history.
+        kTemporal,
+    };
+
+    enum class Projection : U8
+    {
+        kPerspective,
+        // Parallel rays along the camera +Z, for technical and CAD style views.
+        kOrthographic,
+    };
+
+    // Layouts of the full sphere of directions around the camera.
+    enum class Panorama : U8
+    {
+        kNone,
+        // Six 90 degree faces in a 3x2 grid: +X, -X, +Y on top and -Y, +Z, -Z below, in camera axes.
+        kCubemap,
+        // Longitude across the frame from -180 to 180 degrees with forward in the middle, latitude down it.
+        kEquirectangular,
+    };
+
+    struct State
+    {
+        bool m_isRunning = true;
+        // Frame size in pixels, set with --size and followed when the window is resized.
+        U32 m_width = kDefaultWidth;
+        U32 m_height = kDefaultHeight;
+
+        AntiAliasing m_antiAliasing = AntiAliasing::kFxaa;
+        U32 m_numEdgeSamples = 8;
+        bool m_isHalfResolution = false;
+        // Write the window pixels with non-temporal stores.
+        bool m_isStreamingStores = true;
+        // Format of Targets::m_pOutput, converted per post tile. BGRA leaves the window pixels as the only output.
+        PixelFormat m_outputFormat = PixelFormat::kBgra32;
+        // File or pipe the converted frames are recorded to, nullptr when not recording.
+        const char *m_pRecordPath = nullptr;
+        // Export frames to other processes through the shared memory ring.
+        bool m_isSharingFrames = false;
+        // tcp:PORT or unix:PATH the frame server listens on, nullptr when not serving.
+        const char *m_pServeAddress = nullptr;
+        // Loopback port of the MJPEG endpoint, 0 when not serving.
+        U16 m_mjpegPort = 0;
+        // Chrome trace JSON the profile is written to on exit, nullptr when not profiling.
+        const char *m_pProfilePath = nullptr;
+        U32 m_jpegQuality = kJpegDefaultQuality;
+        // Format of the frames dumped with F12.
+        ImageFormat m_dumpFormat = ImageFormat::kPng;
+        Projection m_projection = Projection::kPerspective;
+        // World units visible across the frame height with the orthographic projection.
+        F32 m_orthoHeight = 8.0f;
+        // Grid of viewports the frame is split into, each showing the scene from another side.
+        U32 m_viewColumns = 1;
+        U32 m_viewRows = 1;
+        // Distance between the eyes of the side by side stereo pair in world units, 0 renders a single eye.
+        F32 m_eyeSeparation = 0.0f;
+        Panorama m_panorama = Panorama::kNone;
+        // Radius in pixels traced at full resolution around the focus point, 0 traces every pixel.
+        F32 m_foveaRadius = 0.0f;
+        // Focus point as a fraction of the frame size, supplied by a gaze tracker. The cursor is used without one.
+        bool m_hasGaze = false;
+        F32 m_gazeX = 0.5f;
+        F32 m_gazeY = 0.5f;
+        // Effects run after anti-aliasing, in order.
+        PostEffect m_postEffects[kMaxPostPasses - 2];
+        U32 m_numPostEffects = 0;
+
+        F32 m_camInWorldX;
+        F32 m_camInWorldY;
+        F32 m_camInWorldZ;
+        F32 m_camInWorldW;
+        F32 m_camInWorldE23;
+        F32 m_camInWorldE13;
+        F32 m_camInWorldE12;
+
+        U32 m_numCubes = 0;
+        alignas(F32x4) F32 m_cubeInWorldX[kMaxCubes];
+        alignas(F32x4) F32 m_cubeInWorldY[kMaxCubes];
+        alignas(F32x4) F32 m_cubeInWorldZ[kMaxCubes];
+        alignas(F32x4) F32 m_cubeInWorldW[kMaxCubes];
+        alignas(F32x4) F32 m_cubeInWorldE23[kMaxCubes];
+        alignas(F32x4) F32 m_cubeInWorldE13[kMaxCubes];
+        alignas(F32x4) F32 m_cubeInWorldE12[kMaxCubes];
+        alignas(F32x4) F32 m_cubeSize[kMaxCubes];
+    };
+
+    // Scene data derived once per frame and shared by every camera that renders it.
+    struct FrameScene
+    {
+        // Pose of the world in each cube, so rays move into cube space without inverting the cube pose per ray.
+        F32x4 m_worldToCubePos[kMaxCubes];
+        F32x4 m_worldToCubeOri[kMaxCubes];
+    };
+
+    // Per cube setup of the orthographic rays of a frame. They all share one direction, so only the origin depends on
+    // the pixel: it moves along the camera axes, which are rotated into each cube here instead of per pixel.
+    struct OrthoCube
+    {
+        // Origin of the ray through the image plane center, in cube space.
+        F32x4 m_originInCube;
+        F32x4 m_xInCube;
+        F32x4 m_yInCube;
+        F32x4 m_invDirInCube;
+        F32 m_halfSize;
+        // Face a ray enters through when the slab of that axis is the last one it enters.
+        U32 m_entryFaces[3];
+    };
+
+    struct Camera
+    {
+        Pose m_camInWorld{Vec3f{0.0f, 0.0f, 0.0f}, Quatf{1.0f, 0.0f, 0.0f, 0.0f}};
+        Projection m_projection = Projection::kPerspective;
+        // Half the height of the image plane. Perspective rays diverge as if from an eye at z = -1, which makes this
+        // tan(fovY / 2), orthographic ones are parallel and this is half the visible height in world units.
+        F32 m_halfHeight = kTanHalfFov;
+        const FrameScene *m_pScene = nullptr;
+        // Per cube setup of orthographic frames, nullptr for perspective ones.
+        const OrthoCube *m_pOrthoCubes = nullptr;
+    };
+
+    // Viewport of the frame a camera renders into.
+    struct View
+    {
+        Camera m_camera;
+        U32 m_x = 0;
+        U32 m_y = 0;
+        U32 m_width = 0;
+        U32 m_height = 0;
+    };
+
+    // Eyes of a stereo pair. They share an orientation and only sit apart along the camera X axis, so their rays
+    // through the same pixel are parallel and a cube is tested against both with one pose load and one inverse
+    // direction.
+    struct StereoRig
+    {
+        Camera m_left;
+        Camera m_right;
+        // Offset from the left eye to the right one in each cube.
+        F32x4 m_baselineInCube[kMaxCubes];
+    };
+
+    // Panoramas trace every direction from the one camera position, so the ray origin in each cube is shared by
+    // all pixels and faces of a frame.
+    struct PanoramaRig
+    {
+        Camera m_camera;
+        F32x4 m_originInCube[kMaxCubes];
+    };
+
+    // Intermediate render targets, resolved into the window pixels by the post passes. The frame sized buffers share
+    // one page allocation that is replaced when the resolution changes.
+    struct Targets
+    {
+        PageAllocation m_pages;
+        bool m_isHugePages = false;
+
+        U32 *m_pColor = nullptr;
+        FragmentId *m_pIds = nullptr;
+        F32 *m_pDepth = nullptr;
+
+        // Half resolution G-buffer, upscaled into the full resolution targets above.
+        FragmentId *m_pHalfIds = nullptr;
+        F32 *m_pHalfDepth = nullptr;
+
+        // Converted copy of the frame for encoders, sized for the widest converted format.
+        U8 *m_pOutput = nullptr;
+
+        // Temporal history in 8.8 fixed point per channel, ping-ponged between frames.
+        U16x4 *m_pHistory[2] = {};
+        U32 m_frameIndex = 0;
+        bool m_hasHistory = false;
+        Pose m_prevCamInWorld{Vec3f{0.0f, 0.0f, 0.0f}, Quatf{1.0f, 0.0f, 0.0f, 0.0f}};
+
+        FrameScene m_scene;
+        OrthoCube m_orthoCubes[kMaxViews][kMaxCubes];
+        StereoRig m_stereo;
+        PanoramaRig m_panorama;
+    };
+
+    // Reallocates the frame sized buffers for a width x height frame. Their contents are lost, history included.
+    inline bool ResizeTargets(Targets &targets, const U32 width, const U32 height)
+    {
+        const std::size_t numPixels = static_cast<std::size_t>(width) * height;
+        const std::size_t numHalfPixels = numPixels / 4;
+        std::size_t size = 0;
+        const auto reserve = [&size](const std::size_t bytes) {
+            const std::size_t offset = size;
+            size = AlignUp(size + bytes, 64);
+            return offset;
+        };
+        const std::size_t colorOffset = reserve(numPixels * sizeof(U32));
+        const std::size_t idsOffset = reserve(numPixels * sizeof(FragmentId));
+        const std::size_t depthOffset = reserve(numPixels * sizeof(F32));
+        const std::size_t halfIdsOffset = reserve(numHalfPixels * sizeof(FragmentId));
+        const std::size_t halfDepthOffset = reserve(numHalfPixels * sizeof(F32));
+        const std::size_t outputOffset = reserve(FrameImageSize(PixelFormat::kRgb24, width, height));
+        const std::size_t history0Offset = reserve(numPixels * sizeof(U16x4));
+        const std::size_t history1Offset = reserve(numPixels * sizeof(U16x4));
+
+        FreePages(targets.m_pages);
+        targets.m_pages = AllocatePages(size, targets.m_isHugePages);
+        U8 *pData = static_cast<U8 *>(targets.m_pages.m_pData);
+        if (!pData)
+        {
+            std::fprintf(stderr, "Failed to allocate %zu bytes for the render targets\n", size);
+            return false;
+        }
+        if (targets.m_isHugePages)
+        {
+            std::fprintf(stderr, "Render targets: %zu KB on %s\n", targets.m_pages.m_size / 1024,
+                         PageKindName(targets.m_pages.m_kind));
+        }
+        targets.m_pColor = reinterpret_cast<U32 *>(pData + colorOffset);
+        targets.m_pIds = reinterpret_cast<FragmentId *>(pData + idsOffset);
+        targets.m_pDepth = reinterpret_cast<F32 *>(pData + depthOffset);
+        targets.m_pHalfIds = reinterpret_cast<FragmentId *>(pData + halfIdsOffset);
+        targets.m_pHalfDepth = reinterpret_cast<F32 *>(pData + halfDepthOffset);
+        targets.m_pOutput = pData + outputOffset;
+        targets.m_pHistory[0] = reinterpret_cast<U16x4 *>(pData + history0Offset);
+        targets.m_pHistory[1] = reinterpret_cast<U16x4 *>(pData + history1Offset);
+        targets.m_hasHistory = false;
+        return true;
+    }
+
+    inline void UpdateFrameScene(const State &state, FrameScene &scene)
+    {
+        for (U32 iCube = 0; iCube < state.m_numCubes; ++iCube)
+        {
+            const Pose cubeInWorld(
+                Vec3f(
+                    state.m_cubeInWorldX[iCube],
+                    state.m_cubeInWorldY[iCube],
+                    state.m_cubeInWorldZ[iCube]
+                    ),
+                Quatf(
+                    state.m_cubeInWorldW[iCube],
+                    state.m_cubeInWorldE23[iCube],
+                    state.m_cubeInWorldE13[iCube],
+                    state.m_cubeInWorldE12[iCube]
+                    )
+                );
+            const Pose worldToCube = Inverse(cubeInWorld);
+            scene.m_worldToCubePos[iCube] = worldToCube.m_pos.m_v;
+            scene.m_worldToCubeOri[iCube] = worldToCube.m_ori.m_v;
+        }
+    }
+
+    inline Pose WorldToCube(const FrameScene &scene, const U32 iCube)
+    {
+        return Pose{Vec3f(scene.m_worldToCubePos[iCube]), Quatf(scene.m_worldToCubeOri[iCube])};
+    }
+
+    // Appends a cube of the given edge length, false when the scene is full.
+    inline bool AddCube(State &state, const Pose &cubeInWorld, const F32 size)
+    {
+        if (state.m_numCubes == kMaxCubes)
+        {
+            return false;
+        }
+        const U32 iCube = state.m_numCubes++;
+        state.m_cubeInWorldX[iCube] = cubeInWorld.m_pos[0];
+        state.m_cubeInWorldY[iCube] = cubeInWorld.m_pos[1];
+        state.m_cubeInWorldZ[iCube] = cubeInWorld.m_pos[2];
+        state.m_cubeInWorldW[iCube] = cubeInWorld.m_ori[0];
+        state.m_cubeInWorldE23[iCube] = cubeInWorld.m_ori[1];
+        state.m_cubeInWorldE13[iCube] = cubeInWorld.m_ori[2];
+        state.m_cubeInWorldE12[iCube] = cubeInWorld.m_ori[3];
+        state.m_cubeSize[iCube] = size;
+        return true;
+    }
+
+    inline void SetCameraInWorld(State &state, const Pose &camInWorld)
+    {
+        state.m_camInWorldX = camInWorld.m_pos[0];
+        state.m_camInWorldY = camInWorld.m_pos[1];
+        state.m_camInWorldZ = camInWorld.m_pos[2];
+        state.m_camInWorldW = camInWorld.m_ori[0];
+        state.m_camInWorldE23 = camInWorld.m_ori[1];
+        state.m_camInWorldE13 = camInWorld.m_ori[2];
+        state.m_camInWorldE12 = camInWorld.m_ori[3];
+    }
+
+    inline Pose CameraInWorld(const State &state)
+    {
+        return Pose(
+            Vec3f(
+                state.m_camInWorldX,
+                state.m_camInWorldY,
+                state.m_camInWorldZ
+                ),
+            Quatf(
+                state.m_camInWorldW,
+                state.m_camInWorldE23,
+                state.m_camInWorldE13,
+                state.m_camInWorldE12
+                )
+            );
+    }
+
+    // Builds a camera at camInWorld for the current frame. Orthographic setup is written to pOrthoCubes, one entry
+    // per cube.
+    inline Camera MakeCamera(const State &state, const FrameScene &scene, const Pose &camInWorld,
+                             OrthoCube *pOrthoCubes)
+    {
+        if (state.m_projection == Projection::kPerspective)
+        {
+            return Camera{camInWorld, Projection::kPerspective, kTanHalfFov, &scene, nullptr};
+        }
+
+        const Vec3f xInWorld = Rotate(camInWorld.m_ori, Vec3f(1.0f, 0.0f, 0.0f));
+        const Vec3f yInWorld = Rotate(camInWorld.m_ori, Vec3f(0.0f, 1.0f, 0.0f));
+        const Vec3f dirInWorld = Rotate(camInWorld.m_ori, Vec3f(0.0f, 0.0f, 1.0f));
+        for (U32 iCube = 0; iCube < state.m_numCubes; ++iCube)
+        {
+            const Pose worldToCube = WorldToCube(scene, iCube);
+            const Vec3f dirInCube = Rotate(worldToCube.m_ori, dirInWorld);
+            OrthoCube &cube = pOrthoCubes[iCube];
+            cube.m_originInCube = Transform(worldToCube, camInWorld.m_pos).m_v;
+            cube.m_xInCube = Rotate(worldToCube.m_ori, xInWorld).m_v;
+            cube.m_yInCube = Rotate(worldToCube.m_ori, yInWorld).m_v;
+            // Axis parallel directions divide to infinities, which the slab test below handles like the general one.
+            cube.m_invDirInCube = 1.0f / dirInCube.m_v;
+            cube.m_halfSize = state.m_cubeSize[iCube] * 0.5f;
+            for (U32 iAxis = 0; iAxis < 3; ++iAxis)
+            {
+                cube.m_entryFaces[iAxis] = iAxis * 2 + (dirInCube[iAxis] < 0.0f);
+            }
+        }
+        return Camera{camInWorld, Projection::kOrthographic, state.m_orthoHeight * 0.5f, &scene, pOrthoCubes};
+    }
+
+    // Places the eyes eyeSeparation apart around camInWorld, looking the same way.
+    inline void MakeStereoRig(const State &state, const FrameScene &scene, const Pose &camInWorld, StereoRig &rig)
+    {
+        const F32 halfSeparation = state.m_eyeSeparation * 0.5f;
+        const Pose leftInCam(Vec3f(-halfSeparation, 0.0f, 0.0f), Quatf(1.0f, 0.0f, 0.0f, 0.0f));
+        const Pose rightInCam(Vec3f(halfSeparation, 0.0f, 0.0f), Quatf(1.0f, 0.0f, 0.0f, 0.0f));
+        rig.m_left = MakeCamera(state, scene, Transform(camInWorld, leftInCam), nullptr);
+        rig.m_right = MakeCamera(state, scene, Transform(camInWorld, rightInCam), nullptr);
+        const Vec3f baselineInWorld = Rotate(camInWorld.m_ori, Vec3f(state.m_eyeSeparation, 0.0f, 0.0f));
+        for (U32 iCube = 0; iCube < state.m_numCubes; ++iCube)
+        {
+            rig.m_baselineInCube[iCube] = Rotate(WorldToCube(scene, iCube).m_ori, baselineInWorld).m_v;
+        }
+    }
+
+    inline void MakePanoramaRig(const State &state, const FrameScene &scene, const Pose &camInWorld, PanoramaRig &rig)
+    {
+        rig.m_camera = MakeCamera(state, scene, camInWorld, nullptr);
+        for (U32 iCube = 0; iCube < state.m_numCubes; ++iCube)
+        {
+            rig.m_originInCube[iCube] = Transform(WorldToCube(scene, iCube), camInWorld.m_pos).m_v;
+        }
+    }
+
+    template<typename Extent>
+    Vec3f WindowToCamera(const Extent extent, const Camera &camera, const U32 x, const U32 y, const F32 subX = 0.5f,
+                         const F32 subY = 0.5f)
+    {
+        const F32 xInNdc = 2.0f * (static_cast<F32>(x) + subX) / static_cast<F32>(extent.Width()) - 1.0f;
+        const F32 yInNdc = 1.0f - 2.0f * (static_cast<F32>(y) + subY) / static_cast<F32>(extent.Height());
+        const F32 xInCam = xInNdc * extent.Aspect() * camera.m_halfHeight;
+        const F32 yInCam = yInNdc * camera.m_halfHeight;
+        return Vec3f(xInCam, yInCam, 0.0f);
+    }
+
+    struct Fragment
+    {
+        FragmentId m_id;
+        // Distance along the ray, which is also the camera space depth since ray directions have z = 1.
+        F32 m_depth;
+    };
+
+    // Rays start on the image plane at z = 0 and either diverge as if from an eye at z = -1 or run parallel to +Z.
+    template<typename Extent>
+    Vec2f CameraToWindow(const Extent extent, const Camera &camera, const Vec3f pointInCamera)
+    {
+        const F32 invZ = camera.m_projection == Projection::kPerspective ? 1.0f / (pointInCamera[2] + 1.0f) : 1.0f;
+        const F32 xInNdc = pointInCamera[0] * invZ / (extent.Aspect() * camera.m_halfHeight);
+        const F32 yInNdc = pointInCamera[1] * invZ / camera.m_halfHeight;
+        return Vec2f(
+            (xInNdc + 1.0f) * 0.5f * static_cast<F32>(extent.Width()),
+            (1.0f - yInNdc) * 0.5f * static_cast<F32>(extent.Height())
+            );
+    }
+
+    // Point at depth along the ray that starts at pixelInCamera.
+    inline Vec3f RayPoint(const Camera &camera, const Vec3f pixelInCamera, const F32 depth)
+    {
+        if (camera.m_projection == Projection::kOrthographic)
+        {
+            return Vec3f(pixelInCamera[0], pixelInCamera[1], depth);
+        }
+        return Vec3f(pixelInCamera[0] * (1.0f + depth), pixelInCamera[1] * (1.0f + depth), depth);
+    }
+
+#if defined(ENGINE_TRACE_STATS)
+    // Work done by the ray kernels of one thread. Only benchmark builds count it, the engine compiles it away.
+    struct TraceStats
+    {
+        U64 m_numRays = 0;
+        U64 m_numCubeTests = 0;
+    };
+
+    inline thread_local TraceStats tTraceStats;
+
+    // Sums and resets the counters of the OpenMP workers, every thread of the team runs the region once.
+    inline TraceStats TakeTraceStats()
+    {
+        TraceStats total;
+#pragma omp parallel
+        {
+            __atomic_fetch_add(&total.m_numRays, tTraceStats.m_numRays, __ATOMIC_RELAXED);
+            __atomic_fetch_add(&total.m_numCubeTests, tTraceStats.m_numCubeTests, __ATOMIC_RELAXED);
+            tTraceStats = TraceStats{};
+        }
+        return total;
+    }
+#endif
+
+    inline void CountTraceWork([[maybe_unused]] const U32 numRays, [[maybe_unused]] const U32 numCubeTests)
+    {
+#if defined(ENGINE_TRACE_STATS)
+        tTraceStats.m_numRays += numRays;
+        tTraceStats.m_numCubeTests += numCubeTests;
+#endif
+    }
+
+    // Slab test of a ray against the cube of the given half size around the origin of cube space, all axes at once.
+    // Fills fragment when the ray hits, entryFaces holds the face a ray enters through on each axis.
+    inline bool IntersectCube(const F32x4 pointInCube, const F32x4 invDirInCube, const F32 halfSize,
+                              const U32 *entryFaces, const U32 iCube, Fragment &fragment)
+    {
+        const F32x4 t1 = (-halfSize - pointInCube) * invDirInCube;
+        const F32x4 t2 = (halfSize - pointInCube) * invDirInCube;
+        const F32x4 tMin = Min(t1, t2);
+        const F32x4 tMax = Max(t1, t2);
+        F32 tNear = 0.0f;
+        U32 hitFace = 0;
+        for (U32 iAxis = 0; iAxis < 3; ++iAxis)
+        {
+            if (tMin[iAxis] > tNear)
+            {
+                tNear = tMin[iAxis];
+                hitFace = entryFaces[iAxis];
+            }
+        }
+        const F32 tFar = Min(Min(kFarDepth, tMax[0]), Min(tMax[1], tMax[2]));
+        if (tNear < tFar)
+        {
+            fragment = Fragment{MakeFragmentId(iCube, hitFace), tNear};
+            return true;
+        }
+        return false;
+    }
+
+    // Same slab test as TraceFragment on the per frame setup, which leaves two multiply-adds for the ray origin and
+    // a vector slab test per cube.
+    inline Fragment TraceOrthoFragment(const Vec3f pixelInCamera, const U32 numCubes, const OrthoCube *pCubes)
+    {
+        const F32 xInCam = pixelInCamera[0];
+        const F32 yInCam = pixelInCamera[1];
+        for (U32 iCube = 0; iCube < numCubes; ++iCube)
+        {
+            const OrthoCube &cube = pCubes[iCube];
+            const F32x4 pointInCube = cube.m_originInCube + xInCam * cube.m_xInCube + yInCam * cube.m_yInCube;
+            Fragment fragment;
+            if (IntersectCube(pointInCube, cube.m_invDirInCube, cube.m_halfSize, cube.m_entryFaces, iCube, fragment))
+            {
+                CountTraceWork(1, iCube + 1);
+                return fragment;
+            }
+        }
+
+        CountTraceWork(1, numCubes);
+        return Fragment{kMissId, kFarDepth};
+    }
+
+    inline Fragment TraceFragment(const Vec3f pixelInCamera, const State &state, const Camera &camera)
+    {
+        if (camera.m_pOrthoCubes)
+        {
+            return TraceOrthoFragment(pixelInCamera, state.m_numCubes, camera.m_pOrthoCubes);
+        }
+
+        const Pose &cameraToWorld = camera.m_camInWorld;
+        const Vec3f pixelInWorld = Transform(cameraToWorld, pixelInCamera);
+        const Vec3f pixelDirInWorld = Rotate(cameraToWorld.m_ori, Vec3f(pixelInCamera[0], pixelInCamera[1], 1.0f));
+
+        for (U32 iCube = 0; iCube < state.m_numCubes; ++iCube)
+        {
+            const Pose worldToCube = WorldToCube(*camera.m_pScene, iCube);
+            const Vec3f pointInCube = Transform(worldToCube, pixelInWorld);
+            const Vec3f pixelDirInCube = Rotate(worldToCube.m_ori, pixelDirInWorld);
+            const F32 hs = state.m_cubeSize[iCube] * 0.5f;
+            const Vec3f minInCube(-hs, -hs, -hs);
+            const Vec3f maxInCube(hs, hs, hs);
+            F32 tNear = 0.0f;
+            F32 tFar = kFarDepth;
+            U32 hitFace = 0;
+            for (U32 iAxis = 0; iAxis < 3; ++iAxis)
+            {
+                // TODO: Handle divide by zero...
+                const F32 t1 = (minInCube[iAxis] - pointInCube[iAxis]) / pixelDirInCube[iAxis];
+                const F32 t2 = (maxInCube[iAxis] - pointInCube[iAxis]) / pixelDirInCube[iAxis];
+                const F32 tMin = Min(t1, t2);
+                const F32 tMax = Max(t1, t2);
+                if (tMin > tNear)
+                {
+                    tNear = tMin;
+                    hitFace = iAxis * 2 + (pixelDirInCube[iAxis] < 0.0f);
+                }
+                if (tMax < tFar)
+                {
+                    tFar = tMax;
+                }
+                if (tNear > tFar)
+                {
+                    break;
+                }
+            }
+
+            if (tNear < tFar)
+            {
+                CountTraceWork(1, iCube + 1);
+                return Fragment{MakeFragmentId(iCube, hitFace), tNear};
+            }
+        }
+
+        CountTraceWork(1, state.m_numCubes);
+        return Fragment{kMissId, kFarDepth};
+    }
+
+    // Forward, right and down axes of the cubemap faces in camera space, in the order they are laid out.
+    constexpr F32 kCubemapAxes[6][3][3] = {
+        {{1.0f, 0.0f, 0.0f}, {0.0f, 0.0f, -1.0f}, {0.0f, 1.0f, 0.0f}},
+        {{-1.0f, 0.0f, 0.0f}, {0.0f, 0.0f, 1.0f}, {0.0f, 1.0f, 0.0f}},
+        {{0.0f, 1.0f, 0.0f}, {1.0f, 0.0f, 0.0f}, {0.0f, 0.0f, -1.0f}},
+        {{0.0f, -1.0f, 0.0f}, {1.0f, 0.0f, 0.0f}, {0.0f, 0.0f, 1.0f}},
+        {{0.0f, 0.0f, 1.0f}, {1.0f, 0.0f, 0.0f}, {0.0f, 1.0f, 0.0f}},
+        {{0.0f, 0.0f, -1.0f}, {-1.0f, 0.0f, 0.0f}, {0.0f, 1.0f, 0.0f}},
+    };
+
+    // Unit direction in camera space through pixel (x, y) of a cubemap face faceSize pixels wide.
+    inline Vec3f CubemapToCamera(const U32 iFace, const U32 faceSize, const U32 x, const U32 y)
+    {
+        const F32 u = 2.0f * (static_cast<F32>(x) + 0.5f) / static_cast<F32>(faceSize) - 1.0f;
+        const F32 v = 2.0f * (static_cast<F32>(y) + 0.5f) / static_cast<F32>(faceSize) - 1.0f;
+        const F32(*axes)[3] = kCubemapAxes[iFace];
+        return Normalize(Vec3f(axes[0][0], axes[0][1], axes[0][2]) + u * Vec3f(axes[1][0], axes[1][1], axes[1][2]) +
+                         v * Vec3f(axes[2][0], axes[2][1], axes[2][2]));
+    }
+
+    // Unit direction in camera space through pixel (x, y) of a width x height equirectangular frame.
+    inline Vec3f EquirectangularToCamera(const U32 width, const U32 height, const U32 x, const U32 y)
+    {
+        const F32 longitude = kTau * (static_cast<F32>(x) + 0.5f) / static_cast<F32>(width) - kPi;
+        const F32 latitude = kHalfPi - kPi * (static_cast<F32>(y) + 0.5f) / static_cast<F32>(height);
+        const F32 cosLatitude = Cos(latitude);
+        // Camera +Y points down, so up is -Y.
+        return Vec3f(cosLatitude * Sin(longitude), -Sin(latitude), cosLatitude * Cos(longitude));
+    }
+
+    // Traces a unit direction from the panorama origin. The depth is the distance to the hit.
+    inline Fragment TracePanoramaFragment(const Vec3f dirInCamera, const State &state, const PanoramaRig &rig)
+    {
+        const FrameScene &scene = *rig.m_camera.m_pScene;
+        const Vec3f dirInWorld = Rotate(rig.m_camera.m_camInWorld.m_ori, dirInCamera);
+        for (U32 iCube = 0; iCube < state.m_numCubes; ++iCube)
+        {
+            const Vec3f dirInCube = Rotate(Quatf(scene.m_worldToCubeOri[iCube]), dirInWorld);
+            const U32 entryFaces[3] = {
+                0u + (dirInCube[0] < 0.0f),
+                2u + (dirInCube[1] < 0.0f),
+                4u + (dirInCube[2] < 0.0f),
+            };
+            Fragment fragment;
+            if (IntersectCube(rig.m_originInCube[iCube], 1.0f / dirInCube.m_v, state.m_cubeSize[iCube] * 0.5f,
+                              entryFaces, iCube, fragment))
+            {
+                CountTraceWork(1, iCube + 1);
+                return fragment;
+            }
+        }
+        CountTraceWork(1, state.m_numCubes);
+        return Fragment{kMissId, kFarDepth};
+    }
+
+    struct StereoFragments
+    {
+        Fragment m_left;
+        Fragment m_right;
+    };
+
+    // Traces the same pixel for both eyes in one pass over the cubes, which stops once both rays hit.
+    inline StereoFragments TraceStereoFragments(const Vec3f pixelInCamera, const State &state, const StereoRig &rig)
+    {
+        const Pose &leftInWorld = rig.m_left.m_camInWorld;
+        const FrameScene &scene = *rig.m_left.m_pScene;
+        const Vec3f pixelInWorld = Transform(leftInWorld, pixelInCamera);
+        const Vec3f pixelDirInWorld = Rotate(leftInWorld.m_ori, Vec3f(pixelInCamera[0], pixelInCamera[1], 1.0f));
+
+        StereoFragments fragments{Fragment{kMissId, kFarDepth}, Fragment{kMissId, kFarDepth}};
+        bool isLeftHit = false;
+        bool isRightHit = false;
+        U32 numCubeTests = 0;
+        for (U32 iCube = 0; iCube < state.m_numCubes && !(isLeftHit && isRightHit); ++iCube)
+        {
+            numCubeTests += !isLeftHit + !isRightHit;
+            const Pose worldToCube = WorldToCube(scene, iCube);
+            const F32x4 leftInCube = Transform(worldToCube, pixelInWorld).m_v;
+            const Vec3f pixelDirInCube = Rotate(worldToCube.m_ori, pixelDirInWorld);
+            const F32x4 invDirInCube = 1.0f / pixelDirInCube.m_v;
+            const U32 entryFaces[3] = {
+                0u + (pixelDirInCube[0] < 0.0f),
+                2u + (pixelDirInCube[1] < 0.0f),
+                4u + (pixelDirInCube[2] < 0.0f),
+            };
+            const F32 hs = state.m_cubeSize[iCube] * 0.5f;
+            if (!isLeftHit)
+            {
+                isLeftHit = IntersectCube(leftInCube, invDirInCube, hs, entryFaces, iCube, fragments.m_left);
+            }
+            if (!isRightHit)
+            {
+                isRightHit = IntersectCube(leftInCube + rig.m_baselineInCube[iCube], invDirInCube, hs, entryFaces,
+                                           iCube, fragments.m_right);
+            }
+        }
+        CountTraceWork(2, numCubeTests);
+        return fragments;
+    }
+
+    inline U32 ShadeFragment(const FragmentId id)
+    {
+        constexpr U32 kBackground = 0xFF111111;
+        constexpr U32 kFaceColors[] = {
+            0xFFFF0000, // X+ (red)
+            0xFF880000, // X- (dark red)
+            0xFF00FF00, // Y+ (green)
+            0xFF008800, // Y- (dark green)
+            0xFF0000FF, // Z+ (blue)
+            0xFF000088, // Z- (dark blue)
+        };
+        return id == kMissId ? kBackground : kFaceColors[FragmentFace(id)];
+    }
+
+    // Standard D3D multisample positions in 1/16 pixel units around the pixel center.
+    constexpr I8 kSamplePattern4[][2] = {{-2, -6}, {6, -2}, {-6, 2}, {2, 6}};
+    constexpr I8 kSamplePattern8[][2] = {
+        {1, -3}, {-1, 3}, {5, 1}, {-3, -5}, {-5, 5}, {-7, -1}, {3, 7}, {7, -7},
+    };
+    constexpr I8 kSamplePattern16[][2] = {
+        {1, 1}, {-1, -3}, {-3, 2}, {4, -1}, {-5, -2}, {2, 5}, {5, 3}, {3, -5},
+        {-2, 6}, {0, -7}, {-4, -6}, {-6, 4}, {-8, 0}, {7, -4}, {6, 7}, {-7, -8},
+    };
+
+    template<typename Extent>
+    U32 SupersampleFragment(const Extent extent, const U32 x, const U32 y, const U32 numSamples, const State &state,
+                            const Camera &camera)
+    {
+        const I8(*pPattern)[2] = numSamples == 16  ? kSamplePattern16
+                                 : numSamples == 8 ? kSamplePattern8
+                                                   : kSamplePattern4;
+        U32x4 sum = {};
+        for (U32 iSample = 0; iSample < numSamples; ++iSample)
+        {
+            const F32 subX = 0.5f + static_cast<F32>(pPattern[iSample][0]) * (1.0f / 16.0f);
+            const F32 subY = 0.5f + static_cast<F32>(pPattern[iSample][1]) * (1.0f / 16.0f);
+            const Vec3f pixelInCamera = WindowToCamera(extent, camera, x, y, subX, subY);
+            sum += UnpackColor(ShadeFragment(TraceFragment(pixelInCamera, state, camera).m_id));
+        }
+        return PackColor((sum + numSamples / 2) / numSamples);
+    }
+
+    // Edge pixels are a few percent of the frame, so re-tracing only those gets close to full supersampling quality
+    // at a fraction of the cost. Colors are replaced in place, the IDs of the center samples are left untouched.
+    template<typename Extent>
+    void SupersampleEdges(const Extent extent, const State &state, const Camera &camera, const FragmentId *pIds,
+                          U32 *pColor)
+    {
+        const ProfileZone zone("SupersampleEdges");
+        const U32 width = extent.Width();
+        const U32 height = extent.Height();
+#pragma omp parallel for
+        for (U32 y = 0; y < height; ++y)
+        {
+            ForEachEdgePixel(pIds, width, height, y, 0, width, [&](const U32 x) {
+                pColor[y * width + x] = SupersampleFragment(extent, x, y, state.m_numEdgeSamples, state,
+                                                            camera);
+            });
+        }
+    }
+
+    template<typename Extent>
+    F32x4 LoadHistory(const Extent extent, const U16x4 *pHistory, const U32 x, const U32 y)
+    {
+        return __builtin_convertvector(pHistory[y * extent.Width() + x], F32x4) * (1.0f / 256.0f);
+    }
+
+    template<typename Extent>
+    F32x4 SampleHistory(const Extent extent, const U16x4 *pHistory, const F32 x, const F32 y)
+    {
+        const U32 x0 = static_cast<U32>(x);
+        const U32 y0 = static_cast<U32>(y);
+        const U32 x1 = x0 + 1 < extent.Width() ? x0 + 1 : x0;
+        const U32 y1 = y0 + 1 < extent.Height() ? y0 + 1 : y0;
+        const F32 fx = x - static_cast<F32>(x0);
+        const F32 fy = y - static_cast<F32>(y0);
+        const F32x4 top = LoadHistory(extent, pHistory, x0, y0) * (1.0f - fx) +
+                          LoadHistory(extent, pHistory, x1, y0) * fx;
+        const F32x4 bottom = LoadHistory(extent, pHistory, x0, y1) * (1.0f - fx) +
+                             LoadHistory(extent, pHistory, x1, y1) * fx;
+        return top * (1.0f - fy) + bottom * fy;
+    }
+
+    template<typename Extent>
+    struct TemporalContext
+    {
+        Extent m_extent;
+        Camera m_camera;
+        const F32 *m_pDepth;
+        const U16x4 *m_pPrevHistory;
+        U16x4 *m_pHistory;
+        Pose m_camToPrevCam;
+        bool m_hasHistory;
+    };
+
+    // Reprojects every pixel into the previous frame through its depth and the camera motion, clamps the history
+    // to the current 3x3 neighborhood to reject stale colors and blends the jittered frame in.
+    // Runs as the first post pass so the resolve shares the tile round trip with the other effects.
+    template<typename Extent>
+    void RunTemporalPass(const PostPassArgs &args)
+    {
+        const TemporalContext<Extent> &context = *static_cast<const TemporalContext<Extent> *>(args.m_pContext);
+        const Extent extent = context.m_extent;
+        const PostTile &src = args.m_src;
+        for (I32 y = args.m_region.m_y0; y < args.m_region.m_y1; ++y)
+        {
+            for (I32 x = args.m_region.m_x0; x < args.m_region.m_x1; ++x)
+            {
+                const U32 i = static_cast<U32>(y) * extent.Width() + static_cast<U32>(x);
+                const U32 center = src.m_pColor[src.Index(x, y)];
+                const F32x4 current = __builtin_convertvector(UnpackColor(center), F32x4);
+
+                // Per channel bounds of the 3x3 neighborhood, taken on the packed bytes.
+                U8x4 loBytes;
+                __builtin_memcpy(&loBytes, &center, sizeof(loBytes));
+                U8x4 hiBytes = loBytes;
+                for (I32 ny = y - 1; ny <= y + 1; ++ny)
+                {
+                    for (I32 nx = x - 1; nx <= x + 1; ++nx)
+                    {
+                        U8x4 c;
+                        __builtin_memcpy(&c, &src.m_pColor[src.Index(nx, ny)], sizeof(c));
+                        loBytes = c < loBytes ? c : loBytes;
+                        hiBytes = c > hiBytes ? c : hiBytes;
+                    }
+                }
+                const F32x4 lo = __builtin_convertvector(loBytes, F32x4);
+                const F32x4 hi = __builtin_convertvector(hiBytes, F32x4);
+
+                F32x4 result = current;
+                if (context.m_hasHistory)
+                {
+                    // Reproject the pixel center, only the current sample carries the jitter. Reprojecting the
+                    // jittered position would resample the history at a different sub-pixel offset every frame and
+                    // blur it a little more each time.
+                    const Camera &camera = context.m_camera;
+                    const Vec3f pixelInCamera = WindowToCamera(extent, camera, static_cast<U32>(x),
+                                                               static_cast<U32>(y));
+                    const Vec3f pointInCamera = RayPoint(camera, pixelInCamera, context.m_pDepth[i]);
+                    const Vec3f pointInPrevCam = Transform(context.m_camToPrevCam, pointInCamera);
+                    const Vec2f prevInWindow = CameraToWindow(extent, camera, pointInPrevCam);
+                    const F32 px = prevInWindow[0] - 0.5f;
+                    const F32 py = prevInWindow[1] - 0.5f;
+                    const bool isInFront = camera.m_projection == Projection::kOrthographic ||
+                                           pointInPrevCam[2] > -1.0f;
+                    const bool isOnScreen = isInFront && px >= 0.0f && py >= 0.0f &&
+                                            px <= static_cast<F32>(extent.Width() - 1) &&
+                                            py <= static_cast<F32>(extent.Height() - 1);
+                    if (isOnScreen)
+                    {
+                        const F32x4 history = Min(Max(SampleHistory(extent, context.m_pPrevHistory, px, py), lo), hi);
+                        result = history + (current - history) * kTemporalBlend;
+                    }
+                }
+
+                const bool isInTile = x >= args.m_tile.m_x0 && x < args.m_tile.m_x1 && y >= args.m_tile.m_y0 &&
+                                      y < args.m_tile.m_y1;
+                if (isInTile)
+                {
+                    context.m_pHistory[i] = __builtin_convertvector(result * 256.0f + 0.5f, U16x4);
+                }
+                args.m_dst.m_pColor[args.m_dst.Index(x, y)] = PackColor(__builtin_convertvector(result + 0.5f, U32x4));
+            }
+        }
+    }
+
+    // Traces one full resolution pixel into the ID and depth targets and returns its color.
+    template<typename Extent>
+    U32 TracePixel(const Extent extent, const U32 x, const U32 y, const Vec2f jitter, const State &state,
+                   const Camera &camera, Targets &targets)
+    {
+        const Vec3f pixelInCamera = WindowToCamera(extent, camera, x, y, jitter[0], jitter[1]);
+        const Fragment fragment = TraceFragment(pixelInCamera, state, camera);
+        targets.m_pIds[y * extent.Width() + x] = fragment.m_id;
+        targets.m_pDepth[y * extent.Width() + x] = fragment.m_depth;
+        return ShadeFragment(fragment.m_id);
+    }
+
+    // Fills the 2x2 full resolution pixels that lie between the centers of G-buffer samples (i, j) and (i + 1, j + 1).
+    // Faces are flat shaded so a quad that saw a single ID is filled exactly with no filtering,
+    // while a quad straddling an edge is traced at full resolution so cube silhouettes stay sharp.
+    template<typename Extent>
+    void UpscaleQuad(const Extent extent, const U32 i, const U32 j, const bool isUniform, const Vec2f jitter,
+                     const State &state, const Camera &camera, Targets &targets, U32 *pColor)
+    {
+        const U32 width = extent.Width();
+        const U32 halfWidth = width / 2;
+        const U32 x0 = 2 * i + 1;
+        const U32 y0 = 2 * j + 1;
+        if (!isUniform)
+        {
+            for (U32 y = y0; y < y0 + 2; ++y)
+            {
+                for (U32 x = x0; x < x0 + 2; ++x)
+                {
+                    pColor[y * width + x] = TracePixel(extent, x, y, jitter, state, camera, targets);
+                }
+            }
+            return;
+        }
+
+        const FragmentId id = targets.m_pHalfIds[j * halfWidth + i];
+        const U32 color = ShadeFragment(id);
+        const F32 *pDepth = targets.m_pHalfDepth + j * halfWidth + i;
+        for (U32 dy = 0; dy < 2; ++dy)
+        {
+            // Full resolution pixel centers sit a quarter and three quarters of the way between samples.
+            const F32 fy = dy == 0 ? 0.25f : 0.75f;
+            const F32 left = pDepth[0] + (pDepth[halfWidth] - pDepth[0]) * fy;
+            const F32 right = pDepth[1] + (pDepth[halfWidth + 1] - pDepth[1]) * fy;
+            for (U32 dx = 0; dx < 2; ++dx)
+            {
+                const F32 fx = dx == 0 ? 0.25f : 0.75f;
+                const U32 iPixel = (y0 + dy) * width + x0 + dx;
+                targets.m_pIds[iPixel] = id;
+                targets.m_pDepth[iPixel] = left + (right - left) * fx;
+                pColor[iPixel] = color;
+            }
+        }
+    }
+
+    // Traces primary visibility at half resolution into the G-buffer and upscales into the full resolution targets.
+    template<typename Extent>
+    void RenderHalfResolution(const Extent extent, const Vec2f jitter, const State &state, const Camera &camera,
+                              Targets &targets, U32 *pColor)
+    {
+        const ProfileZone zone("RenderHalfResolution");
+        const U32 width = extent.Width();
+        const U32 height = extent.Height();
+        const U32 halfWidth = width / 2;
+        const U32 halfHeight = height / 2;
+        // Each G-buffer sample is traced at the shared corner of its 2x2 block of full resolution pixels.
+#pragma omp parallel for
+        for (U32 j = 0; j < halfHeight; ++j)
+        {
+            for (U32 i = 0; i < halfWidth; ++i)
+            {
+                const Vec3f pixelInCamera = WindowToCamera(extent, camera, 2 * i, 2 * j, jitter[0] + 0.5f,
+                                                           jitter[1] + 0.5f);
+                const Fragment fragment = TraceFragment(pixelInCamera, state, camera);
+                targets.m_pHalfIds[j * halfWidth + i] = fragment.m_id;
+                targets.m_pHalfDepth[j * halfWidth + i] = fragment.m_depth;
+            }
+        }
+
+#pragma omp parallel for
+        for (U32 j = 0; j < halfHeight - 1; ++j)
+        {
+            const FragmentId *pTop = targets.m_pHalfIds + j * halfWidth;
+            const FragmentId *pBottom = pTop + halfWidth;
+            U32 i = 0;
+            // Test eight quads at a time for a single ID across their four samples.
+            for (; i + 9 <= halfWidth; i += 8)
+            {
+                const U16x8 topLeft = LoadU16x8(pTop + i);
+                const U16x8 isUniform = (topLeft == LoadU16x8(pTop + i + 1)) & (topLeft == LoadU16x8(pBottom + i)) &
+                                        (topLeft == LoadU16x8(pBottom + i + 1));
+                for (U32 lane = 0; lane < 8; ++lane)
+                {
+                    UpscaleQuad(extent, i + lane, j, isUniform[lane] != 0, jitter, state, camera, targets,
+                                pColor);
+                }
+            }
+            for (; i + 1 < halfWidth; ++i)
+            {
+                const bool isUniform = pTop[i] == pTop[i + 1] && pTop[i] == pBottom[i] && pTop[i] == pBottom[i + 1];
+                UpscaleQuad(extent, i, j, isUniform, jitter, state, camera, targets, pColor);
+            }
+        }
+
+        // The outermost ring of pixels has no quad around it, trace it directly.
+#pragma omp parallel for
+        for (U32 x = 0; x < width; ++x)
+        {
+            pColor[x] = TracePixel(extent, x, 0, jitter, state, camera, targets);
+            pColor[(height - 1) * width + x] = TracePixel(extent, x, height - 1, jitter, state, camera, targets);
+        }
+#pragma omp parallel for
+        for (U32 y = 1; y < height - 1; ++y)
+        {
+            pColor[y * width] = TracePixel(extent, 0, y, jitter, state, camera, targets);
+            pColor[y * width + width - 1] = TracePixel(extent, width - 1, y, jitter, state, camera, targets);
+        }
+    }
+
+    // Splits the frame into the grid of viewports set with --views. The first view is the player camera, the others
+    // orbit it about the world up axis through the origin to show the scene from evenly spaced sides.
+    inline U32 LayoutViews(const State &state, Targets &targets, const Pose &camInWorld, View *pViews)
+    {
+        const U32 numViews = state.m_viewColumns * state.m_viewRows;
+        for (U32 iView = 0; iView < numViews; ++iView)
+        {
+            const U32 column = iView % state.m_viewColumns;
+            const U32 row = iView / state.m_viewColumns;
+            const F32 angle = 2.0f * kPi * static_cast<F32>(iView) / static_cast<F32>(numViews);
+            const Pose orbit(Vec3f(0.0f, 0.0f, 0.0f), FromAngleAxis(angle, Vec3f(0.0f, 0.0f, 1.0f)));
+            const Pose viewInWorld = iView == 0 ? camInWorld : Transform(orbit, camInWorld);
+            View &view = pViews[iView];
+            view.m_camera = MakeCamera(state, targets.m_scene, viewInWorld, targets.m_orthoCubes[iView]);
+            view.m_x = column * state.m_width / state.m_viewColumns;
+            view.m_y = row * state.m_height / state.m_viewRows;
+            view.m_width = (column + 1) * state.m_width / state.m_viewColumns - view.m_x;
+            view.m_height = (row + 1) * state.m_height / state.m_viewRows - view.m_y;
+        }
+        return numViews;
+    }
+
+    // Traces every view into its viewport of the frame targets, which are frameWidth pixels wide. The views share
+    // the frame scene and the rows of all of them go to one parallel loop, so no worker idles between views.
+    inline void RenderViews(const View *pViews, const U32 numViews, const U32 frameWidth, const State &state,
+                            Targets &targets, U32 *pColor)
+    {
+        const ProfileZone zone("RenderViews");
+        U32 firstRows[kMaxViews + 1];
+        firstRows[0] = 0;
+        for (U32 iView = 0; iView < numViews; ++iView)
+        {
+            firstRows[iView + 1] = firstRows[iView] + pViews[iView].m_height;
+        }
+#pragma omp parallel for
+        for (U32 iRow = 0; iRow < firstRows[numViews]; ++iRow)
+        {
+            U32 iView = 0;
+            while (iRow >= firstRows[iView + 1])
+            {
+                ++iView;
+            }
+            const View &view = pViews[iView];
+            const DynamicExtent extent{
+                view.m_width, view.m_height, static_cast<F32>(view.m_width) / static_cast<F32>(view.m_height)
+            };
+            const U32 y = iRow - firstRows[iView];
+            const U32 rowStart = (view.m_y + y) * frameWidth + view.m_x;
+            for (U32 x = 0; x < view.m_width; ++x)
+            {
+                const Vec3f pixelInCamera = WindowToCamera(extent, view.m_camera, x, y);
+                const Fragment fragment = TraceFragment(pixelInCamera, state, view.m_camera);
+                targets.m_pIds[rowStart + x] = fragment.m_id;
+                targets.m_pDepth[rowStart + x] = fragment.m_depth;
+                pColor[rowStart + x] = ShadeFragment(fragment.m_id);
+            }
+        }
+    }
+
+    inline void WritePanoramaPixel(const Fragment fragment, const U32 iPixel, Targets &targets, U32 *pColor)
+    {
+        targets.m_pIds[iPixel] = fragment.m_id;
+        targets.m_pDepth[iPixel] = fragment.m_depth;
+        pColor[iPixel] = ShadeFragment(fragment.m_id);
+    }
+
+    // Renders the panorama set with --panorama. Cubemap faces are as large as fit the 3x2 grid, the rows of all six
+    // go to one parallel loop and whatever the grid leaves of the frame is cleared.
+    inline void RenderPanorama(const PanoramaRig &rig, const U32 width, const U32 height, const State &state,
+                               Targets &targets, U32 *pColor)
+    {
+        const ProfileZone zone("RenderPanorama");
+        if (state.m_panorama == Panorama::kEquirectangular)
+        {
+#pragma omp parallel for
+            for (U32 y = 0; y < height; ++y)
+            {
+                for (U32 x = 0; x < width; ++x)
+                {
+                    const Vec3f dirInCamera = EquirectangularToCamera(width, height, x, y);
+                    WritePanoramaPixel(TracePanoramaFragment(dirInCamera, state, rig), y * width + x, targets,
+                                       pColor);
+                }
+            }
+            return;
+        }
+
+        const U32 faceSize = Min(width / 3, height / 2);
+#pragma omp parallel for
+        for (U32 iRow = 0; iRow < 6 * faceSize; ++iRow)
+        {
+            const U32 iFace = iRow / faceSize;
+            const U32 y = iRow % faceSize;
+            const U32 rowStart = ((iFace / 3) * faceSize + y) * width + (iFace % 3) * faceSize;
+            for (U32 x = 0; x < faceSize; ++x)
+            {
+                const Vec3f dirInCamera = CubemapToCamera(iFace, faceSize, x, y);
+                WritePanoramaPixel(TracePanoramaFragment(dirInCamera, state, rig), rowStart + x, targets, pColor);
+            }
+        }
+#pragma omp parallel for
+        for (U32 y = 0; y < height; ++y)
+        {
+            const U32 x0 = y < 2 * faceSize ? 3 * faceSize : 0;
+            for (U32 x = x0; x < width; ++x)
+            {
+                WritePanoramaPixel(Fragment{kMissId, kFarDepth}, y * width + x, targets, pColor);
+            }
+        }
+    }
+
+    // Renders the left eye into the left half of the frame and the right eye into the right half, tracing each pixel
+    // for both eyes at once.
+    inline void RenderStereo(const StereoRig &rig, const U32 frameWidth, const U32 height, const State &state,
+                             Targets &targets, U32 *pColor)
+    {
+        const ProfileZone zone("RenderStereo");
+        const U32 eyeWidth = frameWidth / 2;
+        const DynamicExtent extent{eyeWidth, height, static_cast<F32>(eyeWidth) / static_cast<F32>(height)};
+#pragma omp parallel for
+        for (U32 y = 0; y < height; ++y)
+        {
+            for (U32 x = 0; x < eyeWidth; ++x)
+            {
+                const Vec3f pixelInCamera = WindowToCamera(extent, rig.m_left, x, y);
+                const StereoFragments fragments = TraceStereoFragments(pixelInCamera, state, rig);
+                const U32 iLeft = y * frameWidth + x;
+                const U32 iRight = iLeft + eyeWidth;
+                targets.m_pIds[iLeft] = fragments.m_left.m_id;
+                targets.m_pDepth[iLeft] = fragments.m_left.m_depth;
+                pColor[iLeft] = ShadeFragment(fragments.m_left.m_id);
+                targets.m_pIds[iRight] = fragments.m_right.m_id;
+                targets.m_pDepth[iRight] = fragments.m_right.m_depth;
+                pColor[iRight] = ShadeFragment(fragments.m_right.m_id);
+            }
+        }
+    }
+
+    // Ordered dither thresholds that spread the switch between block sizes over a ring of tiles.
+    constexpr U8 kFoveaDither[4][4] = {{0, 8, 2, 10}, {12, 4, 14, 6}, {3, 11, 1, 9}, {15, 7, 13, 5}};
+
+    // Traces full resolution within the fovea radius of the focus point and coarser blocks further out, doubling the
+    // block size every radius up to the tile size. Each tile picks its block size from the distance of its center,
+    // dithered between neighboring sizes so the periphery coarsens smoothly instead of in visible rings.
+    // Blocks are traced at their center and replicated into the color, ID and depth targets.
+    template<typename Extent>
+    void RenderFoveated(const Extent extent, const Vec2f focus, const State &state, const Camera &camera,
+                        Targets &targets, U32 *pColor)
+    {
+        const ProfileZone zone("RenderFoveated");
+        const U32 width = extent.Width();
+        const U32 height = extent.Height();
+        const U32 numTilesX = (width + kFoveaTileSize - 1) / kFoveaTileSize;
+        const U32 numTilesY = (height + kFoveaTileSize - 1) / kFoveaTileSize;
+        const F32 invRadius = 1.0f / state.m_foveaRadius;
+#pragma omp parallel for
+        for (U32 tileY = 0; tileY < numTilesY; ++tileY)
+        {
+            for (U32 tileX = 0; tileX < numTilesX; ++tileX)
+            {
+                const U32 x0 = tileX * kFoveaTileSize;
+                const U32 y0 = tileY * kFoveaTileSize;
+                const U32 x1 = Min(x0 + kFoveaTileSize, width);
+                const U32 y1 = Min(y0 + kFoveaTileSize, height);
+                const F32 dx = static_cast<F32>(x0 + x1) * 0.5f - focus[0];
+                const F32 dy = static_cast<F32>(y0 + y1) * 0.5f - focus[1];
+                const F32 level = Min(Max(Sqrt(dx * dx + dy * dy) * invRadius - 1.0f, 0.0f),
+                                      static_cast<F32>(kMaxFoveaLevel));
+                const U32 wholeLevel = static_cast<U32>(level);
+                const F32 threshold = (static_cast<F32>(kFoveaDither[tileY & 3][tileX & 3]) + 0.5f) / 16.0f;
+                const U32 blockSize = 1u << (wholeLevel + (level - static_cast<F32>(wholeLevel) > threshold));
+                for (U32 by = y0; by < y1; by += blockSize)
+                {
+                    const U32 byEnd = Min(by + blockSize, y1);
+                    for (U32 bx = x0; bx < x1; bx += blockSize)
+                    {
+                        const U32 bxEnd = Min(bx + blockSize, x1);
+                        const F32 subX = static_cast<F32>(bxEnd - bx) * 0.5f;
+                        const F32 subY = static_cast<F32>(byEnd - by) * 0.5f;
+                        const Vec3f pixelInCamera = WindowToCamera(extent, camera, bx, by, subX, subY);
+                        const Fragment fragment = TraceFragment(pixelInCamera, state, camera);
+                        const U32 color = ShadeFragment(fragment.m_id);
+                        for (U32 y = by; y < byEnd; ++y)
+                        {
+                            for (U32 x = bx; x < bxEnd; ++x)
+                            {
+                                targets.m_pIds[y * width + x] = fragment.m_id;
+                                targets.m_pDepth[y * width + x] = fragment.m_depth;
+                                pColor[y * width + x] = color;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    // Rows are traced into a local buffer and streamed out when they go straight to the window.
+    template<typename Extent>
+    void RenderRows(const Extent extent, const Vec2f jitter, const State &state, const Camera &camera,
+                    Targets &targets, U32 *pColor, const bool isStreamed)
+    {
+        const ProfileZone zone("RenderRows");
+        const U32 width = extent.Width();
+        const U32 height = extent.Height();
+#pragma omp parallel for
+        for (U32 y = 0; y < height; ++y)
+        {
+            alignas(64) U32 row[Extent::kRowCapacity];
+            for (U32 x = 0; x < width; ++x)
+            {
+                row[x] = TracePixel(extent, x, y, jitter, state, camera, targets);
+            }
+            if (isStreamed)
+            {
+                StreamPixels(pColor + y * width, row, width);
+                StreamFence();
+            }
+            else
+            {
+                std::memcpy(pColor + y * width, row, width * sizeof(U32));
+            }
+        }
+    }
+
+    // Gaze point when one is supplied, otherwise the cursor while it is over the window and the frame center else.
+    inline Vec2f FoveaFocus(const State &state, const I32 cursorX, const I32 cursorY)
+    {
+        const F32 width = static_cast<F32>(state.m_width);
+        const F32 height = static_cast<F32>(state.m_height);
+        if (state.m_hasGaze)
+        {
+            return Vec2f(state.m_gazeX * width, state.m_gazeY * height);
+        }
+        if (cursorX >= 0 && cursorY >= 0)
+        {
+            return Vec2f(static_cast<F32>(cursorX) + 0.5f, static_cast<F32>(cursorY) + 0.5f);
+        }
+        return Vec2f(width * 0.5f, height * 0.5f);
+    }
+
+    // Renders the frame into pPixels, the BGRA pixels of the window or wherever the frame goes. A frame converted to
+    // another format is also written to pImage, nullptr skips the conversion. focus is the fovea center in pixels.
+    template<typename Extent>
+    void RenderFrame(const Extent extent, const State &state, Targets &targets, U32 *pPixels, FrameImage *pImage,
+                     const Vec2f focus)
+    {
+        const ProfileZone zone("RenderFrame");
+        const U32 width = extent.Width();
+        const U32 height = extent.Height();
+        UpdateFrameScene(state, targets.m_scene);
+        const Pose camInWorld = CameraInWorld(state);
+        const Camera camera = MakeCamera(state, targets.m_scene, camInWorld, targets.m_orthoCubes[0]);
+        const bool isTemporal = state.m_antiAliasing == AntiAliasing::kTemporal;
+        if (!isTemporal)
+        {
+            targets.m_hasHistory = false;
+        }
+        const U32 phase = targets.m_frameIndex % kTemporalJitterPhases + 1;
+        const Vec2f jitter = isTemporal ? Vec2f(Halton(phase, 2), Halton(phase, 3)) : Vec2f(0.5f, 0.5f);
+
+        const TemporalContext<Extent> temporal{
+            .m_extent = extent,
+            .m_camera = camera,
+            .m_pDepth = targets.m_pDepth,
+            .m_pPrevHistory = targets.m_pHistory[targets.m_frameIndex & 1],
+            .m_pHistory = targets.m_pHistory[(targets.m_frameIndex & 1) ^ 1],
+            .m_camToPrevCam = Transform(Inverse(targets.m_prevCamInWorld), camera.m_camInWorld),
+            .m_hasHistory = targets.m_hasHistory,
+        };
+        PostPass passes[kMaxPostPasses];
+        U32 numPasses = 0;
+        if (isTemporal)
+        {
+            passes[numPasses++] = PostPass{"taa", 1, RunTemporalPass<Extent>, &temporal};
+        }
+        if (state.m_antiAliasing == AntiAliasing::kFxaa)
+        {
+            passes[numPasses++] = kPostEffects[static_cast<U32>(PostEffect::kFxaa)];
+        }
+        for (U32 iEffect = 0; iEffect < state.m_numPostEffects; ++iEffect)
+        {
+            passes[numPasses++] = kPostEffects[static_cast<U32>(state.m_postEffects[iEffect])];
+        }
+        // Without post passes or a conversion the primary pass writes straight into the window pixels.
+        U32 *pColor = numPasses > 0 || pImage ? targets.m_pColor : pPixels;
+        if (state.m_isHalfResolution)
+        {
+            RenderHalfResolution(extent, jitter, state, camera, targets, pColor);
+        }
+        else if (state.m_foveaRadius > 0.0f)
+        {
+            RenderFoveated(extent, focus, state, camera, targets, pColor);
+        }
+        else if (state.m_panorama != Panorama::kNone)
+        {
+            MakePanoramaRig(state, targets.m_scene, camInWorld, targets.m_panorama);
+            RenderPanorama(targets.m_panorama, width, height, state, targets, pColor);
+        }
+        else if (state.m_eyeSeparation > 0.0f)
+        {
+            MakeStereoRig(state, targets.m_scene, camInWorld, targets.m_stereo);
+            RenderStereo(targets.m_stereo, width, height, state, targets, pColor);
+        }
+        else if (state.m_viewColumns * state.m_viewRows > 1)
+        {
+            View views[kMaxViews];
+            const U32 numViews = LayoutViews(state, targets, camInWorld, views);
+            RenderViews(views, numViews, width, state, targets, pColor);
+        }
+        else
+        {
+            // Colors the post passes read next are stored normally so they stay cached.
+            RenderRows(extent, jitter, state, camera, targets, pColor, pColor == pPixels && state.m_isStreamingStores);
+        }
+        if (state.m_antiAliasing == AntiAliasing::kEdgeSupersample)
+        {
+            SupersampleEdges(extent, state, camera, targets.m_pIds, pColor);
+        }
+        if (pColor != pPixels)
+        {
+            RunPostPipeline(passes, numPasses, targets.m_pColor, targets.m_pIds, width, height, pPixels,
+                            state.m_isStreamingStores, pImage);
+        }
+        if (isTemporal)
+        {
+            targets.m_hasHistory = true;
+            targets.m_prevCamInWorld = camera.m_camInWorld;
+            ++targets.m_frameIndex;
+        }
+    }
+}
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <common.hpp>
+#include <render.hpp>
+
+namespace Engine
+{
+    // Scenes and camera paths generated from fixed seeds, shared by the engine, the benchmark and the golden tests.
+    enum class ScenePreset : U32
+    {
+        kCubes,
+        kGrid,
+        kCloud,
+        kWall,
+        kSparse,
+        kCount
+    };
+
+    static constexpr const char *kScenePresetNames[] = {"cubes", "grid", "cloud", "wall", "sparse"};
+    static_assert(sizeof(kScenePresetNames) / sizeof(kScenePresetNames[0]) == static_cast<U32>(ScenePreset::kCount));
+
+    enum class CameraPath : U32
+    {
+        kOrbit,
+        kDolly,
+        kPan,
+        kCount
+    };
+
+    static constexpr const char *kCameraPathNames[] = {"orbit", "dolly", "pan"};
+    static_assert(sizeof(kCameraPathNames) / sizeof(kCameraPathNames[0]) == static_cast<U32>(CameraPath::kCount));
+
+    // Xorshift, so every run and every machine sees the same scene.
+    struct SceneRandom
+    {
+        U32 m_state = 0x9E3779B9u;
+    };
+
+    inline F32 NextSceneRandom(SceneRandom &random, const F32 min, const F32 max)
+    {
+        U32 x = random.m_state;
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        random.m_state = x;
+        return min + (max - min) * static_cast<F32>(x >> 8) * (1.0f / 16777216.0f);
+    }
+
+    inline Quatf RandomOrientation(SceneRandom &random)
+    {
+        const Vec3f axis(NextSceneRandom(random, -1.0f, 1.0f), NextSceneRandom(random, -1.0f, 1.0f) + 2.0f,
+                         NextSceneRandom(random, -1.0f, 1.0f));
+        return FromAngleAxis(NextSceneRandom(random, -kPi, kPi), Normalize(axis));
+    }
+
+    // Fills the scene and returns the radius the camera paths keep to.
+    inline F32 MakeScenePreset(State &state, const ScenePreset scene)
+    {
+        state.m_numCubes = 0;
+        const Quatf identity(1.0f, 0.0f, 0.0f, 0.0f);
+        SceneRandom random;
+        switch (scene)
+        {
+            case ScenePreset::kCubes:
+                // The four cubes the engine starts with.
+                for (U32 i = 0; i < 4; ++i)
+                {
+                    AddCube(state, Pose(Vec3f(i < 2 ? 2.0f : -2.0f, 0.0f, i % 2 == 0 ? 2.0f : -2.0f), identity), 1.0f);
+                }
+                return 6.0f;
+            case ScenePreset::kGrid:
+                // 10x10x10 lattice of axis aligned cubes.
+                for (U32 i = 0; i < 1000; ++i)
+                {
+                    const F32 x = static_cast<F32>(i % 10) * 4.0f - 18.0f;
+                    const F32 y = static_cast<F32>(i / 10 % 10) * 4.0f - 18.0f;
+                    const F32 z = static_cast<F32>(i / 100) * 4.0f - 18.0f;
+                    AddCube(state, Pose(Vec3f(x, y, z), identity), 1.0f);
+                }
+                return 30.0f;
+            case ScenePreset::kCloud:
+                // Randomly placed, sized and oriented cubes filling the whole cache.
+                while (AddCube(state,
+                               Pose(Vec3f(NextSceneRandom(random, -25.0f, 25.0f),
+                                          NextSceneRandom(random, -25.0f, 25.0f),
+                                          NextSceneRandom(random, -25.0f, 25.0f)),
+                                    RandomOrientation(random)),
+                               NextSceneRandom(random, 0.5f, 1.5f)))
+                {
+                }
+                return 40.0f;
+            case ScenePreset::kWall:
+                // Cubes with hairline gaps covering the view, nearly every ray hits. Touching faces would flicker.
+                for (U32 i = 0; i < kMaxCubes; ++i)
+                {
+                    const F32 x = static_cast<F32>(i % 32) - 15.5f;
+                    const F32 y = static_cast<F32>(i / 32) - 15.5f;
+                    AddCube(state, Pose(Vec3f(x, y, 0.0f), identity), 0.95f);
+                }
+                return 24.0f;
+            case ScenePreset::kSparse:
+                // The whole cache spread over a world so large that nearly every ray misses.
+                while (AddCube(state,
+                               Pose(Vec3f(NextSceneRandom(random, -1000.0f, 1000.0f),
+                                          NextSceneRandom(random, -50.0f, 50.0f),
+                                          NextSceneRandom(random, -1000.0f, 1000.0f)),
+                                    RandomOrientation(random)),
+                               NextSceneRandom(random, 1.0f, 4.0f)))
+                {
+                }
+                return 1200.0f;
+            case ScenePreset::kCount:
+                break;
+        }
+        return 0.0f;
+    }
+
+    // Camera pose at fraction t of the path, the camera looks along its Z axis.
+    inline Pose CameraOnPath(const CameraPath path, const F32 radius, const F32 t)
+    {
+        switch (path)
+        {
+            case CameraPath::kOrbit: {
+                // Circles the scene once facing its center.
+                const F32 angle = kTau * t - kPi;
+                return Pose(Vec3f(-radius * Sin(angle), 0.0f, -radius * Cos(angle)),
+                            FromAngleAxis(angle, Vec3f{0.0f, 1.0f, 0.0f}));
+            }
+            case CameraPath::kDolly:
+                // Flies from outside the scene straight through its center.
+                return Pose(Vec3f(0.0f, 0.5f, radius * (2.0f * t - 1.5f)), Quatf(1.0f, 0.0f, 0.0f, 0.0f));
+            case CameraPath::kPan:
+                // Stands outside the scene and sweeps across it.
+                return Pose(Vec3f(0.0f, 0.0f, -radius), FromAngleAxis(kHalfPi * (t - 0.5f), Vec3f{0.0f, 1.0f, 0.0f}));
+            case CameraPath::kCount:
+                break;
+        }
+        return Pose(Vec3f(0.0f, 0.0f, 0.0f), Quatf(1.0f, 0.0f, 0.0f, 0.0f));
+    }
+}
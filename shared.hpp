@@ -0,0 +1,200 @@
+#pragma once
+
+#include <climits>
+#include <cstddef>
+
+#include <common.hpp>
+#include <memory.hpp>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+#endif
+
+namespace Engine
+{
+    // Frames exported to viewer processes through a named shared memory ring. The renderer writes each frame in
+    // place into a slot, viewers map the same memory and read the newest slot without copying.
+    //
+    // Viewer protocol:
+    //  1. Map the object, check m_magic and m_version.
+    //  2. Read m_latestFrame (acquire), the frame is in slot m_latestFrame % m_numSlots.
+    //  3. Read the slot's m_sequence (acquire), then the pixels, then m_sequence again. The pixels are consistent
+    //     if both reads match and equal 2 * frame, odd values mean the renderer is writing the slot.
+    //  4. To wait for the next frame on Linux, increment m_numWaiters, FUTEX_WAIT (not private) on m_futex with the
+    //     value read before step 2, then decrement m_numWaiters. On Windows wait on the event named
+    //     kSharedFrameEventName. Other systems poll m_latestFrame.
+    static constexpr U32 kSharedFrameMagic = 0x52464E45; // "ENFR"
+    static constexpr U32 kSharedFrameVersion = 1;
+    // Enough that a viewer reading the newest slot is not overwritten for two more frames.
+    static constexpr U32 kSharedFrameSlots = 3;
+#if defined(_WIN32)
+    static constexpr const char *kSharedFrameName = "Local\\engine-frames";
+    static constexpr const char *kSharedFrameEventName = "Local\\engine-frames-ready";
+#else
+    static constexpr const char *kSharedFrameName = "/engine-frames";
+#endif
+
+    struct alignas(64) SharedFrameSlot
+    {
+        // Seqlock, odd while the renderer writes the slot, otherwise twice the number of the frame it holds.
+        U64 m_sequence;
+        // Byte offset of the BGRA pixels from the start of the mapping.
+        U64 m_offset;
+    };
+
+    // Start of the mapping. Shared with other processes, so only fixed size fields.
+    struct SharedFrameHeader
+    {
+        U32 m_magic;
+        U32 m_version;
+        U32 m_width;
+        U32 m_height;
+        // Bytes between rows.
+        U32 m_stride;
+        U32 m_numSlots;
+        // Newest published frame, frames are numbered from 1.
+        alignas(64) U64 m_latestFrame;
+        // Incremented on every publish.
+        U32 m_futex;
+        // Viewers blocked on m_futex, the renderer only makes the wake syscall while there are any.
+        U32 m_numWaiters;
+        SharedFrameSlot m_slots[kSharedFrameSlots];
+    };
+
+    struct SharedFrameRing
+    {
+        SharedFrameHeader *m_pHeader = nullptr;
+        std::size_t m_size = 0;
+        U64 m_numFrames = 0;
+#if defined(_WIN32)
+        HANDLE m_hMapping = nullptr;
+        HANDLE m_hEvent = nullptr;
+#else
+        int m_fd = -1;
+#endif
+    };
+
+    inline bool IsSharedFrameRingOpen(const SharedFrameRing &ring)
+    {
+        return ring.m_pHeader != nullptr;
+    }
+
+    inline U32 *SharedFramePixels(const SharedFrameRing &ring, const U32 iSlot)
+    {
+        U8 *pMapping = reinterpret_cast<U8 *>(ring.m_pHeader);
+        return reinterpret_cast<U32 *>(pMapping + ring.m_pHeader->m_slots[iSlot].m_offset);
+    }
+
+    inline void CloseSharedFrameRing(SharedFrameRing &ring)
+    {
+#if defined(_WIN32)
+        if (ring.m_pHeader)
+        {
+            UnmapViewOfFile(ring.m_pHeader);
+        }
+        if (ring.m_hMapping)
+        {
+            CloseHandle(ring.m_hMapping);
+        }
+        if (ring.m_hEvent)
+        {
+            CloseHandle(ring.m_hEvent);
+        }
+#else
+        if (ring.m_pHeader)
+        {
+            munmap(ring.m_pHeader, ring.m_size);
+        }
+        if (ring.m_fd >= 0)
+        {
+            close(ring.m_fd);
+            shm_unlink(kSharedFrameName);
+        }
+#endif
+        ring = SharedFrameRing{};
+    }
+
+    // Creates the named object, replacing one left behind by a previous run.
+    inline bool OpenSharedFrameRing(SharedFrameRing &ring, const U32 width, const U32 height)
+    {
+        const U32 stride = width * sizeof(U32);
+        const std::size_t slotSize = AlignUp(static_cast<std::size_t>(stride) * height, kPageAlignment);
+        const std::size_t firstSlot = AlignUp(sizeof(SharedFrameHeader), kPageAlignment);
+        ring.m_size = firstSlot + slotSize * kSharedFrameSlots;
+#if defined(_WIN32)
+        ring.m_hMapping = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+                                             static_cast<DWORD>(static_cast<U64>(ring.m_size) >> 32),
+                                             static_cast<DWORD>(ring.m_size), kSharedFrameName);
+        ring.m_hEvent = CreateEventA(nullptr, FALSE, FALSE, kSharedFrameEventName);
+        void *pData = ring.m_hMapping ? MapViewOfFile(ring.m_hMapping, FILE_MAP_ALL_ACCESS, 0, 0, ring.m_size)
+                                      : nullptr;
+#else
+        shm_unlink(kSharedFrameName);
+        ring.m_fd = shm_open(kSharedFrameName, O_RDWR | O_CREAT | O_EXCL, 0600);
+        void *pData = nullptr;
+        if (ring.m_fd >= 0 && ftruncate(ring.m_fd, static_cast<off_t>(ring.m_size)) == 0)
+        {
+            pData = mmap(nullptr, ring.m_size, PROT_READ | PROT_WRITE, MAP_SHARED, ring.m_fd, 0);
+            pData = pData != MAP_FAILED ? pData : nullptr;
+        }
+#endif
+        if (!pData)
+        {
+            CloseSharedFrameRing(ring);
+            return false;
+        }
+        ring.m_pHeader = static_cast<SharedFrameHeader *>(pData);
+        SharedFrameHeader &header = *ring.m_pHeader;
+        header.m_version = kSharedFrameVersion;
+        header.m_width = width;
+        header.m_height = height;
+        header.m_stride = stride;
+        header.m_numSlots = kSharedFrameSlots;
+        for (U32 iSlot = 0; iSlot < kSharedFrameSlots; ++iSlot)
+        {
+            header.m_slots[iSlot].m_sequence = 0;
+            header.m_slots[iSlot].m_offset = firstSlot + iSlot * slotSize;
+        }
+        // Viewers may already be polling for the magic.
+        __atomic_store_n(&header.m_magic, kSharedFrameMagic, __ATOMIC_RELEASE);
+        return true;
+    }
+
+    // Claims the slot for the next frame, returns its index. The pixels may be written until PublishSharedFrame.
+    inline U32 BeginSharedFrame(SharedFrameRing &ring)
+    {
+        const U64 frame = ++ring.m_numFrames;
+        const U32 iSlot = static_cast<U32>(frame % kSharedFrameSlots);
+        __atomic_store_n(&ring.m_pHeader->m_slots[iSlot].m_sequence, 2 * frame - 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        return iSlot;
+    }
+
+    // Marks the frame claimed by BeginSharedFrame complete and wakes waiting viewers. Streamed pixel stores must
+    // be fenced before this.
+    inline void PublishSharedFrame(SharedFrameRing &ring, const U32 iSlot)
+    {
+        SharedFrameHeader &header = *ring.m_pHeader;
+        __atomic_store_n(&header.m_slots[iSlot].m_sequence, 2 * ring.m_numFrames, __ATOMIC_RELEASE);
+        __atomic_store_n(&header.m_latestFrame, ring.m_numFrames, __ATOMIC_RELEASE);
+        // Sequentially consistent with the viewers' waiter count, so either the viewer sees the new value before
+        // sleeping or the renderer sees the viewer and wakes it.
+        __atomic_add_fetch(&header.m_futex, 1, __ATOMIC_SEQ_CST);
+#if defined(_WIN32)
+        SetEvent(ring.m_hEvent);
+#elif defined(__linux__)
+        if (__atomic_load_n(&header.m_numWaiters, __ATOMIC_SEQ_CST) > 0)
+        {
+            syscall(SYS_futex, &header.m_futex, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+        }
+#endif
+    }
+}
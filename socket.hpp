@@ -0,0 +1,190 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+
+#include <common.hpp>
+
+#if defined(_WIN32)
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace Engine
+{
+    // Thin layer over Winsock and BSD sockets, just what the local frame servers need.
+#if defined(_WIN32)
+    using Socket = SOCKET;
+    static constexpr Socket kInvalidSocket = INVALID_SOCKET;
+#else
+    using Socket = int;
+    static constexpr Socket kInvalidSocket = -1;
+#endif
+
+#if defined(MSG_NOSIGNAL)
+    // A viewer disconnecting mid frame should fail the send, not raise SIGPIPE.
+    static constexpr int kSendFlags = MSG_NOSIGNAL;
+#else
+    static constexpr int kSendFlags = 0;
+#endif
+
+    inline bool InitializeSockets()
+    {
+#if defined(_WIN32)
+        WSADATA data;
+        return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+#else
+        return true;
+#endif
+    }
+
+    inline void ShutdownSockets()
+    {
+#if defined(_WIN32)
+        WSACleanup();
+#endif
+    }
+
+    inline void CloseSocket(const Socket socket)
+    {
+#if defined(_WIN32)
+        closesocket(socket);
+#else
+        close(socket);
+#endif
+    }
+
+    inline bool SetNonBlocking(const Socket socket, const bool isNonBlocking)
+    {
+#if defined(_WIN32)
+        u_long mode = isNonBlocking ? 1 : 0;
+        return ioctlsocket(socket, FIONBIO, &mode) == 0;
+#else
+        const int flags = fcntl(socket, F_GETFL, 0);
+        return flags >= 0 && fcntl(socket, F_SETFL, isNonBlocking ? flags | O_NONBLOCK : flags & ~O_NONBLOCK) == 0;
+#endif
+    }
+
+    // Accepts are polled, so listeners are non-blocking.
+    inline Socket FinishListen(const Socket listener, const bool isBound)
+    {
+        if (!isBound || listen(listener, 4) != 0 || !SetNonBlocking(listener, true))
+        {
+            CloseSocket(listener);
+            return kInvalidSocket;
+        }
+        return listener;
+    }
+
+    // Only binds the loopback address, remote viewers go through a proxy.
+    inline Socket ListenTcp(const U16 port)
+    {
+        const Socket listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (listener == kInvalidSocket)
+        {
+            return kInvalidSocket;
+        }
+        const int isReused = 1;
+        setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char *>(&isReused), sizeof(isReused));
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        const bool isBound = bind(listener, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) == 0;
+        return FinishListen(listener, isBound);
+    }
+
+    inline Socket ListenUnix([[maybe_unused]] const char *path)
+    {
+#if defined(_WIN32)
+        // Windows has AF_UNIX only from Windows 10 on and behind afunix.h, use TCP there.
+        return kInvalidSocket;
+#else
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        if (std::strlen(path) >= sizeof(address.sun_path))
+        {
+            return kInvalidSocket;
+        }
+        std::strcpy(address.sun_path, path);
+        const Socket listener = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listener == kInvalidSocket)
+        {
+            return kInvalidSocket;
+        }
+        // A socket file left by a previous run would make bind fail.
+        unlink(path);
+        const bool isBound = bind(listener, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) == 0;
+        return FinishListen(listener, isBound);
+#endif
+    }
+
+    // Returns kInvalidSocket when no connection is pending. Clients are blocking with Nagle disabled, frames are
+    // sent in one go and should leave immediately.
+    inline Socket AcceptClient(const Socket listener)
+    {
+        const Socket client = accept(listener, nullptr, nullptr);
+        if (client == kInvalidSocket)
+        {
+            return kInvalidSocket;
+        }
+        SetNonBlocking(client, false);
+        const int isNoDelay = 1;
+        // Fails harmlessly on Unix sockets.
+        setsockopt(client, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char *>(&isNoDelay), sizeof(isNoDelay));
+        return client;
+    }
+
+    // Bounds how long Receive blocks, so a client that connects and sends nothing cannot stall a server thread.
+    inline void SetReceiveTimeout(const Socket socket, const U32 milliseconds)
+    {
+#if defined(_WIN32)
+        const DWORD timeout = milliseconds;
+#else
+        const timeval timeout{static_cast<time_t>(milliseconds / 1000),
+                              static_cast<suseconds_t>(milliseconds % 1000 * 1000)};
+#endif
+        setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char *>(&timeout), sizeof(timeout));
+    }
+
+    // Returns the number of bytes received, 0 when the peer closed the connection or on errors and timeouts.
+    inline std::size_t Receive(const Socket socket, U8 *pData, const std::size_t size)
+    {
+#if defined(_WIN32)
+        const int received = recv(socket, reinterpret_cast<char *>(pData), static_cast<int>(size), 0);
+#else
+        const ssize_t received = recv(socket, pData, size, 0);
+#endif
+        return received > 0 ? static_cast<std::size_t>(received) : 0;
+    }
+
+    inline bool SendAll(const Socket socket, const U8 *pData, std::size_t size)
+    {
+        while (size > 0)
+        {
+            constexpr std::size_t kMaxChunk = 1u << 30;
+            const std::size_t chunk = size < kMaxChunk ? size : kMaxChunk;
+#if defined(_WIN32)
+            const int sent = send(socket, reinterpret_cast<const char *>(pData), static_cast<int>(chunk), kSendFlags);
+#else
+            const ssize_t sent = send(socket, pData, chunk, kSendFlags);
+#endif
+            if (sent <= 0)
+            {
+                return false;
+            }
+            pData += sent;
+            size -= static_cast<std::size_t>(sent);
+        }
+        return true;
+    }
+}
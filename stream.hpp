@@ -0,0 +1,484 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
+#include <common.hpp>
+#include <memory.hpp>
+#include <socket.hpp>
+
+namespace Engine
+{
+    // Frame server for a local viewer or proxy. Each frame sends only the tiles that changed since the previous one,
+    // coded with copy ops that flat shaded faces collapse into a few bytes.
+    //
+    // Wire format, little endian:
+    //  frame: U32 kStreamFrameMagic, U32 frame number, U16 width, U16 height, U16 tile size, U16 flags, U32 tile
+    //         count, U32 payload bytes, then the tiles. Flag kStreamKeyFrame marks frames that code every tile
+    //         without reference to earlier frames, each client starts with one.
+    //  tile:  U16 tile x, U16 tile y, U32 coded bytes, then ops covering the tile's pixels in row-major order. Tiles
+    //         at the right and bottom edges are clipped to the frame.
+    //  op:    a byte whose top two bits select the kind and whose low six bits are count - 1. A low value of 63 is
+    //         followed by a LEB128 varint added to the count.
+    static constexpr U32 kStreamFrameMagic = 0x4D524645; // "EFRM"
+    static constexpr U32 kStreamFrameHeaderSize = 24;
+    static constexpr U32 kStreamTileHeaderSize = 8;
+    static constexpr U16 kStreamKeyFrame = 1;
+    static constexpr U32 kStreamTileSize = 32;
+    static constexpr U32 kMaxStreamClients = 8;
+    // How often the server checks for new connections while no frames arrive.
+    static constexpr U32 kStreamAcceptIntervalMs = 20;
+
+    enum class StreamOp : U8
+    {
+        // Repeat the previous pixel of the tile.
+        kRepeat,
+        // Copy the pixel one row above in the tile.
+        kAbove,
+        // Keep the pixel of the previous frame.
+        kKeep,
+        // Literal pixels follow as B, G, R bytes.
+        kLiteral,
+    };
+
+    inline U8 *PutStreamOp(U8 *p, const StreamOp op, const U32 count)
+    {
+        const U32 low = count - 1 < 63 ? count - 1 : 63;
+        *p++ = static_cast<U8>(static_cast<U32>(op) << 6 | low);
+        if (low == 63)
+        {
+            U32 rest = count - 64;
+            do
+            {
+                *p++ = static_cast<U8>((rest & 0x7Fu) | (rest >= 0x80 ? 0x80u : 0u));
+                rest >>= 7;
+            } while (rest > 0);
+        }
+        return p;
+    }
+
+    // Largest coded tile, literals cost three bytes per pixel and at most one op byte per pixel on top.
+    inline std::size_t StreamTileBound()
+    {
+        return kStreamTileHeaderSize + kStreamTileSize * kStreamTileSize * 4 + 8;
+    }
+
+    // Codes one tile, greedily taking whichever copy op runs longest and falling back to literals where none applies.
+    // pReference is the frame the client holds, or nullptr for key frames.
+    inline U8 *EncodeStreamTile(const U32 *pFrame, const U32 *pReference, const U32 width, const U32 x0, const U32 y0,
+                                const U32 tileWidth, const U32 tileHeight, U8 *pDst)
+    {
+        // Gather the tile so the ops can work on linear indices, alpha is not sent.
+        U32 tile[kStreamTileSize * kStreamTileSize];
+        U32 reference[kStreamTileSize * kStreamTileSize];
+        for (U32 y = 0; y < tileHeight; ++y)
+        {
+            for (U32 x = 0; x < tileWidth; ++x)
+            {
+                const U32 iFrame = (y0 + y) * width + x0 + x;
+                tile[y * tileWidth + x] = pFrame[iFrame] & 0xFFFFFFu;
+                reference[y * tileWidth + x] = pReference ? pReference[iFrame] & 0xFFFFFFu : ~0u;
+            }
+        }
+        const U32 numPixels = tileWidth * tileHeight;
+        // Pixels from i on that match pSource, which is indexed from i - back.
+        const auto runLength = [&tile, numPixels](const U32 i, const U32 *pSource, const U32 back) {
+            U32 length = 0;
+            while (i + length < numPixels && tile[i + length] == pSource[i + length - back])
+            {
+                ++length;
+            }
+            return length;
+        };
+
+        U8 *p = pDst;
+        U32 i = 0;
+        U32 literalStart = 0;
+        const auto flushLiterals = [&] {
+            if (literalStart == i)
+            {
+                return;
+            }
+            p = PutStreamOp(p, StreamOp::kLiteral, i - literalStart);
+            for (U32 iLiteral = literalStart; iLiteral < i; ++iLiteral)
+            {
+                *p++ = static_cast<U8>(tile[iLiteral]);
+                *p++ = static_cast<U8>(tile[iLiteral] >> 8);
+                *p++ = static_cast<U8>(tile[iLiteral] >> 16);
+            }
+        };
+        while (i < numPixels)
+        {
+            StreamOp op = StreamOp::kLiteral;
+            U32 length = 0;
+            if (pReference)
+            {
+                length = runLength(i, reference, 0);
+                op = StreamOp::kKeep;
+            }
+            if (i > 0)
+            {
+                // Every repeated pixel equals the one before the run.
+                U32 repeat = 0;
+                while (i + repeat < numPixels && tile[i + repeat] == tile[i - 1])
+                {
+                    ++repeat;
+                }
+                if (repeat > length)
+                {
+                    length = repeat;
+                    op = StreamOp::kRepeat;
+                }
+            }
+            if (i >= tileWidth)
+            {
+                const U32 above = runLength(i, tile, tileWidth);
+                if (above > length)
+                {
+                    length = above;
+                    op = StreamOp::kAbove;
+                }
+            }
+            if (length == 0)
+            {
+                ++i;
+                continue;
+            }
+            flushLiterals();
+            p = PutStreamOp(p, op, length);
+            i += length;
+            literalStart = i;
+        }
+        flushLiterals();
+        return p;
+    }
+
+    // Applies a coded tile to pFrame, which must hold the client's previous frame. Returns the end of the tile, or
+    // nullptr when the ops are malformed or run past pEnd.
+    inline const U8 *DecodeStreamTile(const U8 *p, const U8 *pEnd, U32 *pFrame, const U32 width, const U32 x0,
+                                      const U32 y0, const U32 tileWidth, const U32 tileHeight)
+    {
+        const U32 numPixels = tileWidth * tileHeight;
+        const auto at = [=](const U32 i) -> U32 & {
+            return pFrame[(y0 + i / tileWidth) * width + x0 + i % tileWidth];
+        };
+        for (U32 i = 0; i < numPixels;)
+        {
+            if (p >= pEnd)
+            {
+                return nullptr;
+            }
+            const StreamOp op = static_cast<StreamOp>(*p >> 6);
+            U32 count = (*p++ & 63u) + 1;
+            if (count == 64)
+            {
+                U32 rest = 0;
+                for (U32 shift = 0;; shift += 7)
+                {
+                    if (p >= pEnd || shift > 28)
+                    {
+                        return nullptr;
+                    }
+                    rest |= (*p & 0x7Fu) << shift;
+                    if ((*p++ & 0x80) == 0)
+                    {
+                        break;
+                    }
+                }
+                count += rest;
+            }
+            if (count > numPixels - i || (op == StreamOp::kRepeat && i == 0) ||
+                (op == StreamOp::kAbove && i < tileWidth) ||
+                (op == StreamOp::kLiteral && static_cast<std::size_t>(pEnd - p) < count * 3))
+            {
+                return nullptr;
+            }
+            for (const U32 iEnd = i + count; i < iEnd; ++i)
+            {
+                switch (op)
+                {
+                    case StreamOp::kRepeat:
+                        at(i) = at(i - 1);
+                        break;
+                    case StreamOp::kAbove:
+                        at(i) = at(i - tileWidth);
+                        break;
+                    case StreamOp::kKeep:
+                        break;
+                    case StreamOp::kLiteral:
+                        at(i) = 0xFF000000u | static_cast<U32>(p[2]) << 16 | static_cast<U32>(p[1]) << 8 | p[0];
+                        p += 3;
+                        break;
+                }
+            }
+        }
+        return p;
+    }
+
+    inline void StoreLittleEndian16(U8 *pDst, const U32 value)
+    {
+        pDst[0] = static_cast<U8>(value);
+        pDst[1] = static_cast<U8>(value >> 8);
+    }
+
+    inline void StoreLittleEndian32(U8 *pDst, const U32 value)
+    {
+        StoreLittleEndian16(pDst, value);
+        StoreLittleEndian16(pDst + 2, value >> 16);
+    }
+
+    // Codes the tiles of pFrame that differ from pReference, or all of them without a reference, into one message.
+    inline std::size_t EncodeStreamFrame(const U32 *pFrame, const U32 *pReference, const U32 width, const U32 height,
+                                         const U32 frameNumber, U8 *pDst)
+    {
+        U8 *p = pDst + kStreamFrameHeaderSize;
+        U32 numTiles = 0;
+        for (U32 y0 = 0; y0 < height; y0 += kStreamTileSize)
+        {
+            for (U32 x0 = 0; x0 < width; x0 += kStreamTileSize)
+            {
+                const U32 tileWidth = Min(kStreamTileSize, width - x0);
+                const U32 tileHeight = Min(kStreamTileSize, height - y0);
+                bool isChanged = !pReference;
+                for (U32 y = y0; y < y0 + tileHeight && !isChanged; ++y)
+                {
+                    isChanged = std::memcmp(pFrame + y * width + x0, pReference + y * width + x0,
+                                            tileWidth * sizeof(U32)) != 0;
+                }
+                if (!isChanged)
+                {
+                    continue;
+                }
+                U8 *pTile = p;
+                p = EncodeStreamTile(pFrame, pReference, width, x0, y0, tileWidth, tileHeight,
+                                     pTile + kStreamTileHeaderSize);
+                StoreLittleEndian16(pTile, x0 / kStreamTileSize);
+                StoreLittleEndian16(pTile + 2, y0 / kStreamTileSize);
+                StoreLittleEndian32(pTile + 4, static_cast<U32>(p - pTile) - kStreamTileHeaderSize);
+                ++numTiles;
+            }
+        }
+        StoreLittleEndian32(pDst, kStreamFrameMagic);
+        StoreLittleEndian32(pDst + 4, frameNumber);
+        StoreLittleEndian16(pDst + 8, width);
+        StoreLittleEndian16(pDst + 10, height);
+        StoreLittleEndian16(pDst + 12, kStreamTileSize);
+        StoreLittleEndian16(pDst + 14, pReference ? 0 : kStreamKeyFrame);
+        StoreLittleEndian32(pDst + 16, numTiles);
+        StoreLittleEndian32(pDst + 20, static_cast<U32>(p - pDst) - kStreamFrameHeaderSize);
+        return static_cast<std::size_t>(p - pDst);
+    }
+
+    // Serves frames from its own thread. The renderer only copies each frame into the pending buffer; while the
+    // server is still busy with an earlier frame, newer frames replace the pending one.
+    struct StreamServer
+    {
+        Socket m_listener = kInvalidSocket;
+        const char *m_pUnixPath = nullptr;
+        U32 m_width = 0;
+        U32 m_height = 0;
+        Socket m_clients[kMaxStreamClients];
+        U32 m_numClients = 0;
+
+        PageAllocation m_buffers;
+        U32 *m_pPending = nullptr;
+        U32 *m_pCurrent = nullptr;
+        U32 *m_pReference = nullptr;
+        U8 *m_pMessage = nullptr;
+        bool m_hasPending = false;
+        bool m_hasReference = false;
+        U32 m_numFrames = 0;
+
+        std::thread m_thread;
+        std::mutex m_mutex;
+        std::condition_variable m_wake;
+        bool m_isClosing = false;
+        U64 m_numSentBytes = 0;
+        U64 m_numRawBytes = 0;
+        U64 m_numReplaced = 0;
+    };
+
+    inline bool IsStreamServerOpen(const StreamServer &server)
+    {
+        return server.m_listener != kInvalidSocket;
+    }
+
+    inline std::size_t StreamFrameBound(const U32 width, const U32 height)
+    {
+        const U32 numTiles = (width + kStreamTileSize - 1) / kStreamTileSize * ((height + kStreamTileSize - 1) /
+                                                                                kStreamTileSize);
+        return kStreamFrameHeaderSize + numTiles * StreamTileBound();
+    }
+
+    inline void SendStreamMessage(StreamServer &server, const Socket client, const std::size_t size, bool &isSent)
+    {
+        isSent = SendAll(client, server.m_pMessage, size);
+        if (isSent)
+        {
+            server.m_numSentBytes += size;
+        }
+    }
+
+    // New clients first get a key frame of the reference, after that they follow the same deltas as everyone else.
+    inline void AcceptStreamClients(StreamServer &server)
+    {
+        for (Socket client; server.m_numClients < kMaxStreamClients &&
+                            (client = AcceptClient(server.m_listener)) != kInvalidSocket;)
+        {
+            bool isSent = true;
+            if (server.m_hasReference)
+            {
+                const std::size_t size = EncodeStreamFrame(server.m_pReference, nullptr, server.m_width,
+                                                           server.m_height, server.m_numFrames, server.m_pMessage);
+                SendStreamMessage(server, client, size, isSent);
+            }
+            if (isSent)
+            {
+                server.m_clients[server.m_numClients++] = client;
+            }
+            else
+            {
+                CloseSocket(client);
+            }
+        }
+    }
+
+    inline void StreamServerMain(StreamServer &server)
+    {
+        for (;;)
+        {
+            bool hasFrame;
+            {
+                std::unique_lock lock(server.m_mutex);
+                server.m_wake.wait_for(lock, std::chrono::milliseconds(kStreamAcceptIntervalMs),
+                                       [&server] { return server.m_isClosing || server.m_hasPending; });
+                if (server.m_isClosing)
+                {
+                    return;
+                }
+                hasFrame = server.m_hasPending;
+                if (hasFrame)
+                {
+                    U32 *pFrame = server.m_pCurrent;
+                    server.m_pCurrent = server.m_pPending;
+                    server.m_pPending = pFrame;
+                    server.m_hasPending = false;
+                }
+            }
+            AcceptStreamClients(server);
+            if (!hasFrame)
+            {
+                continue;
+            }
+            ++server.m_numFrames;
+            if (server.m_numClients > 0)
+            {
+                const std::size_t size = EncodeStreamFrame(server.m_pCurrent,
+                                                           server.m_hasReference ? server.m_pReference : nullptr,
+                                                           server.m_width, server.m_height, server.m_numFrames,
+                                                           server.m_pMessage);
+                server.m_numRawBytes += static_cast<U64>(server.m_width) * server.m_height * 3 * server.m_numClients;
+                for (U32 iClient = 0; iClient < server.m_numClients;)
+                {
+                    bool isSent;
+                    SendStreamMessage(server, server.m_clients[iClient], size, isSent);
+                    if (isSent)
+                    {
+                        ++iClient;
+                        continue;
+                    }
+                    CloseSocket(server.m_clients[iClient]);
+                    server.m_clients[iClient] = server.m_clients[--server.m_numClients];
+                }
+            }
+            U32 *pFrame = server.m_pReference;
+            server.m_pReference = server.m_pCurrent;
+            server.m_pCurrent = pFrame;
+            server.m_hasReference = true;
+        }
+    }
+
+    // address is tcp:PORT for the loopback interface or unix:PATH.
+    inline bool OpenStreamServer(StreamServer &server, const char *address, const U32 width, const U32 height)
+    {
+        if (width > 0xFFFF || height > 0xFFFF || !InitializeSockets())
+        {
+            return false;
+        }
+        if (std::strncmp(address, "tcp:", 4) == 0)
+        {
+            server.m_listener = ListenTcp(static_cast<U16>(std::atoi(address + 4)));
+        }
+        else if (std::strncmp(address, "unix:", 5) == 0)
+        {
+            server.m_pUnixPath = address + 5;
+            server.m_listener = ListenUnix(server.m_pUnixPath);
+        }
+        if (server.m_listener == kInvalidSocket)
+        {
+            ShutdownSockets();
+            return false;
+        }
+        server.m_width = width;
+        server.m_height = height;
+        const std::size_t frameSize = AlignUp(static_cast<std::size_t>(width) * height * sizeof(U32), 64);
+        server.m_buffers = AllocatePages(frameSize * 3 + StreamFrameBound(width, height), false);
+        U8 *pBuffers = static_cast<U8 *>(server.m_buffers.m_pData);
+        server.m_pPending = reinterpret_cast<U32 *>(pBuffers);
+        server.m_pCurrent = reinterpret_cast<U32 *>(pBuffers + frameSize);
+        server.m_pReference = reinterpret_cast<U32 *>(pBuffers + 2 * frameSize);
+        server.m_pMessage = pBuffers + 3 * frameSize;
+        server.m_thread = std::thread(StreamServerMain, std::ref(server));
+        return true;
+    }
+
+    inline void SubmitStreamFrame(StreamServer &server, const U32 *pPixels)
+    {
+        {
+            const std::lock_guard lock(server.m_mutex);
+            server.m_numReplaced += server.m_hasPending ? 1 : 0;
+            std::memcpy(server.m_pPending, pPixels, static_cast<std::size_t>(server.m_width) * server.m_height * 4);
+            server.m_hasPending = true;
+        }
+        server.m_wake.notify_one();
+    }
+
+    inline void CloseStreamServer(StreamServer &server)
+    {
+        if (!IsStreamServerOpen(server))
+        {
+            return;
+        }
+        {
+            const std::lock_guard lock(server.m_mutex);
+            server.m_isClosing = true;
+        }
+        server.m_wake.notify_one();
+        server.m_thread.join();
+        for (U32 iClient = 0; iClient < server.m_numClients; ++iClient)
+        {
+            CloseSocket(server.m_clients[iClient]);
+        }
+        CloseSocket(server.m_listener);
+#if !defined(_WIN32)
+        if (server.m_pUnixPath)
+        {
+            unlink(server.m_pUnixPath);
+        }
+#endif
+        ShutdownSockets();
+        std::fprintf(stderr, "Streamed %u frames, %llu KB sent for %llu KB of RGB, %llu replaced before sending\n",
+                     server.m_numFrames, static_cast<unsigned long long>(server.m_numSentBytes / 1024),
+                     static_cast<unsigned long long>(server.m_numRawBytes / 1024),
+                     static_cast<unsigned long long>(server.m_numReplaced));
+        FreePages(server.m_buffers);
+        server.m_buffers = PageAllocation{};
+        server.m_listener = kInvalidSocket;
+        server.m_numClients = 0;
+    }
+}
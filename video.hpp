@@ -0,0 +1,548 @@
+#pragma once
+
+#include <cerrno>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
+#include <common.hpp>
+#include <format.hpp>
+#include <memory.hpp>
+
+#if defined(_WIN32)
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <csignal>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#define ENGINE_HAS_IO_URING 1
+#endif
+
+namespace Engine
+{
+    enum class VideoContainer : U8
+    {
+        // Frames back to back in their pixel format, without any header.
+        kRaw,
+        // YUV4MPEG2 stream header followed by FRAME marked I420 frames.
+        kY4m,
+    };
+
+    // Frames that can be queued behind the writer before the renderer starts dropping them.
+    static constexpr U32 kVideoPoolSize = 4;
+    static constexpr char kY4mFrameMarker[] = "FRAME\n";
+
+#if defined(ENGINE_HAS_IO_URING)
+    // Minimal io_uring over raw syscalls, only what the writer needs: one write per entry and blocking reaps.
+    struct IoUring
+    {
+        int m_fd = -1;
+        void *m_pSqRing = nullptr;
+        std::size_t m_sqRingSize = 0;
+        void *m_pCqRing = nullptr;
+        std::size_t m_cqRingSize = 0;
+        io_uring_sqe *m_pSqes = nullptr;
+        std::size_t m_sqesSize = 0;
+        U32 *m_pSqTail = nullptr;
+        U32 *m_pSqMask = nullptr;
+        U32 *m_pSqArray = nullptr;
+        U32 *m_pCqHead = nullptr;
+        U32 *m_pCqTail = nullptr;
+        U32 *m_pCqMask = nullptr;
+        io_uring_cqe *m_pCqes = nullptr;
+    };
+
+    inline void CloseIoUring(IoUring &ring)
+    {
+        if (ring.m_pSqes)
+        {
+            munmap(ring.m_pSqes, ring.m_sqesSize);
+        }
+        if (ring.m_pCqRing && ring.m_pCqRing != ring.m_pSqRing)
+        {
+            munmap(ring.m_pCqRing, ring.m_cqRingSize);
+        }
+        if (ring.m_pSqRing)
+        {
+            munmap(ring.m_pSqRing, ring.m_sqRingSize);
+        }
+        if (ring.m_fd >= 0)
+        {
+            close(ring.m_fd);
+        }
+        ring = IoUring{};
+    }
+
+    // Fails on kernels without io_uring or where it is disabled, e.g. by a seccomp profile.
+    inline bool SetupIoUring(IoUring &ring, const U32 numEntries)
+    {
+        io_uring_params params{};
+        ring.m_fd = static_cast<int>(syscall(__NR_io_uring_setup, numEntries, &params));
+        if (ring.m_fd < 0)
+        {
+            ring.m_fd = -1;
+            return false;
+        }
+        ring.m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(U32);
+        ring.m_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        const bool isSingleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (isSingleMap)
+        {
+            ring.m_sqRingSize = ring.m_cqRingSize =
+                ring.m_sqRingSize > ring.m_cqRingSize ? ring.m_sqRingSize : ring.m_cqRingSize;
+        }
+        constexpr int kProtection = PROT_READ | PROT_WRITE;
+        constexpr int kFlags = MAP_SHARED | MAP_POPULATE;
+        void *pSqRing = mmap(nullptr, ring.m_sqRingSize, kProtection, kFlags, ring.m_fd, IORING_OFF_SQ_RING);
+        ring.m_pSqRing = pSqRing != MAP_FAILED ? pSqRing : nullptr;
+        void *pCqRing = isSingleMap
+                            ? pSqRing
+                            : mmap(nullptr, ring.m_cqRingSize, kProtection, kFlags, ring.m_fd, IORING_OFF_CQ_RING);
+        ring.m_pCqRing = pCqRing != MAP_FAILED ? pCqRing : nullptr;
+        ring.m_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+        void *pSqes = mmap(nullptr, ring.m_sqesSize, kProtection, kFlags, ring.m_fd, IORING_OFF_SQES);
+        ring.m_pSqes = pSqes != MAP_FAILED ? static_cast<io_uring_sqe *>(pSqes) : nullptr;
+        if (!ring.m_pSqRing || !ring.m_pCqRing || !ring.m_pSqes)
+        {
+            CloseIoUring(ring);
+            return false;
+        }
+        U8 *pSq = static_cast<U8 *>(ring.m_pSqRing);
+        U8 *pCq = static_cast<U8 *>(ring.m_pCqRing);
+        ring.m_pSqTail = reinterpret_cast<U32 *>(pSq + params.sq_off.tail);
+        ring.m_pSqMask = reinterpret_cast<U32 *>(pSq + params.sq_off.ring_mask);
+        ring.m_pSqArray = reinterpret_cast<U32 *>(pSq + params.sq_off.array);
+        ring.m_pCqHead = reinterpret_cast<U32 *>(pCq + params.cq_off.head);
+        ring.m_pCqTail = reinterpret_cast<U32 *>(pCq + params.cq_off.tail);
+        ring.m_pCqMask = reinterpret_cast<U32 *>(pCq + params.cq_off.ring_mask);
+        ring.m_pCqes = reinterpret_cast<io_uring_cqe *>(pCq + params.cq_off.cqes);
+        return true;
+    }
+
+    // Queues and submits a single write, offset -1 writes at the file position for pipes.
+    inline bool SubmitIoUringWrite(IoUring &ring, const int fd, const void *pData, const U32 size, const U64 offset,
+                                   const U64 userData)
+    {
+        const U32 tail = *ring.m_pSqTail;
+        const U32 index = tail & *ring.m_pSqMask;
+        io_uring_sqe &sqe = ring.m_pSqes[index];
+        std::memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = IORING_OP_WRITE;
+        sqe.fd = fd;
+        sqe.addr = reinterpret_cast<U64>(pData);
+        sqe.len = size;
+        sqe.off = offset;
+        sqe.user_data = userData;
+        ring.m_pSqArray[index] = index;
+        __atomic_store_n(ring.m_pSqTail, tail + 1, __ATOMIC_RELEASE);
+        return syscall(__NR_io_uring_enter, ring.m_fd, 1, 0, 0, nullptr, 0) == 1;
+    }
+
+    // Blocks until at least one write completed, then hands every available completion to visit.
+    template<typename Visit>
+    void ReapIoUring(IoUring &ring, Visit visit)
+    {
+        U32 head = *ring.m_pCqHead;
+        while (head == __atomic_load_n(ring.m_pCqTail, __ATOMIC_ACQUIRE))
+        {
+            syscall(__NR_io_uring_enter, ring.m_fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+        }
+        for (; head != __atomic_load_n(ring.m_pCqTail, __ATOMIC_ACQUIRE); ++head)
+        {
+            const io_uring_cqe &cqe = ring.m_pCqes[head & *ring.m_pCqMask];
+            visit(cqe.user_data, cqe.res);
+        }
+        __atomic_store_n(ring.m_pCqHead, head, __ATOMIC_RELEASE);
+    }
+#endif
+
+    struct VideoSlot
+    {
+        // File offset of the frame, writes can complete partially and are resumed from there.
+        U64 m_offset = 0;
+        U32 m_written = 0;
+        bool m_isDone = false;
+    };
+
+    // Streams frames to a file or pipe from a writer thread. The renderer converts straight into a pool buffer and
+    // submits it, and never waits for I/O: when the writer falls behind by kVideoPoolSize frames, frames are dropped
+    // and counted instead.
+    struct VideoSink
+    {
+        VideoContainer m_container = VideoContainer::kRaw;
+        PixelFormat m_format = PixelFormat::kBgra32;
+        U32 m_width = 0;
+        U32 m_height = 0;
+#if defined(_WIN32)
+        std::FILE *m_pFile = nullptr;
+#else
+        int m_fd = -1;
+        // Regular files get explicit offsets so several writes can be in flight, pipes are written one at a time.
+        bool m_isSeekable = false;
+        U64 m_fileOffset = 0;
+#endif
+#if defined(ENGINE_HAS_IO_URING)
+        IoUring m_ring;
+#endif
+        bool m_isUsingIoUring = false;
+
+        PageAllocation m_pool;
+        U32 m_slotSize = 0;
+        U32 m_frameOffset = 0;
+        VideoSlot m_slots[kVideoPoolSize];
+
+        std::thread m_writer;
+        std::mutex m_mutex;
+        std::condition_variable m_wake;
+        // Frames handed over by the renderer, issued to the OS, and fully written, all monotonic.
+        U64 m_numSubmitted = 0;
+        U64 m_numIssued = 0;
+        U64 m_numWritten = 0;
+        U64 m_numDropped = 0;
+        // Frames queued when the pipe broke, they are retired without being written.
+        U64 m_numDiscarded = 0;
+        bool m_isClosing = false;
+        bool m_hasFailed = false;
+        // The reader closed its end of the pipe. The writer stops writing and the renderer closes the sink.
+        bool m_isBroken = false;
+    };
+
+    inline bool IsVideoSinkOpen(const VideoSink &sink)
+    {
+        return sink.m_pool.m_pData != nullptr;
+    }
+
+    inline bool IsVideoSinkBroken(const VideoSink &sink)
+    {
+        return __atomic_load_n(&sink.m_isBroken, __ATOMIC_ACQUIRE);
+    }
+
+    // A pipe whose reader went away stays broken, so every later frame would fail the same way.
+    inline void FailVideoWrite(VideoSink &sink, const int error)
+    {
+        sink.m_hasFailed = true;
+        if (error == EPIPE)
+        {
+            __atomic_store_n(&sink.m_isBroken, true, __ATOMIC_RELEASE);
+        }
+    }
+
+    inline U8 *VideoSlotData(const VideoSink &sink, const U64 iFrame)
+    {
+        return static_cast<U8 *>(sink.m_pool.m_pData) + iFrame % kVideoPoolSize * sink.m_slotSize;
+    }
+
+    // Blocking write of everything, used for the stream header and whenever io_uring is unavailable. Seekable files
+    // are written at offset, which keeps the frame order when other writes are still in flight.
+    inline bool WriteAll(VideoSink &sink, const U8 *pData, std::size_t size, [[maybe_unused]] const U64 offset = ~0ull)
+    {
+#if defined(_WIN32)
+        return std::fwrite(pData, 1, size, sink.m_pFile) == size;
+#else
+        const bool isPositioned = sink.m_isSeekable && offset != ~0ull;
+        for (U64 written = 0; size > 0;)
+        {
+            const ssize_t result = isPositioned ? pwrite(sink.m_fd, pData, size, static_cast<off_t>(offset + written))
+                                                : write(sink.m_fd, pData, size);
+            if (result < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (result <= 0)
+            {
+                return false;
+            }
+            pData += result;
+            size -= static_cast<std::size_t>(result);
+            written += static_cast<U64>(result);
+        }
+        return true;
+#endif
+    }
+
+    inline void WriterMain(VideoSink &sink)
+    {
+        U32 numInFlight = 0;
+#if !defined(_WIN32)
+        const U32 maxInFlight = sink.m_isSeekable ? kVideoPoolSize : 1;
+#endif
+        const auto completeFrame = [&sink](const U64 iFrame) {
+            sink.m_slots[iFrame % kVideoPoolSize].m_isDone = true;
+            const std::lock_guard lock(sink.m_mutex);
+            // Completions can arrive out of order, slots are only recycled in order.
+            while (sink.m_numWritten < sink.m_numIssued && sink.m_slots[sink.m_numWritten % kVideoPoolSize].m_isDone)
+            {
+                sink.m_slots[sink.m_numWritten % kVideoPoolSize] = VideoSlot{};
+                ++sink.m_numWritten;
+            }
+        };
+        const auto discardFrame = [&](const U64 iFrame) {
+            ++sink.m_numDiscarded;
+            completeFrame(iFrame);
+        };
+        for (;;)
+        {
+            U64 numSubmitted;
+            bool isClosing;
+            {
+                std::unique_lock lock(sink.m_mutex);
+                if (numInFlight == 0)
+                {
+                    sink.m_wake.wait(lock, [&sink] {
+                        return sink.m_isClosing || sink.m_numIssued < sink.m_numSubmitted;
+                    });
+                }
+                numSubmitted = sink.m_numSubmitted;
+                isClosing = sink.m_isClosing;
+            }
+            if (numInFlight == 0 && isClosing && sink.m_numIssued == numSubmitted)
+            {
+                return;
+            }
+#if defined(ENGINE_HAS_IO_URING)
+            if (sink.m_isUsingIoUring)
+            {
+                const auto submit = [&sink](const U64 iFrame) {
+                    const VideoSlot &slot = sink.m_slots[iFrame % kVideoPoolSize];
+                    return SubmitIoUringWrite(sink.m_ring, sink.m_fd, VideoSlotData(sink, iFrame) + slot.m_written,
+                                              sink.m_slotSize - slot.m_written,
+                                              sink.m_isSeekable ? slot.m_offset + slot.m_written : ~0ull, iFrame);
+                };
+                // A write io_uring refused, e.g. on kernels without IORING_OP_WRITE, is finished synchronously.
+                const auto finishBlocking = [&](const U64 iFrame) {
+                    if (IsVideoSinkBroken(sink))
+                    {
+                        discardFrame(iFrame);
+                        return;
+                    }
+                    const VideoSlot &slot = sink.m_slots[iFrame % kVideoPoolSize];
+                    if (!WriteAll(sink, VideoSlotData(sink, iFrame) + slot.m_written, sink.m_slotSize - slot.m_written,
+                                  slot.m_offset + slot.m_written))
+                    {
+                        FailVideoWrite(sink, errno);
+                    }
+                    completeFrame(iFrame);
+                };
+                for (; sink.m_numIssued < numSubmitted && numInFlight < maxInFlight; ++sink.m_numIssued)
+                {
+                    const U64 iFrame = sink.m_numIssued;
+                    sink.m_slots[iFrame % kVideoPoolSize].m_offset = sink.m_fileOffset;
+                    sink.m_fileOffset += sink.m_slotSize;
+                    if (IsVideoSinkBroken(sink))
+                    {
+                        discardFrame(iFrame);
+                    }
+                    else if (submit(iFrame))
+                    {
+                        ++numInFlight;
+                    }
+                    else
+                    {
+                        finishBlocking(iFrame);
+                    }
+                }
+                if (numInFlight > 0)
+                {
+                    ReapIoUring(sink.m_ring, [&](const U64 iFrame, const I32 result) {
+                        VideoSlot &slot = sink.m_slots[iFrame % kVideoPoolSize];
+                        if (result > 0)
+                        {
+                            slot.m_written += static_cast<U32>(result);
+                        }
+                        else if (result == -EPIPE)
+                        {
+                            FailVideoWrite(sink, EPIPE);
+                        }
+                        if (result > 0 && slot.m_written < sink.m_slotSize && submit(iFrame))
+                        {
+                            // Short write, the rest of the frame stays in flight.
+                            return;
+                        }
+                        --numInFlight;
+                        if (slot.m_written < sink.m_slotSize)
+                        {
+                            finishBlocking(iFrame);
+                        }
+                        else
+                        {
+                            completeFrame(iFrame);
+                        }
+                    });
+                }
+                continue;
+            }
+#endif
+            for (; sink.m_numIssued < numSubmitted; ++sink.m_numIssued)
+            {
+                if (IsVideoSinkBroken(sink))
+                {
+                    discardFrame(sink.m_numIssued);
+                    continue;
+                }
+                if (!WriteAll(sink, VideoSlotData(sink, sink.m_numIssued), sink.m_slotSize))
+                {
+                    FailVideoWrite(sink, errno);
+                }
+                completeFrame(sink.m_numIssued);
+            }
+        }
+    }
+
+    // Opens path for writing, "-" is standard output. Y4M needs I420 frames, raw takes any format.
+    inline bool OpenVideoSink(VideoSink &sink, const char *path, const VideoContainer container,
+                              const PixelFormat format, const U32 width, const U32 height, const U32 frameRate)
+    {
+        const bool isStdout = std::strcmp(path, "-") == 0;
+#if defined(_WIN32)
+        if (isStdout)
+        {
+            _setmode(_fileno(stdout), _O_BINARY);
+        }
+        sink.m_pFile = isStdout ? stdout : std::fopen(path, "wb");
+        if (!sink.m_pFile)
+        {
+            return false;
+        }
+#else
+        sink.m_fd = isStdout ? STDOUT_FILENO : open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (sink.m_fd < 0)
+        {
+            return false;
+        }
+        struct stat status;
+        sink.m_isSeekable = fstat(sink.m_fd, &status) == 0 && S_ISREG(status.st_mode) &&
+                            lseek(sink.m_fd, 0, SEEK_CUR) >= 0;
+        // A reader that exits, e.g. ffmpeg at the end of a pipe, would otherwise kill the engine with SIGPIPE on the
+        // next write. Ignored for the whole process rather than masked on the writer thread, since io_uring can
+        // complete the write on a kernel worker. Writes then fail with EPIPE and the sink is closed.
+        if (!sink.m_isSeekable)
+        {
+            std::signal(SIGPIPE, SIG_IGN);
+        }
+#endif
+        sink.m_container = container;
+        sink.m_format = format;
+        sink.m_width = width;
+        sink.m_height = height;
+        sink.m_frameOffset = container == VideoContainer::kY4m ? sizeof(kY4mFrameMarker) - 1 : 0;
+        sink.m_slotSize = sink.m_frameOffset + static_cast<U32>(FrameImageSize(format, width, height));
+        sink.m_pool = AllocatePages(static_cast<std::size_t>(sink.m_slotSize) * kVideoPoolSize, false);
+        if (!sink.m_pool.m_pData)
+        {
+            return false;
+        }
+        for (U32 iSlot = 0; iSlot < kVideoPoolSize; ++iSlot)
+        {
+            std::memcpy(VideoSlotData(sink, iSlot), kY4mFrameMarker, sink.m_frameOffset);
+        }
+
+        if (container == VideoContainer::kY4m)
+        {
+            // Chroma is box filtered between luma samples, which is what 420jpeg describes.
+            char header[128];
+            const int length = std::snprintf(header, sizeof(header), "YUV4MPEG2 W%u H%u F%u:1 Ip A1:1 C420jpeg\n",
+                                             width, height, frameRate);
+            if (!WriteAll(sink, reinterpret_cast<const U8 *>(header), static_cast<std::size_t>(length)))
+            {
+                return false;
+            }
+        }
+#if !defined(_WIN32)
+        if (sink.m_isSeekable)
+        {
+            sink.m_fileOffset = static_cast<U64>(lseek(sink.m_fd, 0, SEEK_CUR));
+        }
+#endif
+#if defined(ENGINE_HAS_IO_URING)
+        sink.m_isUsingIoUring = SetupIoUring(sink.m_ring, kVideoPoolSize * 2);
+#endif
+        sink.m_writer = std::thread(WriterMain, std::ref(sink));
+        return true;
+    }
+
+    // Points image at the next free pool buffer. Returns false and counts a dropped frame when the writer is
+    // kVideoPoolSize frames behind.
+    inline bool AcquireVideoFrame(VideoSink &sink, FrameImage &image)
+    {
+        if (IsVideoSinkBroken(sink))
+        {
+            return false;
+        }
+        const std::lock_guard lock(sink.m_mutex);
+        if (sink.m_numSubmitted - sink.m_numWritten == kVideoPoolSize)
+        {
+            ++sink.m_numDropped;
+            return false;
+        }
+        image = MakeFrameImage(sink.m_format, sink.m_width, sink.m_height,
+                               VideoSlotData(sink, sink.m_numSubmitted) + sink.m_frameOffset);
+        return true;
+    }
+
+    // Hands the frame filled since AcquireVideoFrame to the writer.
+    inline void SubmitVideoFrame(VideoSink &sink)
+    {
+        {
+            const std::lock_guard lock(sink.m_mutex);
+            ++sink.m_numSubmitted;
+        }
+        sink.m_wake.notify_one();
+    }
+
+    // Drains the queued frames, stops the writer and reports how the recording went.
+    inline void CloseVideoSink(VideoSink &sink)
+    {
+        if (!IsVideoSinkOpen(sink))
+        {
+            return;
+        }
+        if (sink.m_writer.joinable())
+        {
+            {
+                const std::lock_guard lock(sink.m_mutex);
+                sink.m_isClosing = true;
+            }
+            sink.m_wake.notify_one();
+            sink.m_writer.join();
+        }
+        const char *failure = "";
+        if (sink.m_isBroken)
+        {
+            failure = ", stopped after the reader closed the pipe";
+        }
+        else if (sink.m_hasFailed)
+        {
+            failure = ", some writes failed";
+        }
+        std::fprintf(stderr, "Recorded %llu frames with %s, dropped %llu%s\n",
+                     static_cast<unsigned long long>(sink.m_numWritten - sink.m_numDiscarded),
+                     sink.m_isUsingIoUring ? "io_uring" : "blocking writes",
+                     static_cast<unsigned long long>(sink.m_numDropped + sink.m_numDiscarded), failure);
+#if defined(ENGINE_HAS_IO_URING)
+        CloseIoUring(sink.m_ring);
+#endif
+#if defined(_WIN32)
+        if (sink.m_pFile != stdout)
+        {
+            std::fclose(sink.m_pFile);
+        }
+#else
+        if (sink.m_fd != STDOUT_FILENO)
+        {
+            close(sink.m_fd);
+        }
+#endif
+        FreePages(sink.m_pool);
+        sink.m_pool = PageAllocation{};
+    }
+}